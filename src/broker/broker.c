@@ -9,6 +9,7 @@
 #include <sys/epoll.h>
 #include <sys/signalfd.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include "broker/broker.h"
 #include "broker/controller.h"
@@ -19,9 +20,12 @@
 #include "util/dispatch.h"
 #include "util/error.h"
 #include "util/log.h"
+#include "util/pool.h"
 #include "util/proc.h"
 #include "util/user.h"
 
+#define BROKER_POOL_TRIM_INTERVAL_SEC (5)
+
 static int broker_dispatch_signals(DispatchFile *file) {
         Broker *broker = c_container_of(file, Broker, signals_file);
         struct signalfd_siginfo si;
@@ -38,7 +42,66 @@ static int broker_dispatch_signals(DispatchFile *file) {
         return DISPATCH_E_EXIT;
 }
 
-int broker_new(Broker **brokerp, const char *machine_id, int log_fd, int controller_fd, uint64_t max_bytes, uint64_t max_fds, uint64_t max_matches, uint64_t max_objects) {
+static int broker_dispatch_trim(DispatchFile *file) {
+        Broker *broker = c_container_of(file, Broker, trim_file);
+        uint64_t n_expirations;
+        ssize_t l;
+
+        assert(dispatch_file_events(file) == EPOLLIN);
+
+        l = read(broker->trim_fd, &n_expirations, sizeof(n_expirations));
+        if (l < 0) {
+                if (errno == EAGAIN) {
+                        dispatch_file_clear(file, EPOLLIN);
+                        return 0;
+                }
+
+                return error_origin(-errno);
+        }
+
+        assert(l == sizeof(n_expirations));
+
+        /*
+         * The timer is one-shot, so it cannot expire again before it is
+         * re-armed by broker_schedule_trim().
+         */
+        dispatch_file_clear(file, EPOLLIN);
+        broker->trim_armed = false;
+
+        pool_trim_all();
+
+        return 0;
+}
+
+static int broker_schedule_trim(Broker *broker) {
+        int r;
+
+        /*
+         * As long as the object pools cache anything, we arm a one-shot timer
+         * and shrink the pools whenever it expires. Hence, memory cached
+         * during a burst is returned even if the bus stays idle afterwards.
+         * The timer is only armed while there is something to release, so an
+         * idle bus with empty pools is never woken up. pool_trim() releases
+         * only objects that were unused since its previous call, so objects
+         * must stay unused for a whole interval before they are released.
+         */
+        if (broker->trim_armed || !pool_has_cached())
+                return 0;
+
+        r = timerfd_settime(broker->trim_fd,
+                            0,
+                            &(struct itimerspec){
+                                .it_value.tv_sec = BROKER_POOL_TRIM_INTERVAL_SEC,
+                            },
+                            NULL);
+        if (r < 0)
+                return error_origin(-errno);
+
+        broker->trim_armed = true;
+        return 0;
+}
+
+int broker_new(Broker **brokerp, const char *machine_id, int log_fd, int controller_fd, uint64_t max_bytes, uint64_t max_fds, uint64_t max_matches, uint64_t max_objects, uint64_t write_bytes, uint64_t write_vectors, uint64_t dispatch_messages, uint64_t dispatch_bytes) {
         _c_cleanup_(broker_freep) Broker *broker = NULL;
         struct ucred ucred;
         socklen_t z;
@@ -66,6 +129,8 @@ int broker_new(Broker **brokerp, const char *machine_id, int log_fd, int control
         broker->dispatcher = (DispatchContext)DISPATCH_CONTEXT_NULL(broker->dispatcher);
         broker->signals_fd = -1;
         broker->signals_file = (DispatchFile)DISPATCH_FILE_NULL(broker->signals_file);
+        broker->trim_fd = -1;
+        broker->trim_file = (DispatchFile)DISPATCH_FILE_NULL(broker->trim_file);
         broker->controller = (Controller)CONTROLLER_NULL(broker->controller);
 
         if (log_fd < 0)
@@ -84,6 +149,9 @@ int broker_new(Broker **brokerp, const char *machine_id, int log_fd, int control
         if (r)
                 return error_fold(r);
 
+        broker->bus.write_bytes = write_bytes;
+        broker->bus.write_vectors = write_vectors;
+
         /*
          * XXX: We need the seclabel to run the broker for 2 reasons: First,
          *      if 'org.freedesktop.DBus' is queried for the seclabel, we need
@@ -112,6 +180,9 @@ int broker_new(Broker **brokerp, const char *machine_id, int log_fd, int control
         if (r)
                 return error_fold(r);
 
+        broker->dispatcher.budget_items = dispatch_messages;
+        broker->dispatcher.budget_bytes = dispatch_bytes;
+
         sigemptyset(&sigmask);
         sigaddset(&sigmask, SIGTERM);
         sigaddset(&sigmask, SIGINT);
@@ -129,8 +200,24 @@ int broker_new(Broker **brokerp, const char *machine_id, int log_fd, int control
         if (r)
                 return error_fold(r);
 
+        dispatch_file_set_priority(&broker->signals_file, DISPATCH_PRIORITY_CONTROLLER);
         dispatch_file_select(&broker->signals_file, EPOLLIN);
 
+        broker->trim_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        if (broker->trim_fd < 0)
+                return error_origin(-errno);
+
+        r = dispatch_file_init(&broker->trim_file,
+                               &broker->dispatcher,
+                               broker_dispatch_trim,
+                               broker->trim_fd,
+                               EPOLLIN,
+                               0);
+        if (r)
+                return error_fold(r);
+
+        dispatch_file_select(&broker->trim_file, EPOLLIN);
+
         r = controller_init(&broker->controller, broker, controller_fd);
         if (r)
                 return error_fold(r);
@@ -145,6 +232,8 @@ Broker *broker_free(Broker *broker) {
                 return NULL;
 
         controller_deinit(&broker->controller);
+        dispatch_file_deinit(&broker->trim_file);
+        c_close(broker->trim_fd);
         dispatch_file_deinit(&broker->signals_file);
         c_close(broker->signals_fd);
         dispatch_context_deinit(&broker->dispatcher);
@@ -172,6 +261,12 @@ int broker_run(Broker *broker) {
                 return error_fold(r);
 
         do {
+                r = broker_schedule_trim(broker);
+                if (r) {
+                        r = error_fold(r);
+                        break;
+                }
+
                 r = dispatch_context_dispatch(&broker->dispatcher);
                 if (r == DISPATCH_E_EXIT)
                         r = MAIN_EXIT;
@@ -182,6 +277,8 @@ int broker_run(Broker *broker) {
         } while (!r);
 
         peer_registry_flush(&broker->bus.peers);
+        pool_flush_all();
+        message_flush_signatures();
 
         sigprocmask(SIG_SETMASK, &sigold, NULL);
 
@@ -28,12 +28,16 @@ struct Broker {
         int signals_fd;
         DispatchFile signals_file;
 
+        int trim_fd;
+        DispatchFile trim_file;
+        bool trim_armed;
+
         Controller controller;
 };
 
 /* broker */
 
-int broker_new(Broker **brokerp, const char *machine_id, int log_fd, int controller_fd, uint64_t max_bytes, uint64_t max_fds, uint64_t max_matches, uint64_t max_objects);
+int broker_new(Broker **brokerp, const char *machine_id, int log_fd, int controller_fd, uint64_t max_bytes, uint64_t max_fds, uint64_t max_matches, uint64_t max_objects, uint64_t write_bytes, uint64_t write_vectors, uint64_t dispatch_messages, uint64_t dispatch_bytes);
 Broker *broker_free(Broker *broker);
 
 int broker_run(Broker *broker);
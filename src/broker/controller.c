@@ -14,6 +14,7 @@
 #include "bus/policy.h"
 #include "dbus/connection.h"
 #include "dbus/message.h"
+#include "util/dispatch.h"
 #include "util/error.h"
 #include "util/sockopt.h"
 #include "util/user.h"
@@ -260,6 +261,9 @@ int controller_init(Controller *c, Broker *broker, int controller_fd) {
         if (r)
                 return error_fold(r);
 
+        /* activation and reload requests must not queue behind bus traffic */
+        dispatch_file_set_priority(&controller->connection.socket_file, DISPATCH_PRIORITY_CONTROLLER);
+
         controller = NULL;
         return 0;
 }
@@ -10,6 +10,7 @@
 #include <sys/types.h>
 #include "broker/broker.h"
 #include "broker/main.h"
+#include "dbus/socket.h"
 #include "util/audit.h"
 #include "util/error.h"
 #include "util/selinux.h"
@@ -22,6 +23,10 @@ uint64_t main_arg_max_bytes = 16 * 1024 * 1024;
 uint64_t main_arg_max_fds = 64;
 uint64_t main_arg_max_matches = 16 * 1024;
 uint64_t main_arg_max_objects = 16 * 1024;
+uint64_t main_arg_write_bytes = SOCKET_WRITE_BYTES_DEFAULT;
+uint64_t main_arg_write_vectors = SOCKET_WRITE_VECS_MAX;
+uint64_t main_arg_dispatch_messages = 64;
+uint64_t main_arg_dispatch_bytes = 512 * 1024;
 
 static void help(void) {
         printf("%s [GLOBALS...] ...\n\n"
@@ -30,12 +35,16 @@ static void help(void) {
                "     --version                  Show package version\n"
                "     --audit                    Log to the audit subsystem\n"
                "     --controller FD            Specify controller file-descriptor\n"
+               "     --dispatch-bytes BYTES     Maximum number of bytes read from a single peer per dispatch round\n"
+               "     --dispatch-messages MSGS   Maximum number of messages read from a single peer per dispatch round\n"
                "     --log FD                   Provide logging socket\n"
                "     --machine-id MACHINE_ID    Machine ID of the current machine\n"
                "     --max-bytes BYTES          Maximum number of bytes each user may allocate in the broker\n"
                "     --max-fds FDS              Maximum number of file descriptors each user may allocate in the broker\n"
                "     --max-matches MATCHES      Maximum number of match rules each user may allocate in the broker\n"
                "     --max-objects OBJECTS      Maximum total number of names, peers, pending replies, etc each user may allocate in the broker\n"
+               "     --write-bytes BYTES        Maximum number of bytes of queued messages coalesced into a single write\n"
+               "     --write-vectors VECTORS    Maximum number of I/O vectors of queued messages coalesced into a single write\n"
                , program_invocation_short_name);
 }
 
@@ -44,24 +53,32 @@ static int parse_argv(int argc, char *argv[]) {
                 ARG_VERSION = 0x100,
                 ARG_AUDIT,
                 ARG_CONTROLLER,
+                ARG_DISPATCH_BYTES,
+                ARG_DISPATCH_MESSAGES,
                 ARG_LOG,
                 ARG_MACHINE_ID,
                 ARG_MAX_BYTES,
                 ARG_MAX_FDS,
                 ARG_MAX_MATCHES,
                 ARG_MAX_OBJECTS,
+                ARG_WRITE_BYTES,
+                ARG_WRITE_VECTORS,
         };
         static const struct option options[] = {
                 { "help",               no_argument,            NULL,   'h'                     },
                 { "version",            no_argument,            NULL,   ARG_VERSION             },
                 { "audit",              no_argument,            NULL,   ARG_AUDIT               },
                 { "controller",         required_argument,      NULL,   ARG_CONTROLLER          },
+                { "dispatch-bytes",     required_argument,      NULL,   ARG_DISPATCH_BYTES      },
+                { "dispatch-messages",  required_argument,      NULL,   ARG_DISPATCH_MESSAGES   },
                 { "log",                required_argument,      NULL,   ARG_LOG                 },
                 { "machine-id",         required_argument,      NULL,   ARG_MACHINE_ID          },
                 { "max-bytes",          required_argument,      NULL,   ARG_MAX_BYTES           },
                 { "max-fds",            required_argument,      NULL,   ARG_MAX_FDS             },
                 { "max-matches",        required_argument,      NULL,   ARG_MAX_MATCHES         },
                 { "max-objects",        required_argument,      NULL,   ARG_MAX_OBJECTS         },
+                { "write-bytes",        required_argument,      NULL,   ARG_WRITE_BYTES         },
+                { "write-vectors",      required_argument,      NULL,   ARG_WRITE_VECTORS       },
                 {}
         };
         int r, c;
@@ -180,6 +197,66 @@ static int parse_argv(int argc, char *argv[]) {
                         break;
                 }
 
+                case ARG_DISPATCH_BYTES: {
+                        unsigned long long vul;
+                        char *end;
+
+                        errno = 0;
+                        vul = strtoull(optarg, &end, 10);
+                        if (errno != 0 || *end || optarg == end) {
+                                fprintf(stderr, "%s: invalid number of dispatch bytes -- '%s'\n", program_invocation_name, optarg);
+                                return MAIN_FAILED;
+                        }
+
+                        main_arg_dispatch_bytes = vul;
+                        break;
+                }
+
+                case ARG_DISPATCH_MESSAGES: {
+                        unsigned long long vul;
+                        char *end;
+
+                        errno = 0;
+                        vul = strtoull(optarg, &end, 10);
+                        if (errno != 0 || *end || optarg == end) {
+                                fprintf(stderr, "%s: invalid number of dispatch messages -- '%s'\n", program_invocation_name, optarg);
+                                return MAIN_FAILED;
+                        }
+
+                        main_arg_dispatch_messages = vul;
+                        break;
+                }
+
+                case ARG_WRITE_BYTES: {
+                        unsigned long long vul;
+                        char *end;
+
+                        errno = 0;
+                        vul = strtoull(optarg, &end, 10);
+                        if (errno != 0 || *end || optarg == end) {
+                                fprintf(stderr, "%s: invalid number of write bytes -- '%s'\n", program_invocation_name, optarg);
+                                return MAIN_FAILED;
+                        }
+
+                        main_arg_write_bytes = vul;
+                        break;
+                }
+
+                case ARG_WRITE_VECTORS: {
+                        unsigned long long vul;
+                        char *end;
+
+                        errno = 0;
+                        vul = strtoull(optarg, &end, 10);
+                        if (errno != 0 || *end || optarg == end || vul < 1 || vul > SOCKET_WRITE_VECS_MAX) {
+                                fprintf(stderr, "%s: invalid number of write vectors -- '%s'\n", program_invocation_name, optarg);
+                                return MAIN_FAILED;
+                        }
+
+                        main_arg_write_vectors = vul;
+                        break;
+                }
+
                 case '?':
                         /* getopt_long() prints warning */
                         return MAIN_FAILED;
@@ -260,7 +337,7 @@ static int run(void) {
         _c_cleanup_(broker_freep) Broker *broker = NULL;
         int r;
 
-        r = broker_new(&broker, main_arg_machine_id, main_arg_log, main_arg_controller, main_arg_max_bytes, main_arg_max_fds, main_arg_max_matches, main_arg_max_objects);
+        r = broker_new(&broker, main_arg_machine_id, main_arg_log, main_arg_controller, main_arg_max_bytes, main_arg_max_fds, main_arg_max_matches, main_arg_max_objects, main_arg_write_bytes, main_arg_write_vectors, main_arg_dispatch_messages, main_arg_dispatch_bytes);
         if (!r)
                 r = broker_run(broker);
 
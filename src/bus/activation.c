@@ -32,7 +32,7 @@ ActivationMessage *activation_message_free(ActivationMessage *message) {
                 return NULL;
 
         name_snapshot_free(message->senders_names);
-        policy_snapshot_free(message->senders_policy);
+        policy_snapshot_unref(message->senders_policy);
         message_unref(message->message);
         c_list_unlink(&message->link);
         user_charge_deinit(&message->charges[1]);
@@ -127,9 +127,7 @@ int activation_queue_message(Activation *activation,
         if (r)
                 return (r == USER_E_QUOTA) ? ACTIVATION_E_QUOTA : error_fold(r);
 
-        r = policy_snapshot_dup(policy, &message->senders_policy);
-        if (r)
-                return error_fold(r);
+        message->senders_policy = policy_snapshot_ref(policy);
 
         r = name_snapshot_new(&message->senders_names, names);
         if (r)
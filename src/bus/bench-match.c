@@ -0,0 +1,113 @@
+/*
+ * Benchmark Match Registry Lookups
+ *
+ * This is not a test and is not run as part of the test-suite. It prints the
+ * cost of broadcast lookups, so changes to the match registry can be compared.
+ */
+
+#include <c-macro.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "bus/match.h"
+#include "dbus/message.h"
+#include "dbus/protocol.h"
+#include "util/hash.h"
+
+static size_t bench_count_subscribers(MatchRegistry *registry, MessageMetadata *metadata) {
+        CList subscribers = C_LIST_INIT(subscribers);
+        MatchOwner *owner;
+        size_t n = 0;
+
+        match_registry_get_subscribers(registry, &subscribers, metadata, NULL);
+
+        while ((owner = c_list_first_entry(&subscribers, MatchOwner, destinations_link))) {
+                c_list_unlink(&owner->destinations_link);
+                ++n;
+        }
+
+        return n;
+}
+
+static uint64_t bench_nsec(void) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(CLOCK_MONOTONIC, &ts);
+        assert(!r);
+
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+/*
+ * Measure the cost of a broadcast lookup against registries of different
+ * sizes. Every rule matches on a distinct value of @key (e.g., a distinct
+ * arg0, in the style of NameOwnerChanged subscriptions), so only a single
+ * rule matches, and the lookup cost should not depend on the number of rules.
+ */
+static void bench_lookup(size_t n_rules, const char *key) {
+        MatchRegistry registry = MATCH_REGISTRY_INIT(registry);
+        MessageMetadata metadata = MESSAGE_METADATA_INIT;
+        MessageMetadataArg args[1] = {};
+        MatchOwner owner = MATCH_OWNER_INIT(owner);
+        MatchRule **rules;
+        char rule_string[128];
+        size_t i, n, n_lookups = 100000;
+        uint64_t ts;
+        int r;
+
+        rules = calloc(n_rules, sizeof(*rules));
+        assert(rules);
+
+        for (i = 0; i < n_rules; ++i) {
+                sprintf(rule_string, "type=signal,interface=com.example,%s%zu", key, i);
+
+                r = match_owner_ref_rule(&owner, &rules[i], NULL, rule_string);
+                assert(!r);
+
+                r = match_rule_link(rules[i], &registry, false);
+                assert(!r);
+        }
+
+        metadata.header.type = DBUS_MESSAGE_TYPE_SIGNAL;
+        metadata.fields.path = "/com/example/Object0/Child";
+        metadata.fields.interface = "com.example";
+        metadata.fields.member = "Signal0";
+        metadata.args = args;
+        metadata.n_args = C_ARRAY_SIZE(args);
+        args[0] = (MessageMetadataArg){ 's', "com.example.Name0" };
+
+        /* parsed messages carry the hashes of their fields */
+        metadata.hashes.path = hash_string(metadata.fields.path);
+        metadata.hashes.interface = hash_string(metadata.fields.interface);
+        metadata.hashes.member = hash_string(metadata.fields.member);
+        metadata.hashes.valid = true;
+
+        ts = bench_nsec();
+        for (i = 0, n = 0; i < n_lookups; ++i)
+                n += bench_count_subscribers(&registry, &metadata);
+        ts = bench_nsec() - ts;
+
+        assert(n == n_lookups);
+
+        fprintf(stderr, "Broadcast lookup with %zu rules on '%s': %"PRIu64"ns\n", n_rules, key, ts / n_lookups);
+
+        for (i = 0; i < n_rules; ++i)
+                match_rule_user_unref(rules[i]);
+
+        free(rules);
+        match_owner_deinit(&owner);
+        match_registry_deinit(&registry);
+}
+
+int main(int argc, char **argv) {
+        bench_lookup(16, "member=Signal");
+        bench_lookup(16 * 1024, "member=Signal");
+        bench_lookup(16, "member=Signal0,arg0=com.example.Name");
+        bench_lookup(16 * 1024, "member=Signal0,arg0=com.example.Name");
+        bench_lookup(16, "member=Signal0,path_namespace=/com/example/Object");
+        bench_lookup(16 * 1024, "member=Signal0,path_namespace=/com/example/Object");
+
+        return 0;
+}
@@ -0,0 +1,294 @@
+/*
+ * Broadcast Destination Cache
+ *
+ * Resolving the destinations of a broadcast requires a lookup in several
+ * match registries (the wildcard registry, the registry of the sender and the
+ * registries of all names it owns). Signals are usually emitted repeatedly
+ * with the same type, sender, path, interface and member, though, and for
+ * those the result only changes when the set of match rules or the name
+ * ownership changes. Hence, this cache maps those routing fields to the
+ * resolved list of destinations.
+ *
+ * Every entry records the generation it was resolved in. The caller passes in
+ * its current generation on every lookup, and entries of older generations
+ * are treated as misses. The generation must change whenever a match rule,
+ * a name or a peer changes, so an entry never refers to an owner that went
+ * away. Results that depend on the message body (i.e., if any candidate rule
+ * matches on arguments) must not be added to the cache at all.
+ *
+ * Every match rule evaluated while resolving the destinations keeps statistics
+ * on how often it was evaluated and how often it matched. The caller records
+ * those evaluations in @trace while resolving, and the entry keeps a copy of
+ * them, so they can be credited again on every hit. The trace holds at most
+ * MATCH_TRACE_MAX evaluations, and results that needed more are not cached.
+ * This bounds both the size of an entry and the cost of a hit, and the cache
+ * is only worth it for broadcasts with few candidate rules anyway.
+ *
+ * The cache is bounded by @max_entries. Entries are kept in LRU order, and
+ * the least recently used entry is evicted whenever a new one is needed.
+ */
+
+#include <c-list.h>
+#include <c-macro.h>
+#include <c-rbtree.h>
+#include <c-string.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bus/broadcast.h"
+#include "bus/match.h"
+#include "dbus/message.h"
+#include "util/hash.h"
+
+typedef struct BroadcastKey BroadcastKey;
+
+struct BroadcastKey {
+        uint64_t hash;
+        MatchRegistry *matches;
+        uint64_t sender_id;
+        uint8_t type;
+        const char *path;
+        const char *interface;
+        const char *member;
+};
+
+static void broadcast_key_init(BroadcastKey *key, MatchRegistry *matches, MessageMetadata *metadata) {
+        uint64_t hash;
+
+        if (metadata->hashes.valid)
+                hash = hash_combine(hash_combine(metadata->hashes.path,
+                                                 metadata->hashes.interface),
+                                    metadata->hashes.member);
+        else
+                hash = hash_combine(hash_combine(hash_string(metadata->fields.path),
+                                                 hash_string(metadata->fields.interface)),
+                                    hash_string(metadata->fields.member));
+
+        hash = hash_combine(hash, metadata->sender_id);
+        hash = hash_combine(hash, metadata->header.type);
+        hash = hash_combine(hash, (uintptr_t)matches);
+
+        *key = (BroadcastKey){
+                .hash = hash,
+                .matches = matches,
+                .sender_id = metadata->sender_id,
+                .type = metadata->header.type,
+                .path = metadata->fields.path,
+                .interface = metadata->fields.interface,
+                .member = metadata->fields.member,
+        };
+}
+
+static int broadcast_cache_entry_compare(CRBTree *tree, void *k, CRBNode *rb) {
+        BroadcastCacheEntry *entry = c_container_of(rb, BroadcastCacheEntry, cache_node);
+        BroadcastKey *key = k;
+        int r;
+
+        if (key->hash != entry->hash)
+                return key->hash < entry->hash ? -1 : 1;
+        if (key->matches != entry->matches)
+                return (uintptr_t)key->matches < (uintptr_t)entry->matches ? -1 : 1;
+        if (key->sender_id != entry->sender_id)
+                return key->sender_id < entry->sender_id ? -1 : 1;
+        if (key->type != entry->type)
+                return key->type < entry->type ? -1 : 1;
+
+        if ((r = c_string_compare(key->path, entry->path)) ||
+            (r = c_string_compare(key->interface, entry->interface)) ||
+            (r = c_string_compare(key->member, entry->member)))
+                return r;
+
+        return 0;
+}
+
+static void broadcast_cache_entry_free(BroadcastCache *cache, BroadcastCacheEntry *entry) {
+        c_rbnode_unlink(&entry->cache_node);
+        c_list_unlink(&entry->lru_link);
+        --cache->n_entries;
+        free(entry);
+}
+
+static char *broadcast_cache_entry_copy(char **p, const char *string) {
+        char *copy = *p;
+
+        if (!string)
+                return NULL;
+
+        *p = stpcpy(copy, string) + 1;
+        return copy;
+}
+
+static BroadcastCacheEntry *broadcast_cache_entry_new(BroadcastKey *key, uint64_t generation, MatchTrace *trace, CList *destinations) {
+        BroadcastCacheEntry *entry;
+        MatchOwner *owner;
+        size_t n_destinations = 0, n_strings = 0;
+        char *p;
+
+        static_assert(alignof(MatchTraceEntry) <= alignof(MatchOwner *),
+                      "Evaluations cannot be stored after the destinations");
+
+        c_list_for_each_entry(owner, destinations, destinations_link)
+                ++n_destinations;
+
+        if (key->path)
+                n_strings += strlen(key->path) + 1;
+        if (key->interface)
+                n_strings += strlen(key->interface) + 1;
+        if (key->member)
+                n_strings += strlen(key->member) + 1;
+
+        entry = malloc(sizeof(*entry) +
+                       n_destinations * sizeof(*entry->destinations) +
+                       trace->n_entries * sizeof(*entry->evaluations) +
+                       n_strings);
+        if (!entry)
+                return NULL;
+
+        entry->cache_node = (CRBNode)C_RBNODE_INIT(entry->cache_node);
+        entry->lru_link = (CList)C_LIST_INIT(entry->lru_link);
+        entry->generation = generation;
+        entry->hash = key->hash;
+        entry->matches = key->matches;
+        entry->sender_id = key->sender_id;
+        entry->type = key->type;
+        entry->n_destinations = 0;
+
+        c_list_for_each_entry(owner, destinations, destinations_link)
+                entry->destinations[entry->n_destinations++] = owner;
+
+        entry->evaluations = (MatchTraceEntry *)(entry->destinations + n_destinations);
+        entry->n_evaluations = trace->n_entries;
+        if (trace->n_entries)
+                memcpy(entry->evaluations, trace->entries, trace->n_entries * sizeof(*entry->evaluations));
+
+        p = (char *)(entry->evaluations + entry->n_evaluations);
+        entry->path = broadcast_cache_entry_copy(&p, key->path);
+        entry->interface = broadcast_cache_entry_copy(&p, key->interface);
+        entry->member = broadcast_cache_entry_copy(&p, key->member);
+
+        return entry;
+}
+
+/**
+ * broadcast_cache_get_destinations() - look up cached destinations
+ * @cache:              cache to operate on
+ * @generation:         current generation of the caller
+ * @matches:            additional registry the destinations were resolved in
+ * @metadata:           metadata of the message
+ * @destinations:       list to link the destinations into
+ *
+ * This looks up the destinations of a message with the routing fields of
+ * @metadata. If there is an entry for them that was resolved in @generation,
+ * all its destinations that are not linked into a destination list yet are
+ * linked into @destinations, and the rule evaluations it was resolved with
+ * are credited again.
+ *
+ * Return: True on a cache hit, false if the caller has to resolve the
+ *         destinations itself.
+ */
+bool broadcast_cache_get_destinations(BroadcastCache *cache,
+                                      uint64_t generation,
+                                      MatchRegistry *matches,
+                                      MessageMetadata *metadata,
+                                      CList *destinations) {
+        BroadcastCacheEntry *entry;
+        BroadcastKey key;
+        size_t i;
+
+        broadcast_key_init(&key, matches, metadata);
+
+        entry = c_rbtree_find_entry(&cache->entry_tree,
+                                    broadcast_cache_entry_compare,
+                                    &key,
+                                    BroadcastCacheEntry,
+                                    cache_node);
+        if (!entry || entry->generation != generation) {
+                ++cache->n_misses;
+                return false;
+        }
+
+        ++cache->n_hits;
+        c_list_unlink(&entry->lru_link);
+        c_list_link_front(&cache->lru_list, &entry->lru_link);
+
+        match_trace_credit(entry->evaluations, entry->n_evaluations);
+
+        for (i = 0; i < entry->n_destinations; ++i) {
+                if (c_list_is_linked(&entry->destinations[i]->destinations_link))
+                        continue;
+
+                c_list_link_tail(destinations, &entry->destinations[i]->destinations_link);
+        }
+
+        return true;
+}
+
+/**
+ * broadcast_cache_add() - cache resolved destinations
+ * @cache:              cache to operate on
+ * @generation:         current generation of the caller
+ * @matches:            additional registry the destinations were resolved in
+ * @metadata:           metadata of the message
+ * @destinations:       resolved destinations
+ *
+ * This caches all entries of @destinations as the destinations of messages
+ * with the routing fields of @metadata, replacing any previous entry. The
+ * caller must make sure @destinations contains exactly the resolved
+ * destinations, that they do not depend on the message body, and that
+ * @cache->trace holds the rule evaluations they were resolved with.
+ *
+ * Caching is best-effort. If the entry cannot be allocated, or the trace was
+ * truncated because too many rules were evaluated, nothing is cached.
+ */
+void broadcast_cache_add(BroadcastCache *cache,
+                         uint64_t generation,
+                         MatchRegistry *matches,
+                         MessageMetadata *metadata,
+                         CList *destinations) {
+        BroadcastCacheEntry *entry;
+        CRBNode *parent, **slot;
+        BroadcastKey key;
+
+        broadcast_key_init(&key, matches, metadata);
+
+        entry = c_rbtree_find_entry(&cache->entry_tree,
+                                    broadcast_cache_entry_compare,
+                                    &key,
+                                    BroadcastCacheEntry,
+                                    cache_node);
+        if (entry)
+                broadcast_cache_entry_free(cache, entry);
+
+        if (cache->trace.truncated)
+                return;
+
+        entry = broadcast_cache_entry_new(&key, generation, &cache->trace, destinations);
+        if (!entry)
+                return;
+
+        if (cache->n_entries && cache->n_entries >= cache->max_entries)
+                broadcast_cache_entry_free(cache,
+                                           c_list_last_entry(&cache->lru_list,
+                                                             BroadcastCacheEntry,
+                                                             lru_link));
+
+        slot = c_rbtree_find_slot(&cache->entry_tree, broadcast_cache_entry_compare, &key, &parent);
+        assert(slot);
+        c_rbtree_add(&cache->entry_tree, parent, slot, &entry->cache_node);
+        c_list_link_front(&cache->lru_list, &entry->lru_link);
+        ++cache->n_entries;
+}
+
+/**
+ * broadcast_cache_flush() - drop all cached entries
+ * @cache:              cache to operate on
+ *
+ * This releases all entries of @cache. The counters are left untouched.
+ */
+void broadcast_cache_flush(BroadcastCache *cache) {
+        BroadcastCacheEntry *entry, *safe;
+
+        c_list_for_each_entry_safe(entry, safe, &cache->lru_list, lru_link)
+                broadcast_cache_entry_free(cache, entry);
+
+        assert(!cache->n_entries);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+/*
+ * Broadcast Destination Cache
+ */
+
+#include <c-list.h>
+#include <c-macro.h>
+#include <c-rbtree.h>
+#include <stdlib.h>
+#include "bus/match.h"
+
+typedef struct BroadcastCache BroadcastCache;
+typedef struct BroadcastCacheEntry BroadcastCacheEntry;
+typedef struct MessageMetadata MessageMetadata;
+
+#define BROADCAST_CACHE_MAX (256UL)
+
+struct BroadcastCacheEntry {
+        CRBNode cache_node;
+        CList lru_link;
+        uint64_t generation;
+
+        uint64_t hash;
+        MatchRegistry *matches;
+        uint64_t sender_id;
+        uint8_t type;
+        const char *path;
+        const char *interface;
+        const char *member;
+
+        /* rule evaluations that resolved @destinations */
+        MatchTraceEntry *evaluations;
+        size_t n_evaluations;
+
+        size_t n_destinations;
+        MatchOwner *destinations[];
+};
+
+struct BroadcastCache {
+        CRBTree entry_tree;
+        CList lru_list;
+        size_t n_entries;
+        size_t max_entries;
+
+        uint64_t n_hits;
+        uint64_t n_misses;
+        uint64_t n_bypasses;
+
+        MatchTrace trace;
+};
+
+#define BROADCAST_CACHE_INIT(_x) {                              \
+                .entry_tree = C_RBTREE_INIT,                    \
+                .lru_list = C_LIST_INIT((_x).lru_list),         \
+                .max_entries = BROADCAST_CACHE_MAX,             \
+                .trace = MATCH_TRACE_INIT,                      \
+        }
+
+bool broadcast_cache_get_destinations(BroadcastCache *cache,
+                                      uint64_t generation,
+                                      MatchRegistry *matches,
+                                      MessageMetadata *metadata,
+                                      CList *destinations);
+void broadcast_cache_add(BroadcastCache *cache,
+                         uint64_t generation,
+                         MatchRegistry *matches,
+                         MessageMetadata *metadata,
+                         CList *destinations);
+void broadcast_cache_flush(BroadcastCache *cache);
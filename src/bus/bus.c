@@ -54,6 +54,7 @@ void bus_deinit(Bus *bus) {
         bus->pid = 0;
         bus->user = user_unref(bus->user);
         metrics_deinit(&bus->metrics);
+        broadcast_cache_flush(&bus->broadcast_cache);
         peer_registry_deinit(&bus->peers);
         user_registry_deinit(&bus->users);
         name_registry_deinit(&bus->names);
@@ -87,6 +88,102 @@ Peer *bus_find_peer_by_name(Bus *bus, Name **namep, const char *name_str) {
         return peer;
 }
 
+static uint64_t bus_get_generation(Bus *bus) {
+        /* both counters only ever grow, so their sum changes whenever either does */
+        return bus->generation + match_registry_generation();
+}
+
+/*
+ * Messages of a peer are also matched against the sender registries of all the
+ * names it is the primary owner of. Rather than walking all its names for
+ * every message, each peer caches the registries that actually hold rules.
+ * The cache is only rebuilt once the peer was invalidated, which happens when
+ * it gains or loses a primary name, or when a sender registry of one of its
+ * names gains or loses rules. Changes anywhere else on the bus keep it.
+ */
+static int bus_update_name_matches(Bus *bus, Peer *peer) {
+        NameOwnership *ownership;
+        MatchRegistry **registries;
+        size_t n_names = 0;
+
+        if (!peer->name_matches_stale)
+                return 0;
+
+        c_rbtree_for_each_entry(ownership, &peer->owned_names.ownership_tree, owner_node)
+                ++n_names;
+
+        if (n_names > peer->z_name_matches) {
+                registries = realloc(peer->name_matches, n_names * sizeof(*registries));
+                if (!registries)
+                        return error_origin(-ENOMEM);
+
+                peer->name_matches = registries;
+                peer->z_name_matches = n_names;
+        }
+
+        peer->n_name_matches = 0;
+        c_rbtree_for_each_entry(ownership, &peer->owned_names.ownership_tree, owner_node) {
+                if (!name_ownership_is_primary(ownership))
+                        continue;
+                if (match_registry_is_empty(&ownership->name->sender_matches))
+                        continue;
+
+                peer->name_matches[peer->n_name_matches++] = &ownership->name->sender_matches;
+        }
+
+        peer->name_matches_stale = false;
+        return 0;
+}
+
+static bool bus_get_name_subscribers(Bus *bus, CList *destinations, Peer *sender, MessageMetadata *metadata, MatchTrace *trace) {
+        NameOwnership *ownership;
+        bool body = false;
+        size_t i;
+        int r;
+
+        r = bus_update_name_matches(bus, sender);
+        if (!r) {
+                for (i = 0; i < sender->n_name_matches; ++i)
+                        if (match_registry_get_subscribers(sender->name_matches[i], destinations, metadata, trace))
+                                body = true;
+
+                return body;
+        }
+
+        /* if the cache cannot be built, walk all names instead */
+        c_rbtree_for_each_entry(ownership, &sender->owned_names.ownership_tree, owner_node) {
+                if (!name_ownership_is_primary(ownership))
+                        continue;
+
+                if (match_registry_get_subscribers(&ownership->name->sender_matches, destinations, metadata, trace))
+                        body = true;
+        }
+
+        return body;
+}
+
+static void bus_get_name_monitors(Bus *bus, CList *destinations, Peer *sender, MessageMetadata *metadata) {
+        NameOwnership *ownership;
+        size_t i;
+        int r;
+
+        r = bus_update_name_matches(bus, sender);
+        if (!r) {
+                for (i = 0; i < sender->n_name_matches; ++i)
+                        match_registry_get_monitors(sender->name_matches[i], destinations, metadata);
+
+                return;
+        }
+
+        /* if the cache cannot be built, walk all names instead */
+        c_rbtree_for_each_entry(ownership, &sender->owned_names.ownership_tree, owner_node) {
+                if (!name_ownership_is_primary(ownership))
+                        continue;
+
+                match_registry_get_monitors(&ownership->name->sender_matches, destinations, metadata);
+        }
+}
+
 void bus_get_monitor_destinations(Bus *bus, CList *destinations, Peer *sender, MessageMetadata *metadata) {
         if (!bus->n_monitors)
                 return;
@@ -94,15 +191,7 @@ void bus_get_monitor_destinations(Bus *bus, CList *destinations, Peer *sender, M
         match_registry_get_monitors(&bus->wildcard_matches, destinations, metadata);
 
         if (sender) {
-                NameOwnership *ownership;
-
-                c_rbtree_for_each_entry(ownership, &sender->owned_names.ownership_tree, owner_node) {
-                        if (!name_ownership_is_primary(ownership))
-                                continue;
-
-                        match_registry_get_monitors(&ownership->name->sender_matches, destinations, metadata);
-                }
-
+                bus_get_name_monitors(bus, destinations, sender, metadata);
                 match_registry_get_monitors(&sender->sender_matches, destinations, metadata);
         } else {
                 /* sent from the driver */
@@ -110,29 +199,67 @@ void bus_get_monitor_destinations(Bus *bus, CList *destinations, Peer *sender, M
         }
 }
 
-void bus_get_broadcast_destinations(Bus *bus, CList *destinations, MatchRegistry *matches, Peer *sender, MessageMetadata *metadata) {
-        match_registry_get_subscribers(&bus->wildcard_matches, destinations, metadata);
+static bool bus_resolve_broadcast_destinations(Bus *bus, CList *destinations, MatchRegistry *matches, Peer *sender, MessageMetadata *metadata, MatchTrace *trace) {
+        bool body;
+
+        body = match_registry_get_subscribers(&bus->wildcard_matches, destinations, metadata, trace);
 
         if (matches) {
-                match_registry_get_subscribers(matches, destinations, metadata);
+                if (match_registry_get_subscribers(matches, destinations, metadata, trace))
+                        body = true;
         }
 
         if (sender) {
-                NameOwner *owner = &sender->owned_names;
-                NameOwnership *ownership;
-
-                c_rbtree_for_each_entry(ownership, &owner->ownership_tree, owner_node) {
-                        if (!name_ownership_is_primary(ownership))
-                                continue;
-
-                        match_registry_get_subscribers(&ownership->name->sender_matches, destinations, metadata);
-                }
+                if (bus_get_name_subscribers(bus, destinations, sender, metadata, trace))
+                        body = true;
         } else {
                 /* sent from the driver */
-                match_registry_get_subscribers(&bus->sender_matches, destinations, metadata);
+                if (match_registry_get_subscribers(&bus->sender_matches, destinations, metadata, trace))
+                        body = true;
         }
+
+        return body;
+}
+
+/**
+ * bus_invalidate_broadcasts() - invalidate cached broadcast destinations
+ * @bus:                bus to operate on
+ *
+ * This invalidates the broadcast destination cache, as well as the registries
+ * cached on each peer for its primary names. It must be called whenever the
+ * primary owner of a name changes, or a peer is added or removed. Changes to
+ * match rules are tracked by the match registries themselves.
+ */
+void bus_invalidate_broadcasts(Bus *bus) {
+        ++bus->generation;
 }
 
+void bus_get_broadcast_destinations(Bus *bus, CList *destinations, MatchRegistry *matches, Peer *sender, MessageMetadata *metadata) {
+        uint64_t generation;
+
+        /*
+         * The cached destinations are only complete if no owner was linked
+         * elsewhere already, as the registries skip those. This is always
+         * the case for regular broadcasts, monitors are collected separately.
+         */
+        if (!c_list_is_empty(destinations)) {
+                bus_resolve_broadcast_destinations(bus, destinations, matches, sender, metadata, NULL);
+                return;
+        }
+
+        generation = bus_get_generation(bus);
+
+        if (broadcast_cache_get_destinations(&bus->broadcast_cache, generation, matches, metadata, destinations))
+                return;
+
+        /* a hit credits the rule evaluations it saves, so record them */
+        match_trace_reset(&bus->broadcast_cache.trace);
+
+        if (bus_resolve_broadcast_destinations(bus, destinations, matches, sender, metadata, &bus->broadcast_cache.trace))
+                ++bus->broadcast_cache.n_bypasses;
+        else
+                broadcast_cache_add(&bus->broadcast_cache, generation, matches, metadata, destinations);
+}
 
 void bus_log_append_transaction(Bus *bus, uint64_t sender_id, uint64_t receiver_id,
                                 NameSet *sender_names, NameSet *receiver_names, const char *sender_label, const char *receiver_label,
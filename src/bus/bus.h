@@ -7,10 +7,12 @@
 #include <c-macro.h>
 #include <c-rbtree.h>
 #include <stdlib.h>
+#include "bus/broadcast.h"
 #include "bus/listener.h"
 #include "bus/match.h"
 #include "bus/name.h"
 #include "bus/peer.h"
+#include "dbus/socket.h"
 #include "util/metrics.h"
 #include "util/user.h"
 
@@ -44,10 +46,22 @@ struct Bus {
         MatchRegistry wildcard_matches;
         MatchRegistry sender_matches;
         PeerRegistry peers;
+        BroadcastCache broadcast_cache;
 
+        uint64_t generation;
         uint64_t n_monitors;
         uint64_t listener_ids;
 
+        size_t write_bytes;
+        size_t write_vectors;
+
+        /* write counters of all peers that were freed already */
+        struct {
+                uint64_t n_syscalls;
+                uint64_t n_msgs;
+                uint64_t n_buffers;
+        } write_stats;
+
         Metrics metrics;
 };
 
@@ -57,6 +71,10 @@ struct Bus {
                 .wildcard_matches = MATCH_REGISTRY_INIT((_x).wildcard_matches), \
                 .sender_matches = MATCH_REGISTRY_INIT((_x).sender_matches),     \
                 .peers = PEER_REGISTRY_INIT,                                    \
+                .broadcast_cache = BROADCAST_CACHE_INIT((_x).broadcast_cache),  \
+                .generation = 1,                                                \
+                .write_bytes = SOCKET_WRITE_BYTES_DEFAULT,                      \
+                .write_vectors = SOCKET_WRITE_VECS_MAX,                         \
                 .metrics = METRICS_INIT(CLOCK_THREAD_CPUTIME_ID),               \
         }
 
@@ -71,6 +89,7 @@ void bus_deinit(Bus *bus);
 
 Peer *bus_find_peer_by_name(Bus *bus, Name **namep, const char *name);
 void bus_get_monitor_destinations(Bus *bus, CList *destinations, Peer *sender, MessageMetadata *metadata);
+void bus_invalidate_broadcasts(Bus *bus);
 void bus_get_broadcast_destinations(Bus *bus, CList *destinations, MatchRegistry *matches, Peer *sender, MessageMetadata *metadata);
 
 void bus_log_append_transaction(Bus *bus, uint64_t sender_id, uint64_t receiver_id, NameSet *sender_names, NameSet *receiver_names, const char *sender_label, const char *receiver_label, Message *message);
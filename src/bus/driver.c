@@ -18,7 +18,9 @@
 #include "dbus/message.h"
 #include "dbus/protocol.h"
 #include "dbus/socket.h"
+#include "util/dispatch.h"
 #include "util/error.h"
+#include "util/metrics.h"
 #include "util/selinux.h"
 
 typedef struct DriverInterface DriverInterface;
@@ -73,6 +75,15 @@ static const CDVarType driver_type_in_s[] = {
                 )
         )
 };
+static const CDVarType driver_type_in_as[] = {
+        C_DVAR_T_INIT(
+                C_DVAR_T_TUPLE1(
+                        C_DVAR_T_ARRAY(
+                                C_DVAR_T_s
+                        )
+                )
+        )
+};
 static const CDVarType driver_type_in_su[] = {
         C_DVAR_T_INIT(
                 C_DVAR_T_TUPLE2(
@@ -199,6 +210,41 @@ static const CDVarType driver_type_out_apsv[] = {
                 )
         )
 };
+static const CDVarType driver_type_out_apst[] = {
+        C_DVAR_T_INIT(
+                DRIVER_T_MESSAGE(
+                        C_DVAR_T_TUPLE1(
+                                C_DVAR_T_ARRAY(
+                                        C_DVAR_T_PAIR(
+                                                C_DVAR_T_s,
+                                                C_DVAR_T_t
+                                        )
+                                )
+                        )
+                )
+        )
+};
+
+static const CDVarType driver_type_out_apsastt[] = {
+        C_DVAR_T_INIT(
+                DRIVER_T_MESSAGE(
+                        C_DVAR_T_TUPLE1(
+                                C_DVAR_T_ARRAY(
+                                        C_DVAR_T_PAIR(
+                                                C_DVAR_T_s,
+                                                C_DVAR_T_ARRAY(
+                                                        C_DVAR_T_TUPLE3(
+                                                                C_DVAR_T_s,
+                                                                C_DVAR_T_t,
+                                                                C_DVAR_T_t
+                                                        )
+                                                )
+                                        )
+                                )
+                        )
+                )
+        )
+};
 
 static void driver_write_bytes(CDVar *var, const char *bytes, size_t n_bytes) {
         c_dvar_write(var, "[");
@@ -567,7 +613,7 @@ static int driver_notify_name_owner_changed(Bus *bus, MatchRegistry *matches, co
                         .interface = "org.freedesktop.DBus",
                         .member = "NameOwnerChanged",
                 },
-                .args = {
+                .args = (MessageMetadataArg[]){
                         {
                                 .value = name,
                                 .element = 's',
@@ -671,6 +717,11 @@ static int driver_name_owner_changed(Bus *bus, MatchRegistry *matches, const cha
         assert(old_owner || new_owner);
         assert(name || !old_owner || !new_owner);
 
+        /* the set of names of a sender affects its broadcast destinations */
+        bus_invalidate_broadcasts(bus);
+        peer_invalidate_name_matches(old_owner);
+        peer_invalidate_name_matches(new_owner);
+
         old_owner_str = old_owner ? address_to_string(&(Address)ADDRESS_INIT_ID(old_owner->id)) : "";
         new_owner_str = new_owner ? address_to_string(&(Address)ADDRESS_INIT_ID(new_owner->id)) : "";
         name = name ?: (old_owner ? old_owner_str : new_owner_str);
@@ -1453,6 +1504,254 @@ static int driver_method_remove_match(Peer *peer, const char *path, CDVar *in_v,
         return 0;
 }
 
+static int driver_read_strings(CDVar *in_v, const char ***stringsp, size_t *n_stringsp, size_t n_max) {
+        _c_cleanup_(c_freep) const char **strings = NULL;
+        size_t n_strings = 0, n_allocated = 0;
+        const char **tmp;
+        int r;
+
+        c_dvar_read(in_v, "([");
+        while (c_dvar_more(in_v)) {
+                /*
+                 * The array is sized by the message and not charged to the
+                 * caller, so refuse to grow it beyond @n_max entries.
+                 */
+                if (n_strings >= n_max)
+                        return DRIVER_E_QUOTA;
+
+                if (n_strings >= n_allocated) {
+                        n_allocated = c_min(c_max(n_allocated * 2, (size_t)16), n_max);
+
+                        tmp = realloc(strings, n_allocated * sizeof(*strings));
+                        if (!tmp)
+                                return error_origin(-ENOMEM);
+
+                        strings = tmp;
+                }
+
+                c_dvar_read(in_v, "s", &strings[n_strings++]);
+        }
+        c_dvar_read(in_v, "])");
+
+        r = driver_end_read(in_v);
+        if (r)
+                return error_trace(r);
+
+        *stringsp = strings;
+        *n_stringsp = n_strings;
+        strings = NULL;
+        return 0;
+}
+
+static int driver_compare_pointers(const void *a, const void *b) {
+        uintptr_t p1 = (uintptr_t)*(void * const *)a, p2 = (uintptr_t)*(void * const *)b;
+
+        return (p1 > p2) - (p1 < p2);
+}
+
+static int driver_method_add_matches(Peer *peer, const char *path, CDVar *in_v, uint32_t serial, CDVar *out_v) {
+        _c_cleanup_(c_freep) const char **rule_strings = NULL;
+        size_t i, n_rule_strings;
+        MatchRule *rule;
+        int r, k;
+
+        r = driver_read_strings(in_v, &rule_strings, &n_rule_strings, DRIVER_MATCHES_MAX);
+        if (r)
+                return error_trace(r);
+
+        /*
+         * The rules are added all-or-nothing, so make sure all of them parse
+         * before adding any, so only the quota can fail below.
+         */
+        for (i = 0; i < n_rule_strings; ++i) {
+                r = peer_find_match(peer, &rule, rule_strings[i]);
+                if (r) {
+                        if (r == PEER_E_MATCH_INVALID)
+                                return DRIVER_E_MATCH_INVALID;
+                        else
+                                return error_fold(r);
+                }
+        }
+
+        for (i = 0; i < n_rule_strings; ++i) {
+                r = peer_add_match(peer, rule_strings[i]);
+                if (r)
+                        break;
+        }
+
+        if (r) {
+                /*
+                 * Drop again all the rules we added so far. This only drops
+                 * references we just acquired, so it cannot fail.
+                 */
+                while (i-- > 0) {
+                        k = peer_remove_match(peer, rule_strings[i]);
+                        if (k)
+                                return error_fold(k);
+                }
+
+                if (r == PEER_E_QUOTA)
+                        return DRIVER_E_QUOTA;
+                else
+                        return error_fold(r);
+        }
+
+        c_dvar_write(out_v, "()");
+
+        r = driver_send_reply(peer, out_v, serial);
+        if (r)
+                return error_trace(r);
+
+        return 0;
+}
+
+static int driver_method_remove_matches(Peer *peer, const char *path, CDVar *in_v, uint32_t serial, CDVar *out_v) {
+        _c_cleanup_(c_freep) const char **rule_strings = NULL;
+        _c_cleanup_(c_freep) MatchRule **rules = NULL;
+        size_t i, j, n_rule_strings;
+        int r;
+
+        r = driver_read_strings(in_v, &rule_strings, &n_rule_strings, DRIVER_MATCHES_MAX);
+        if (r)
+                return error_trace(r);
+
+        rules = calloc(c_max(n_rule_strings, (size_t)1), sizeof(*rules));
+        if (!rules)
+                return error_origin(-ENOMEM);
+
+        /*
+         * The rules are removed all-or-nothing, so make sure the peer holds
+         * every rule before removing any. Re-adding removed rules could fail
+         * and would reset their statistics, so there is no rollback.
+         */
+        for (i = 0; i < n_rule_strings; ++i) {
+                r = peer_find_match(peer, &rules[i], rule_strings[i]);
+                if (r) {
+                        if (r == PEER_E_MATCH_INVALID)
+                                return DRIVER_E_MATCH_INVALID;
+                        else
+                                return error_fold(r);
+                } else if (!rules[i]) {
+                        return DRIVER_E_MATCH_NOT_FOUND;
+                }
+        }
+
+        /* a rule may be listed as often as the peer added it, but no more */
+        qsort(rules, n_rule_strings, sizeof(*rules), driver_compare_pointers);
+        for (i = 0; i < n_rule_strings; i = j) {
+                for (j = i + 1; j < n_rule_strings && rules[j] == rules[i]; ++j)
+                        /* empty */ ;
+
+                if (j - i > rules[i]->n_user_refs)
+                        return DRIVER_E_MATCH_NOT_FOUND;
+        }
+
+        for (i = 0; i < n_rule_strings; ++i) {
+                r = peer_remove_match(peer, rule_strings[i]);
+                if (r)
+                        return error_fold(r);
+        }
+
+        c_dvar_write(out_v, "()");
+
+        r = driver_send_reply(peer, out_v, serial);
+        if (r)
+                return error_trace(r);
+
+        return 0;
+}
+
+static int driver_method_get_match_stats(Peer *peer, const char *path, CDVar *in_v, uint32_t serial, CDVar *out_v) {
+        uint64_t n_evaluations, n_hits;
+        MatchRule *rule;
+        Peer *p;
+        int r;
+
+        if (!peer_is_privileged(peer))
+                return DRIVER_E_PEER_NOT_PRIVILEGED;
+
+        c_dvar_read(in_v, "()");
+
+        r = driver_end_read(in_v);
+        if (r)
+                return error_trace(r);
+
+        c_dvar_write(out_v, "([");
+        c_rbtree_for_each_entry(p, &peer->bus->peers.peer_tree, registry_node) {
+                if (!peer_is_registered(p))
+                        continue;
+
+                c_dvar_write(out_v, "{");
+                driver_dvar_write_unique_name(out_v, p);
+                c_dvar_write(out_v, "[");
+                c_rbtree_for_each_entry(rule, &p->owned_matches.rule_tree, owner_node) {
+                        _c_cleanup_(c_freep) char *rule_string = NULL;
+
+                        r = match_rule_format(rule, &rule_string);
+                        if (r)
+                                return error_fold(r);
+
+                        match_rule_get_counters(rule, &n_evaluations, &n_hits);
+                        c_dvar_write(out_v, "(stt)", rule_string, n_evaluations, n_hits);
+                }
+                c_dvar_write(out_v, "]}");
+        }
+        c_dvar_write(out_v, "])");
+
+        r = driver_send_reply(peer, out_v, serial);
+        if (r)
+                return error_trace(r);
+
+        return 0;
+}
+
+static int driver_method_get_dispatch_stats(Peer *peer, const char *path, CDVar *in_v, uint32_t serial, CDVar *out_v) {
+        Metrics *metrics = &BROKER(peer->bus)->dispatcher.wait_metrics;
+        uint64_t n_syscalls, n_msgs, n_buffers;
+        Peer *p;
+        int r;
+
+        if (!peer_is_privileged(peer))
+                return DRIVER_E_PEER_NOT_PRIVILEGED;
+
+        c_dvar_read(in_v, "()");
+
+        r = driver_end_read(in_v);
+        if (r)
+                return error_trace(r);
+
+        n_syscalls = peer->bus->write_stats.n_syscalls;
+        n_msgs = peer->bus->write_stats.n_msgs;
+        n_buffers = peer->bus->write_stats.n_buffers;
+
+        c_rbtree_for_each_entry(p, &peer->bus->peers.peer_tree, registry_node) {
+                n_syscalls += p->connection.socket.out.n_syscalls;
+                n_msgs += p->connection.socket.out.n_msgs;
+                n_buffers += p->connection.socket.out.n_buffers;
+        }
+
+        /*
+         * Wait times of ready peers until they are dispatched, in ns, and the
+         * number of write syscalls, of msghdrs written by them, and of
+         * message buffers written via those msghdrs.
+         */
+        c_dvar_write(out_v, "([{st}{st}{st}{st}{st}{st}{st}{st}])",
+                     "DispatchCount", metrics->count,
+                     "WaitP50", metrics_read_quantile(metrics, 0.5),
+                     "WaitP90", metrics_read_quantile(metrics, 0.9),
+                     "WaitP99", metrics_read_quantile(metrics, 0.99),
+                     "WaitMax", metrics->maximum,
+                     "WriteSyscalls", n_syscalls,
+                     "WriteMessages", n_msgs,
+                     "WriteBuffers", n_buffers);
+
+        r = driver_send_reply(peer, out_v, serial);
+        if (r)
+                return error_trace(r);
+
+        return 0;
+}
+
 int driver_reload_config_completed(Bus *bus, uint64_t sender_id, uint32_t reply_serial) {
         Peer *sender;
         int r;
@@ -1663,6 +1962,20 @@ static int driver_method_introspect(Peer *peer, const char *path, CDVar *in_v, u
                 "      <method name=\"Ping\">\n"
                 "    </method>\n"
                 "  </interface>\n"
+                "  <interface name=\"org.bus1.DBus.Broker\">\n"
+                "    <method name=\"AddMatches\">\n"
+                "      <arg direction=\"in\" type=\"as\"/>\n"
+                "    </method>\n"
+                "    <method name=\"RemoveMatches\">\n"
+                "      <arg direction=\"in\" type=\"as\"/>\n"
+                "    </method>\n"
+                "    <method name=\"GetMatchStats\">\n"
+                "      <arg direction=\"out\" type=\"a{sa(stt)}\"/>\n"
+                "    </method>\n"
+                "    <method name=\"GetDispatchStats\">\n"
+                "      <arg direction=\"out\" type=\"a{st}\"/>\n"
+                "    </method>\n"
+                "  </interface>\n"
                 "</node>\n";
         static const char *introspection_org_freedesktop =
                 "<!DOCTYPE node PUBLIC \"-//freedesktop//DTD D-BUS Object Introspection 1.0//EN\"\n"
@@ -1860,7 +2173,7 @@ static void driver_append_property_interfaces(CDVar *v) {
                 )
         };
 
-        c_dvar_write(v, "<[s]>", variant_type, "org.freedesktop.DBus.Monitoring");
+        c_dvar_write(v, "<[ss]>", variant_type, "org.freedesktop.DBus.Monitoring", "org.bus1.DBus.Broker");
 }
 
 static int driver_method_get(Peer *peer, const char *path, CDVar *in_v, uint32_t serial, CDVar *out_v) {
@@ -2009,6 +2322,14 @@ static const DriverMethod monitoring_methods[] = {
         { },
 };
 
+static const DriverMethod broker_methods[] = {
+        { "AddMatches",                                 true,   NULL,                           driver_method_add_matches,                                      driver_type_in_as,      driver_type_out_unit },
+        { "RemoveMatches",                              true,   NULL,                           driver_method_remove_matches,                                   driver_type_in_as,      driver_type_out_unit },
+        { "GetMatchStats",                              true,   NULL,                           driver_method_get_match_stats,                                  c_dvar_type_unit,       driver_type_out_apsastt },
+        { "GetDispatchStats",                           true,   NULL,                           driver_method_get_dispatch_stats,                               c_dvar_type_unit,       driver_type_out_apst },
+        { },
+};
+
 static const DriverMethod introspectable_methods[] = {
         { "Introspect",                                 true,   NULL,                           driver_method_introspect,                                       c_dvar_type_unit,       driver_type_out_s },
         { },
@@ -2045,6 +2366,7 @@ static int driver_dispatch_interface(Peer *peer, uint32_t serial, const char *in
                 { "org.freedesktop.DBus.Introspectable", introspectable_methods },
                 { "org.freedesktop.DBus.Peer", peer_methods },
                 { "org.freedesktop.DBus.Properties", properties_methods },
+                { "org.bus1.DBus.Broker", broker_methods },
         };
         int r;
 
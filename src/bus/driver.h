@@ -12,6 +12,8 @@ typedef struct Message Message;
 typedef struct Peer Peer;
 typedef struct User User;
 
+#define DRIVER_MATCHES_MAX (1024UL) /* rules per AddMatches/RemoveMatches call */
+
 enum {
         _DRIVER_E_SUCCESS,
 
@@ -101,6 +101,7 @@ int listener_init_with_fd(Listener *l,
         if (r)
                 return error_fold(r);
 
+        dispatch_file_set_priority(&listener->socket_file, DISPATCH_PRIORITY_REGISTRATION);
         dispatch_file_select(&listener->socket_file, EPOLLIN);
 
         listener->socket_fd = socket_fd;
@@ -135,7 +136,7 @@ int listener_set_policy(Listener *listener, PolicyRegistry *registry) {
                 if (r)
                         return error_fold(r);
 
-                policy_snapshot_free(peer->policy);
+                policy_snapshot_unref(peer->policy);
                 peer->policy = policy;
         }
 
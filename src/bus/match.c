@@ -7,11 +7,41 @@
 #include <c-macro.h>
 #include <c-rbtree.h>
 #include <c-string.h>
+#include <stdio.h>
 #include "bus/match.h"
 #include "dbus/address.h"
 #include "dbus/message.h"
 #include "dbus/protocol.h"
 #include "util/error.h"
+#include "util/hash.h"
+#include "util/pool.h"
+
+typedef struct MatchPrefix MatchPrefix;
+
+struct MatchPrefix {
+        const char *string;
+        size_t n_string;
+};
+
+/*
+ * Match rules are short-lived for many clients (e.g., they are added and
+ * removed around every name-owner lookup), so we cache them by the length of
+ * the rule string. Longer rules are allocated directly.
+ */
+#define MATCH_RULE_POOL(_x, _n) POOL_INIT(_x, sizeof(MatchRule) + (_n))
+static Pool match_rule_pools[] = {
+        MATCH_RULE_POOL(match_rule_pools[0], 64),
+        MATCH_RULE_POOL(match_rule_pools[1], 128),
+        MATCH_RULE_POOL(match_rule_pools[2], 256),
+        MATCH_RULE_POOL(match_rule_pools[3], 512),
+};
+
+/*
+ * Generation of all match registries. It is bumped whenever a rule is linked
+ * into, or unlinked from, any registry, so users can cache lookup results and
+ * cheaply tell whether they are still valid.
+ */
+static uint64_t match_generation;
 
 static bool match_key_equal(const char *key1, const char *key2, size_t n_key2) {
         if (strlen(key1) != n_key2)
@@ -20,6 +50,21 @@ static bool match_key_equal(const char *key1, const char *key2, size_t n_key2) {
         return !strncmp(key1, key2, n_key2);
 }
 
+static void match_filter_add_arg(MatchFilter *filter, unsigned int index, bool path, const char *value) {
+        size_t i;
+
+        /* keep the argument matches sorted by index */
+        for (i = filter->n_args; i > 0 && filter->args[i - 1].index > index; --i)
+                filter->args[i] = filter->args[i - 1];
+
+        filter->args[i] = (MatchFilterArg){
+                .value = value,
+                .index = index,
+                .path = path,
+        };
+        ++filter->n_args;
+}
+
 static int match_keys_assign(MatchKeys *keys, const char *key, size_t n_key, const char *value) {
         if (match_key_equal("type", key, n_key)) {
                 if (keys->filter.type != DBUS_MESSAGE_TYPE_INVALID)
@@ -84,7 +129,7 @@ static int match_keys_assign(MatchKeys *keys, const char *key, size_t n_key, con
                         return MATCH_E_INVALID;
                 keys->path_namespace = value;
         } else if (match_key_equal("arg0namespace", key, n_key)) {
-                if (keys->arg0namespace || keys->filter.args[0] || keys->filter.argpaths[0])
+                if (keys->arg0namespace || match_filter_find_arg(&keys->filter, 0))
                         return MATCH_E_INVALID;
                 if (!dbus_validate_namespace(value, strlen(value)))
                         return MATCH_E_INVALID;
@@ -104,21 +149,17 @@ static int match_keys_assign(MatchKeys *keys, const char *key, size_t n_key, con
 
                 if (i == 0 && keys->arg0namespace)
                         return MATCH_E_INVALID;
-                if (i > 63)
+                if (i >= MATCH_ARGS_MAX)
                         return MATCH_E_INVALID;
 
-                if (keys->filter.args[i] || keys->filter.argpaths[i])
+                if (match_filter_find_arg(&keys->filter, i))
                         return MATCH_E_INVALID;
 
-                if (match_key_equal("", key, n_key)) {
-                        keys->filter.args[i] = value;
-                        if (i + 1 > keys->filter.n_args)
-                                keys->filter.n_args = i + 1;
-                } else if (match_key_equal("path", key, n_key)) {
-                        keys->filter.argpaths[i] = value;
-                        if (i + 1 > keys->filter.n_argpaths)
-                                keys->filter.n_argpaths = i + 1;
-                } else
+                if (match_key_equal("", key, n_key))
+                        match_filter_add_arg(&keys->filter, i, false, value);
+                else if (match_key_equal("path", key, n_key))
+                        match_filter_add_arg(&keys->filter, i, true, value);
+                else
                         return MATCH_E_INVALID;
         } else {
                 return MATCH_E_INVALID;
@@ -200,12 +241,34 @@ static int match_parse_key(const char **match, const char **keyp, size_t *n_keyp
         return 0;
 }
 
+/*
+ * The argument matches of a rule are stored in an array at the front of the
+ * buffer of its keys, followed by the copied values. Every key-value pair but
+ * the last is terminated by a comma, so the number of commas bounds the size
+ * of the array, without parsing the rule first.
+ */
+static size_t match_keys_n_args_max(const char *string) {
+        size_t n_args = 1;
+
+        for ( ; (string = strchr(string, ',')); ++string)
+                ++n_args;
+
+        return c_min(n_args, MATCH_ARGS_MAX);
+}
+
+static size_t match_keys_n_buffer(const char *string) {
+        return match_keys_n_args_max(string) * sizeof(MatchFilterArg) + strlen(string) + 1;
+}
+
 static int match_keys_parse(MatchKeys *keys, const char *string) {
         const char *key, *value;
         size_t n_key, n_buffer;
         char *p;
         int r;
 
+        static_assert(offsetof(MatchKeys, buffer) % alignof(MatchFilterArg) == 0,
+                      "Argument matches cannot be stored in the key buffer");
+
         /*
          * Parse the rule-string @string into @keys. We repeatedly pop off a
          * key from @string and copy over the value into @keys, remembering the
@@ -214,7 +277,8 @@ static int match_keys_parse(MatchKeys *keys, const char *string) {
          * Note that we rely on @string to be zero-terminated!
          */
 
-        p = keys->buffer;
+        keys->filter.args = (MatchFilterArg *)keys->buffer;
+        p = keys->buffer + match_keys_n_args_max(string) * sizeof(MatchFilterArg);
 
         for (;;) {
                 r = match_parse_key(&string, &key, &n_key);
@@ -246,15 +310,15 @@ static void match_keys_deinit(MatchKeys *keys) {
 
 C_DEFINE_CLEANUP(MatchKeys *, match_keys_deinit);
 
-static int match_keys_init(MatchKeys *k, const char *string, size_t n_string) {
+static int match_keys_init(MatchKeys *k, const char *string, size_t n_buffer) {
         _c_cleanup_(match_keys_deinitp) MatchKeys *keys = k;
         int r;
 
-        assert(n_string > 0);
-        assert(n_string - 1 <= MATCH_RULE_LENGTH_MAX);
+        assert(strlen(string) <= MATCH_RULE_LENGTH_MAX);
+        assert(n_buffer == match_keys_n_buffer(string));
 
         *keys = (MatchKeys)MATCH_KEYS_NULL;
-        keys->n_buffer = n_string;
+        keys->n_buffer = n_buffer;
 
         r = match_keys_parse(keys, string);
         if (r)
@@ -264,18 +328,43 @@ static int match_keys_init(MatchKeys *k, const char *string, size_t n_string) {
         return 0;
 }
 
+static size_t match_keys_size(MatchKeys *keys) {
+        size_t n_buffer;
+
+        n_buffer = keys->filter.n_args * sizeof(MatchFilterArg);
+
+        if (keys->filter.interface)
+                n_buffer += strlen(keys->filter.interface) + 1;
+        if (keys->filter.member)
+                n_buffer += strlen(keys->filter.member) + 1;
+        if (keys->filter.path)
+                n_buffer += strlen(keys->filter.path) + 1;
+        for (size_t i = 0; i < keys->filter.n_args; ++i)
+                n_buffer += strlen(keys->filter.args[i].value) + 1;
+        if (keys->destination)
+                n_buffer += strlen(keys->destination) + 1;
+        if (keys->sender)
+                n_buffer += strlen(keys->sender) + 1;
+        if (keys->path_namespace)
+                n_buffer += strlen(keys->path_namespace) + 1;
+        if (keys->arg0namespace)
+                n_buffer += strlen(keys->arg0namespace) + 1;
+
+        return n_buffer;
+}
+
 static int match_keys_clone(MatchKeys *k, MatchKeys *old) {
         _c_cleanup_(match_keys_deinitp) MatchKeys *keys = k;
-        size_t n_buffer;
         char *p;
 
         *keys = (MatchKeys)MATCH_KEYS_NULL;
-        keys->n_buffer = old->n_buffer;
+        keys->n_buffer = match_keys_size(old);
 
         keys->filter.type = old->filter.type;
         keys->filter.sender = old->filter.sender;
 
-        p = keys->buffer;
+        keys->filter.args = (MatchFilterArg *)keys->buffer;
+        p = keys->buffer + old->filter.n_args * sizeof(MatchFilterArg);
 
         if (old->filter.interface) {
                 keys->filter.interface = p;
@@ -293,21 +382,12 @@ static int match_keys_clone(MatchKeys *k, MatchKeys *old) {
         }
 
         for (size_t i = 0; i < old->filter.n_args; ++i) {
-                if (old->filter.args[i]) {
-                        keys->filter.args[i] = p;
-                        p = stpcpy(p, old->filter.args[i]) + 1;
-                }
+                keys->filter.args[i] = old->filter.args[i];
+                keys->filter.args[i].value = p;
+                p = stpcpy(p, old->filter.args[i].value) + 1;
         }
         keys->filter.n_args = old->filter.n_args;
 
-        for (size_t i = 0; i < old->filter.n_argpaths; ++i) {
-                if (old->filter.argpaths[i]) {
-                        keys->filter.argpaths[i] = p;
-                        p = stpcpy(p, old->filter.argpaths[i]) + 1;
-                }
-        }
-        keys->filter.n_argpaths = old->filter.n_argpaths;
-
         if (old->destination) {
                 keys->destination = p;
                 p = stpcpy(p, old->destination) + 1;
@@ -328,12 +408,7 @@ static int match_keys_clone(MatchKeys *k, MatchKeys *old) {
                 p = stpcpy(p, old->arg0namespace) + 1;
         }
 
-        n_buffer = p - keys->buffer;
-
-        assert(n_buffer <= keys->n_buffer);
-
-        keys->n_buffer = p - keys->buffer;
-
+        assert(keys->n_buffer == (size_t)(p - keys->buffer));
 
         keys = NULL;
         return 0;
@@ -351,18 +426,19 @@ C_DEFINE_CLEANUP(MatchKeys *, match_keys_free);
 
 static int match_keys_new(MatchKeys **keysp, const char *string) {
         _c_cleanup_(match_keys_freep) MatchKeys *keys = NULL;
-        size_t n_string;
+        size_t n_buffer;
         int r;
 
-        n_string = strlen(string) + 1;
-        if (n_string - 1 > MATCH_RULE_LENGTH_MAX)
+        if (strlen(string) > MATCH_RULE_LENGTH_MAX)
                 return MATCH_E_INVALID;
 
-        keys = calloc(1, sizeof(*keys) + n_string);
+        n_buffer = match_keys_n_buffer(string);
+
+        keys = calloc(1, sizeof(*keys) + n_buffer);
         if (!keys)
                 return error_origin(-ENOMEM);
 
-        r = match_keys_init(keys, string, n_string);
+        r = match_keys_init(keys, string, n_buffer);
         if (r)
                 return error_trace(r);
 
@@ -395,132 +471,218 @@ static bool match_string_prefix(const char *string, const char *prefix, char del
         return true;
 }
 
-static bool match_keys_match_metadata(MatchKeys *keys, MessageMetadata *metadata) {
-        if (keys->filter.n_args > metadata->n_args)
-                return false;
-
-        if (keys->filter.n_argpaths > metadata->n_args)
-                return false;
+/*
+ * The registry forms a decision structure: the registry a rule is linked
+ * into decides on its sender, the index decides on path, interface and
+ * member, and the value trees below decide on arg0 and the namespaces. Only
+ * the remaining predicates are checked for each rule. These flags tell
+ * match_keys_match_metadata() which of the optional predicates were decided
+ * already.
+ */
+enum {
+        MATCH_IMPLIED_ARG0              = (1U << 0),
+        MATCH_IMPLIED_ARG0NAMESPACE     = (1U << 1),
+        MATCH_IMPLIED_PATH_NAMESPACE    = (1U << 2),
+};
 
-        if (keys->path_namespace && !match_string_prefix(metadata->fields.path, keys->path_namespace, '/', false))
-                return false;
+static bool match_keys_match_metadata(MatchKeys *keys, MessageMetadata *metadata, unsigned int implied) {
+        MatchFilterArg *arg;
 
-        if (keys->arg0namespace && !(metadata->args[0].element == 's' && match_string_prefix(metadata->args[0].value, keys->arg0namespace, '.', false)))
+        /* argument matches are sorted, so the last one has the highest index */
+        if (keys->filter.n_args && keys->filter.args[keys->filter.n_args - 1].index >= metadata->n_args)
                 return false;
 
-        for (unsigned int i = 0; i < keys->filter.n_args || i < keys->filter.n_argpaths; i ++) {
-                if (keys->filter.args[i] && !(metadata->args[0].element == 's' && c_string_equal(keys->filter.args[i], metadata->args[i].value)))
-                        return false;
-
-                if (keys->filter.argpaths[i]) {
-                        if (!match_string_prefix(metadata->args[i].value, keys->filter.argpaths[i], '/', true) &&
-                            !match_string_prefix(keys->filter.argpaths[i], metadata->args[0].value, '/', true))
-                                return false;
-                }
-        }
-
         if (keys->filter.type != DBUS_MESSAGE_TYPE_INVALID && keys->filter.type != metadata->header.type)
                 return false;
 
         if (keys->filter.sender != ADDRESS_ID_INVALID && keys->filter.sender != metadata->sender_id)
                 return false;
 
-        if (keys->filter.interface && !c_string_equal(keys->filter.interface, metadata->fields.interface))
+        if (!(implied & MATCH_IMPLIED_PATH_NAMESPACE) &&
+            keys->path_namespace && !match_string_prefix(metadata->fields.path, keys->path_namespace, '/', false))
                 return false;
 
-        if (keys->filter.member && !c_string_equal(keys->filter.member, metadata->fields.member))
+        if (!(implied & MATCH_IMPLIED_ARG0NAMESPACE) &&
+            keys->arg0namespace && !(metadata->n_args && metadata->args[0].element == 's' && match_string_prefix(metadata->args[0].value, keys->arg0namespace, '.', false)))
                 return false;
 
-        if (keys->filter.path && !c_string_equal(keys->filter.path, metadata->fields.path))
-                return false;
+        for (size_t i = 0; i < keys->filter.n_args; ++i) {
+                arg = &keys->filter.args[i];
+
+                if (arg->path) {
+                        if (!match_string_prefix(metadata->args[arg->index].value, arg->value, '/', true) &&
+                            !match_string_prefix(arg->value, metadata->args[0].value, '/', true))
+                                return false;
+                } else if (arg->index || !(implied & MATCH_IMPLIED_ARG0)) {
+                        if (!(metadata->args[0].element == 's' && c_string_equal(arg->value, metadata->args[arg->index].value)))
+                                return false;
+                }
+        }
 
         return true;
 }
 
-static int match_registry_by_path_compare(CRBTree *tree, void *k, CRBNode *rb) {
-        MatchRegistryByPath *registry = c_container_of(rb, MatchRegistryByPath, registry_node);
-        const char *path1 = k ?: "", *path2 = registry->path;
-
-        return strcmp(path1, path2);
+static uint64_t match_index_hash(uint64_t path, uint64_t interface, uint64_t member) {
+        return hash_combine(hash_combine(path, interface), member);
 }
 
-static int match_registry_by_path_new(MatchRegistryByPath **registryp, const char *path) {
-        MatchRegistryByPath *registry;
-        size_t n_path;
-
-        if (!path)
-                path = "";
+/*
+ * Every index keeps a small bloom filter of the (interface, member) pairs of
+ * its entries, with two bits per pair. Lookups check it before probing the
+ * table, so indices that cannot contain a match for a message are rejected
+ * with a few bit tests. Bits are not cleared when an entry is removed, but
+ * the filter is rebuilt once the number of removals exceeds the number of
+ * remaining entries.
+ */
+static uint64_t match_index_summary(uint64_t interface, uint64_t member) {
+        uint64_t hash = hash_combine(interface, member);
 
-        n_path = strlen(path);
+        return (UINT64_C(1) << (hash & 63)) | (UINT64_C(1) << ((hash >> 6) & 63));
+}
 
-        registry = malloc(sizeof(*registry) + n_path + 1);
-        if (!registry)
-                return error_origin(-ENOMEM);
+static bool match_index_may_contain(MatchIndex *index, uint64_t interface, uint64_t member) {
+        uint64_t summary = match_index_summary(interface, member);
 
-        *registry = (MatchRegistryByPath)MATCH_REGISTRY_BY_PATH_INIT(*registry);
-        strcpy(registry->path, path);
+        return (index->summary & summary) == summary;
+}
 
-        *registryp = registry;
-        return 0;
+static bool match_registry_by_fields_equal(MatchRegistryByFields *registry, const char *path, const char *interface, const char *member) {
+        return c_string_equal(registry->path, path) &&
+               c_string_equal(registry->interface, interface) &&
+               c_string_equal(registry->member, member);
 }
 
-static MatchRegistryByPath *match_registry_by_path_ref(MatchRegistryByPath *registry) {
-        if (!registry)
+static MatchRegistryByFields *match_index_find(MatchIndex *index, uint64_t hash, const char *path, const char *interface, const char *member) {
+        MatchRegistryByFields *registry;
+        size_t i, mask;
+
+        if (!index->n_entries)
                 return NULL;
 
-        assert(registry->n_refs > 0);
+        mask = index->n_buckets - 1;
 
-        ++registry->n_refs;
+        for (i = hash & mask; (registry = index->buckets[i]); i = (i + 1) & mask)
+                if (registry->hash == hash && match_registry_by_fields_equal(registry, path, interface, member))
+                        return registry;
 
-        return registry;
+        return NULL;
 }
 
-static MatchRegistryByPath *match_registry_by_path_unref(MatchRegistryByPath *registry) {
-        if (!registry || --registry->n_refs > 0)
-                return NULL;
+static void match_index_insert(MatchRegistryByFields **buckets, size_t n_buckets, MatchRegistryByFields *registry) {
+        size_t i, mask = n_buckets - 1;
 
-        assert(c_rbtree_is_empty(&registry->interface_tree));
+        for (i = registry->hash & mask; buckets[i]; i = (i + 1) & mask)
+                ;
 
-        c_rbnode_unlink(&registry->registry_node);
-        free(registry);
-
-        return NULL;
+        buckets[i] = registry;
 }
 
-C_DEFINE_CLEANUP(MatchRegistryByPath *, match_registry_by_path_unref);
+static int match_index_add(MatchIndex *index, MatchRegistryByFields *registry) {
+        MatchRegistryByFields **buckets;
+        size_t i, n_buckets;
 
-static void match_registry_by_path_link(MatchRegistryByPath *registry, CRBTree *tree, CRBNode *parent, CRBNode **slot) {
-        c_rbtree_add(tree, parent, slot, &registry->registry_node);
-}
+        /*
+         * We use open addressing with linear probing, and keep the load
+         * factor at or below 1/2, so probe sequences stay short. The table
+         * grows by doubling, and is released once it runs empty.
+         */
+        if (2 * (index->n_entries + 1) > index->n_buckets) {
+                n_buckets = c_max(index->n_buckets * 2, (size_t)16);
 
-static int match_registry_by_interface_compare(CRBTree *tree, void *k, CRBNode *rb) {
-        MatchRegistryByInterface *registry = c_container_of(rb, MatchRegistryByInterface, registry_node);
-        const char *interface1 = k ?: "", *interface2 = registry->interface;
+                buckets = calloc(n_buckets, sizeof(*buckets));
+                if (!buckets)
+                        return error_origin(-ENOMEM);
 
-        return strcmp(interface1, interface2);
+                for (i = 0; i < index->n_buckets; ++i)
+                        if (index->buckets[i])
+                                match_index_insert(buckets, n_buckets, index->buckets[i]);
+
+                free(index->buckets);
+                index->buckets = buckets;
+                index->n_buckets = n_buckets;
+        }
+
+        match_index_insert(index->buckets, index->n_buckets, registry);
+        ++index->n_entries;
+        index->summary |= registry->summary;
+        registry->index = index;
+
+        return 0;
 }
 
-static int match_registry_by_interface_new(MatchRegistryByInterface **registryp, const char *interface) {
-        MatchRegistryByInterface *registry;
-        size_t n_interface;
+static void match_index_remove(MatchIndex *index, MatchRegistryByFields *registry) {
+        size_t i, j, home, mask = index->n_buckets - 1;
+
+        for (i = registry->hash & mask; index->buckets[i] != registry; i = (i + 1) & mask)
+                assert(index->buckets[i]);
+
+        /*
+         * Backward-shift deletion: Move all following entries of the probe
+         * sequence into the hole, unless that would move them before their
+         * home bucket. This keeps lookups correct without tombstones.
+         */
+        for (j = (i + 1) & mask; index->buckets[j]; j = (j + 1) & mask) {
+                home = index->buckets[j]->hash & mask;
+                if (((j - home) & mask) >= ((j - i) & mask)) {
+                        index->buckets[i] = index->buckets[j];
+                        i = j;
+                }
+        }
+
+        index->buckets[i] = NULL;
+        registry->index = NULL;
+
+        if (!--index->n_entries) {
+                index->buckets = c_free(index->buckets);
+                index->n_buckets = 0;
+                index->summary = 0;
+                index->n_stale = 0;
+        } else if (++index->n_stale > index->n_entries) {
+                index->summary = 0;
+                index->n_stale = 0;
+
+                for (i = 0; i < index->n_buckets; ++i)
+                        if (index->buckets[i])
+                                index->summary |= index->buckets[i]->summary;
+        }
+}
 
-        if (!interface)
-                interface = "";
+static int match_registry_by_fields_new(MatchRegistryByFields **registryp, const char *path, const char *interface, const char *member) {
+        MatchRegistryByFields *registry;
+        size_t n_path, n_interface, n_member;
+        char *p;
 
-        n_interface = strlen(interface);
+        n_path = path ? strlen(path) + 1 : 0;
+        n_interface = interface ? strlen(interface) + 1 : 0;
+        n_member = member ? strlen(member) + 1 : 0;
 
-        registry = malloc(sizeof(*registry) + n_interface + 1);
+        registry = malloc(sizeof(*registry) + n_path + n_interface + n_member);
         if (!registry)
                 return error_origin(-ENOMEM);
 
-        *registry = (MatchRegistryByInterface)MATCH_REGISTRY_BY_INTERFACE_INIT(*registry);
-        strcpy(registry->interface, interface);
+        *registry = (MatchRegistryByFields)MATCH_REGISTRY_BY_FIELDS_INIT;
+        registry->hash = match_index_hash(hash_string(path), hash_string(interface), hash_string(member));
+        registry->summary = match_index_summary(hash_string(interface), hash_string(member));
+
+        p = registry->buffer;
+        if (path) {
+                registry->path = p;
+                p = stpcpy(p, path) + 1;
+        }
+        if (interface) {
+                registry->interface = p;
+                p = stpcpy(p, interface) + 1;
+        }
+        if (member) {
+                registry->member = p;
+                p = stpcpy(p, member) + 1;
+        }
 
         *registryp = registry;
         return 0;
 }
 
-static MatchRegistryByInterface *match_registry_by_interface_ref(MatchRegistryByInterface *registry) {
+static MatchRegistryByFields *match_registry_by_fields_ref(MatchRegistryByFields *registry) {
         if (!registry)
                 return NULL;
 
@@ -531,54 +693,60 @@ static MatchRegistryByInterface *match_registry_by_interface_ref(MatchRegistryBy
         return registry;
 }
 
-static MatchRegistryByInterface *match_registry_by_interface_unref(MatchRegistryByInterface *registry) {
+static MatchRegistryByFields *match_registry_by_fields_unref(MatchRegistryByFields *registry) {
         if (!registry || --registry->n_refs > 0)
                 return NULL;
 
-        assert(c_rbtree_is_empty(&registry->member_tree));
+        assert(c_rbtree_is_empty(&registry->keys_tree));
+        assert(c_rbtree_is_empty(&registry->arg0_tree));
+        assert(c_rbtree_is_empty(&registry->arg0namespace_tree));
+        assert(c_rbtree_is_empty(&registry->path_namespace_tree));
 
-        c_rbnode_unlink(&registry->registry_node);
-        match_registry_by_path_unref(registry->registry_by_path);
+        if (registry->index)
+                match_index_remove(registry->index, registry);
         free(registry);
 
         return NULL;
 }
 
-C_DEFINE_CLEANUP(MatchRegistryByInterface *, match_registry_by_interface_unref);
+C_DEFINE_CLEANUP(MatchRegistryByFields *, match_registry_by_fields_unref);
 
-static void match_registry_by_interface_link(MatchRegistryByInterface *registry, MatchRegistryByPath *registry_by_path, CRBNode *parent, CRBNode **slot) {
-        c_rbtree_add(&registry_by_path->interface_tree, parent, slot, &registry->registry_node);
-        registry->registry_by_path = match_registry_by_path_ref(registry_by_path);
+static int match_registry_by_value_compare(CRBTree *tree, void *k, CRBNode *rb) {
+        MatchRegistryByValue *registry = c_container_of(rb, MatchRegistryByValue, registry_node);
+
+        return strcmp(k, registry->value);
 }
 
-static int match_registry_by_member_compare(CRBTree *tree, void *k, CRBNode *rb) {
-        MatchRegistryByMember *registry = c_container_of(rb, MatchRegistryByMember, registry_node);
-        const char *member1 = k ?: "", *member2 = registry->member;
+static int match_registry_by_value_compare_prefix(CRBTree *tree, void *k, CRBNode *rb) {
+        MatchRegistryByValue *registry = c_container_of(rb, MatchRegistryByValue, registry_node);
+        MatchPrefix *prefix = k;
+        int r;
 
-        return strcmp(member1, member2);
-}
+        r = strncmp(prefix->string, registry->value, prefix->n_string);
+        if (r)
+                return r;
 
-static int match_registry_by_member_new(MatchRegistryByMember **registryp, const char *member) {
-        MatchRegistryByMember *registry;
-        size_t n_member;
+        return registry->value[prefix->n_string] ? -1 : 0;
+}
 
-        if (!member)
-                member = "";
+static int match_registry_by_value_new(MatchRegistryByValue **registryp, const char *value) {
+        MatchRegistryByValue *registry;
+        size_t n_value;
 
-        n_member = strlen(member);
+        n_value = strlen(value) + 1;
 
-        registry = malloc(sizeof(*registry) + n_member + 1);
+        registry = malloc(sizeof(*registry) + n_value);
         if (!registry)
                 return error_origin(-ENOMEM);
 
-        *registry = (MatchRegistryByMember)MATCH_REGISTRY_BY_MEMBER_INIT(*registry);
-        strcpy(registry->member, member);
+        *registry = (MatchRegistryByValue)MATCH_REGISTRY_BY_VALUE_INIT(*registry);
+        memcpy(registry->value, value, n_value);
 
         *registryp = registry;
         return 0;
 }
 
-static MatchRegistryByMember *match_registry_by_member_ref(MatchRegistryByMember *registry) {
+static MatchRegistryByValue *match_registry_by_value_ref(MatchRegistryByValue *registry) {
         if (!registry)
                 return NULL;
 
@@ -589,27 +757,28 @@ static MatchRegistryByMember *match_registry_by_member_ref(MatchRegistryByMember
         return registry;
 }
 
-static MatchRegistryByMember *match_registry_by_member_unref(MatchRegistryByMember *registry) {
+static MatchRegistryByValue *match_registry_by_value_unref(MatchRegistryByValue *registry) {
         if (!registry || --registry->n_refs > 0)
                 return NULL;
 
         assert(c_rbtree_is_empty(&registry->keys_tree));
 
         c_rbnode_unlink(&registry->registry_node);
-        match_registry_by_interface_unref(registry->registry_by_interface);
+        match_registry_by_fields_unref(registry->registry_by_fields);
         free(registry);
 
         return NULL;
 }
 
-C_DEFINE_CLEANUP(MatchRegistryByMember *, match_registry_by_member_unref);
+C_DEFINE_CLEANUP(MatchRegistryByValue *, match_registry_by_value_unref);
 
-static void match_registry_by_member_link(MatchRegistryByMember *registry, MatchRegistryByInterface *registry_by_interface, CRBNode *parent, CRBNode **slot) {
-        c_rbtree_add(&registry_by_interface->member_tree, parent, slot, &registry->registry_node);
-        registry->registry_by_interface = match_registry_by_interface_ref(registry_by_interface);
+static void match_registry_by_value_link(MatchRegistryByValue *registry, MatchRegistryByFields *registry_by_fields, CRBTree *tree, CRBNode *parent, CRBNode **slot) {
+        c_rbtree_add(tree, parent, slot, &registry->registry_node);
+        registry->registry_by_fields = match_registry_by_fields_ref(registry_by_fields);
 }
 
 static int match_keys_compare(MatchKeys *key1, MatchKeys *key2) {
+        MatchFilterArg *arg1, *arg2;
         int r;
 
         if ((r = c_string_compare(key1->sender, key2->sender)) ||
@@ -631,14 +800,21 @@ static int match_keys_compare(MatchKeys *key1, MatchKeys *key2) {
         if (key1->filter.n_args > key2->filter.n_args)
                 return 1;
 
-        if (key1->filter.n_argpaths < key2->filter.n_argpaths)
-                return -1;
-        if (key1->filter.n_argpaths > key2->filter.n_argpaths)
-                return 1;
+        for (size_t i = 0; i < key1->filter.n_args; ++i) {
+                arg1 = &key1->filter.args[i];
+                arg2 = &key2->filter.args[i];
+
+                if (arg1->index < arg2->index)
+                        return -1;
+                if (arg1->index > arg2->index)
+                        return 1;
 
-        for (size_t i = 0; i < key1->filter.n_args || i < key1->filter.n_argpaths; i ++) {
-                if ((r = c_string_compare(key1->filter.args[i], key2->filter.args[i])) ||
-                    (r = c_string_compare(key1->filter.argpaths[i], key2->filter.argpaths[i])))
+                if (arg1->path < arg2->path)
+                        return -1;
+                if (arg1->path > arg2->path)
+                        return 1;
+
+                if ((r = strcmp(arg1->value, arg2->value)))
                         return r;
         }
 
@@ -655,7 +831,8 @@ static int match_registry_by_keys_compare(CRBTree *tree, void *k, CRBNode *rb) {
 static int match_registry_by_keys_new(MatchRegistryByKeys **registryp, MatchKeys *keys) {
         MatchRegistryByKeys *registry;
 
-        registry = malloc(sizeof(*registry) + keys->n_buffer);
+        /* the parsed rule reserves space for the whole rule string, the clone only for the keys it has */
+        registry = malloc(sizeof(*registry) + match_keys_size(keys));
         if (!registry)
                 return error_origin(-ENOMEM);
 
@@ -684,7 +861,8 @@ static MatchRegistryByKeys *match_registry_by_keys_unref(MatchRegistryByKeys *re
         assert(c_list_is_empty(&registry->rule_list));
 
         c_rbnode_unlink(&registry->registry_node);
-        match_registry_by_member_unref(registry->registry_by_member);
+        match_registry_by_value_unref(registry->registry_by_value);
+        match_registry_by_fields_unref(registry->registry_by_fields);
         free(registry);
 
         return NULL;
@@ -692,9 +870,14 @@ static MatchRegistryByKeys *match_registry_by_keys_unref(MatchRegistryByKeys *re
 
 C_DEFINE_CLEANUP(MatchRegistryByKeys *, match_registry_by_keys_unref);
 
-static void match_registry_by_keys_link(MatchRegistryByKeys *registry, MatchRegistryByMember *registry_by_member, CRBNode *parent, CRBNode **slot) {
-        c_rbtree_add(&registry_by_member->keys_tree, parent, slot, &registry->registry_node);
-        registry->registry_by_member = match_registry_by_member_ref(registry_by_member);
+static void match_registry_by_keys_link(MatchRegistryByKeys *registry, MatchRegistryByFields *registry_by_fields, CRBNode *parent, CRBNode **slot) {
+        c_rbtree_add(&registry_by_fields->keys_tree, parent, slot, &registry->registry_node);
+        registry->registry_by_fields = match_registry_by_fields_ref(registry_by_fields);
+}
+
+static void match_registry_by_keys_link_by_value(MatchRegistryByKeys *registry, MatchRegistryByValue *registry_by_value, CRBNode *parent, CRBNode **slot) {
+        c_rbtree_add(&registry_by_value->keys_tree, parent, slot, &registry->registry_node);
+        registry->registry_by_value = match_registry_by_value_ref(registry_by_value);
 }
 
 static int match_rule_compare(CRBTree *tree, void *k, CRBNode *rb) {
@@ -715,7 +898,7 @@ static MatchRule *match_rule_free(MatchRule *rule) {
         user_charge_deinit(&rule->charge[0]);
         c_rbnode_unlink(&rule->owner_node);
         match_rule_unlink(rule);
-        free(rule);
+        pool_free(rule->pool, rule);
 
         return NULL;
 }
@@ -724,26 +907,31 @@ C_DEFINE_CLEANUP(MatchRule *, match_rule_free);
 
 static int match_rule_new(MatchRule **rulep, MatchOwner *owner, User *user, const char *string) {
         _c_cleanup_(match_rule_freep) MatchRule *rule = NULL;
-        size_t n_string;
+        size_t n_buffer;
+        Pool *pool;
         int r;
 
-        n_string = strlen(string) + 1;
-        if (n_string - 1 > MATCH_RULE_LENGTH_MAX)
+        if (strlen(string) > MATCH_RULE_LENGTH_MAX)
                 return MATCH_E_INVALID;
 
-        rule = calloc(1, sizeof(*rule) + n_string);
+        n_buffer = match_keys_n_buffer(string);
+
+        pool = pool_select(match_rule_pools, C_ARRAY_SIZE(match_rule_pools), sizeof(*rule) + n_buffer);
+
+        rule = pool_alloc0(pool, sizeof(*rule) + n_buffer);
         if (!rule)
                 return error_origin(-ENOMEM);
 
         *rule = (MatchRule)MATCH_RULE_NULL(*rule);
         rule->owner = owner;
+        rule->pool = pool;
 
-        r = user_charge(user, &rule->charge[0], NULL, USER_SLOT_BYTES, sizeof(*rule) + n_string);
+        r = user_charge(user, &rule->charge[0], NULL, USER_SLOT_BYTES, sizeof(*rule) + n_buffer);
         r = r ?: user_charge(user, &rule->charge[1], NULL, USER_SLOT_MATCHES, 1);
         if (r)
                 return (r == USER_E_QUOTA) ? MATCH_E_QUOTA : error_fold(r);
 
-        r = match_keys_init(&rule->keys, string, n_string);
+        r = match_keys_init(&rule->keys, string, n_buffer);
         if (r)
                 return error_trace(r);
 
@@ -786,9 +974,11 @@ MatchRule *match_rule_user_unref(MatchRule *rule) {
 static void match_rule_link_by_keys(MatchRule *rule, MatchRegistryByKeys *registry) {
         c_list_link_tail(&registry->rule_list, &rule->registry_link);
         rule->registry_by_keys = match_registry_by_keys_ref(registry);
+        rule->n_evaluations_base = registry->n_evaluations;
+        rule->n_hits_base = registry->n_hits;
 }
 
-static int match_rule_link_by_member(MatchRule *rule, MatchRegistryByMember *registry) {
+static int match_rule_link_by_value(MatchRule *rule, MatchRegistryByValue *registry) {
         _c_cleanup_(match_registry_by_keys_unrefp) MatchRegistryByKeys *registry_by_keys = NULL;
         CRBNode **slot, *parent;
         int r;
@@ -801,7 +991,7 @@ static int match_rule_link_by_member(MatchRule *rule, MatchRegistryByMember *reg
                 if (r)
                         return error_trace(r);
 
-                match_registry_by_keys_link(registry_by_keys, registry, parent, slot);
+                match_registry_by_keys_link_by_value(registry_by_keys, registry, parent, slot);
         }
 
         match_rule_link_by_keys(rule, registry_by_keys);
@@ -809,48 +999,66 @@ static int match_rule_link_by_member(MatchRule *rule, MatchRegistryByMember *reg
         return 0;
 }
 
-static int match_rule_link_by_interface(MatchRule *rule, MatchRegistryByInterface *registry) {
-        _c_cleanup_(match_registry_by_member_unrefp) MatchRegistryByMember *registry_by_member = NULL;
+static int match_rule_link_by_fields(MatchRule *rule, MatchRegistryByFields *registry) {
+        _c_cleanup_(match_registry_by_value_unrefp) MatchRegistryByValue *registry_by_value = NULL;
+        _c_cleanup_(match_registry_by_keys_unrefp) MatchRegistryByKeys *registry_by_keys = NULL;
         CRBNode **slot, *parent;
+        const char *value;
+        CRBTree *tree;
         int r;
 
-        slot = c_rbtree_find_slot(&registry->member_tree, match_registry_by_member_compare, rule->keys.filter.member, &parent);
-        if (!slot) {
-                registry_by_member = match_registry_by_member_ref(c_rbnode_entry(parent, MatchRegistryByMember, registry_node));
+        /*
+         * Rules that match on arg0 (most prominently, NameOwnerChanged
+         * subscriptions for a single name) are indexed by the value of arg0,
+         * so a lookup only considers those rules that can possibly match.
+         * Similarly, rules with an arg0 or path namespace are indexed by
+         * their namespace, and a lookup only considers the namespaces that
+         * are ancestors of the respective message field.
+         */
+        if ((value = match_filter_get_arg(&rule->keys.filter, 0))) {
+                tree = &registry->arg0_tree;
+        } else if (rule->keys.arg0namespace) {
+                tree = &registry->arg0namespace_tree;
+                value = rule->keys.arg0namespace;
+        } else if (rule->keys.path_namespace) {
+                tree = &registry->path_namespace_tree;
+                value = rule->keys.path_namespace;
         } else {
-                r = match_registry_by_member_new(&registry_by_member, rule->keys.filter.member);
-                if (r)
-                        return error_trace(r);
-
-                match_registry_by_member_link(registry_by_member, registry, parent, slot);
+                tree = NULL;
+                value = NULL;
         }
 
-        r = match_rule_link_by_member(rule, registry_by_member);
-        if (r)
-                return error_trace(r);
+        if (tree) {
+                slot = c_rbtree_find_slot(tree, match_registry_by_value_compare, value, &parent);
+                if (!slot) {
+                        registry_by_value = match_registry_by_value_ref(c_rbnode_entry(parent, MatchRegistryByValue, registry_node));
+                } else {
+                        r = match_registry_by_value_new(&registry_by_value, value);
+                        if (r)
+                                return error_trace(r);
 
-        return 0;
-}
+                        match_registry_by_value_link(registry_by_value, registry, tree, parent, slot);
+                }
 
-static int match_rule_link_by_path(MatchRule *rule, MatchRegistryByPath *registry) {
-        _c_cleanup_(match_registry_by_interface_unrefp) MatchRegistryByInterface *registry_by_interface = NULL;
-        CRBNode **slot, *parent;
-        int r;
+                r = match_rule_link_by_value(rule, registry_by_value);
+                if (r)
+                        return error_trace(r);
 
-        slot = c_rbtree_find_slot(&registry->interface_tree, match_registry_by_interface_compare, rule->keys.filter.interface, &parent);
+                return 0;
+        }
+
+        slot = c_rbtree_find_slot(&registry->keys_tree, match_registry_by_keys_compare, &rule->keys, &parent);
         if (!slot) {
-                registry_by_interface = match_registry_by_interface_ref(c_rbnode_entry(parent, MatchRegistryByInterface, registry_node));
+                registry_by_keys = match_registry_by_keys_ref(c_rbnode_entry(parent, MatchRegistryByKeys, registry_node));
         } else {
-                r = match_registry_by_interface_new(&registry_by_interface, rule->keys.filter.interface);
+                r = match_registry_by_keys_new(&registry_by_keys, &rule->keys);
                 if (r)
                         return error_trace(r);
 
-                match_registry_by_interface_link(registry_by_interface, registry, parent, slot);
+                match_registry_by_keys_link(registry_by_keys, registry, parent, slot);
         }
 
-        r = match_rule_link_by_interface(rule, registry_by_interface);
-        if (r)
-                return error_trace(r);
+        match_rule_link_by_keys(rule, registry_by_keys);
 
         return 0;
 }
@@ -859,9 +1067,12 @@ static int match_rule_link_by_path(MatchRule *rule, MatchRegistryByPath *registr
  * match_rule_link() - XXX
  */
 int match_rule_link(MatchRule *rule, MatchRegistry *registry, bool monitor) {
-        _c_cleanup_(match_registry_by_path_unrefp) MatchRegistryByPath *registry_by_path = NULL;
-        CRBTree *tree;
-        CRBNode **slot, *parent;
+        _c_cleanup_(match_registry_by_fields_unrefp) MatchRegistryByFields *registry_by_fields = NULL;
+        const char *path = rule->keys.filter.path;
+        const char *interface = rule->keys.filter.interface;
+        const char *member = rule->keys.filter.member;
+        MatchIndex *index;
+        uint64_t hash;
         int r;
 
         if (rule->registry) {
@@ -872,25 +1083,28 @@ int match_rule_link(MatchRule *rule, MatchRegistry *registry, bool monitor) {
         }
 
         if (monitor)
-                tree = &registry->monitor_tree;
+                index = &registry->monitor_index;
         else
-                tree = &registry->subscription_tree;
+                index = &registry->subscription_index;
 
-        slot = c_rbtree_find_slot(tree, match_registry_by_path_compare, rule->keys.filter.path, &parent);
-        if (!slot) {
-                registry_by_path = match_registry_by_path_ref(c_rbnode_entry(parent, MatchRegistryByPath, registry_node));
-        } else {
-                r = match_registry_by_path_new(&registry_by_path, rule->keys.filter.path);
+        hash = match_index_hash(hash_string(path), hash_string(interface), hash_string(member));
+
+        registry_by_fields = match_registry_by_fields_ref(match_index_find(index, hash, path, interface, member));
+        if (!registry_by_fields) {
+                r = match_registry_by_fields_new(&registry_by_fields, path, interface, member);
                 if (r)
                         return error_trace(r);
 
-                match_registry_by_path_link(registry_by_path, tree, parent, slot);
+                r = match_index_add(index, registry_by_fields);
+                if (r)
+                        return error_trace(r);
         }
 
-        r = match_rule_link_by_path(rule, registry_by_path);
+        r = match_rule_link_by_fields(rule, registry_by_fields);
         if (r)
                 return error_trace(r);
         rule->registry = registry;
+        ++match_generation;
 
         return 0;
 }
@@ -903,7 +1117,130 @@ void match_rule_unlink(MatchRule *rule) {
                 c_list_unlink(&rule->registry_link);
                 rule->registry_by_keys = match_registry_by_keys_unref(rule->registry_by_keys);
                 rule->registry = NULL;
+                ++match_generation;
+        }
+}
+
+/**
+ * match_rule_get_counters() - query statistics of a rule
+ * @rule:               rule to operate on
+ * @n_evaluationsp:     output argument for the number of evaluations
+ * @n_hitsp:            output argument for the number of hits
+ *
+ * All rules with equal keys in a registry share their evaluation, so the
+ * counting is done on the shared keys. This returns how often those keys were
+ * evaluated against a message, and how often they matched, since @rule was
+ * linked. If @rule is not linked, both counters are 0.
+ *
+ * Broadcasts served from the destination cache of the bus do not evaluate any
+ * rules, but the cache credits the evaluations it saves via
+ * match_trace_credit(), so they are counted as well.
+ */
+void match_rule_get_counters(MatchRule *rule, uint64_t *n_evaluationsp, uint64_t *n_hitsp) {
+        if (rule->registry_by_keys) {
+                *n_evaluationsp = rule->registry_by_keys->n_evaluations - rule->n_evaluations_base;
+                *n_hitsp = rule->registry_by_keys->n_hits - rule->n_hits_base;
+        } else {
+                *n_evaluationsp = 0;
+                *n_hitsp = 0;
+        }
+}
+
+static size_t match_format_put(char *p, size_t n, const char *string) {
+        size_t n_string = strlen(string);
+
+        if (p)
+                memcpy(p + n, string, n_string);
+
+        return n + n_string;
+}
+
+static size_t match_format_pair(char *p, size_t n, const char *key, const char *value) {
+        if (n)
+                n = match_format_put(p, n, ",");
+
+        n = match_format_put(p, n, key);
+        n = match_format_put(p, n, "='");
+
+        for ( ; *value; ++value) {
+                if (*value == '\'') {
+                        /* quotes cannot be escaped, so end the quoted section */
+                        n = match_format_put(p, n, "'\\''");
+                } else {
+                        if (p)
+                                p[n] = *value;
+                        ++n;
+                }
         }
+
+        return match_format_put(p, n, "'");
+}
+
+static size_t match_keys_format(MatchKeys *keys, char *p) {
+        static const char * const types[] = {
+                [DBUS_MESSAGE_TYPE_METHOD_CALL] = "method_call",
+                [DBUS_MESSAGE_TYPE_METHOD_RETURN] = "method_return",
+                [DBUS_MESSAGE_TYPE_ERROR] = "error",
+                [DBUS_MESSAGE_TYPE_SIGNAL] = "signal",
+        };
+        char key[sizeof("arg63path")];
+        MatchFilterArg *arg;
+        size_t n = 0;
+
+        if (keys->filter.type != DBUS_MESSAGE_TYPE_INVALID)
+                n = match_format_pair(p, n, "type", types[keys->filter.type]);
+        if (keys->sender)
+                n = match_format_pair(p, n, "sender", keys->sender);
+        if (keys->destination)
+                n = match_format_pair(p, n, "destination", keys->destination);
+        if (keys->filter.interface)
+                n = match_format_pair(p, n, "interface", keys->filter.interface);
+        if (keys->filter.member)
+                n = match_format_pair(p, n, "member", keys->filter.member);
+        if (keys->filter.path)
+                n = match_format_pair(p, n, "path", keys->filter.path);
+        if (keys->path_namespace)
+                n = match_format_pair(p, n, "path_namespace", keys->path_namespace);
+        if (keys->arg0namespace)
+                n = match_format_pair(p, n, "arg0namespace", keys->arg0namespace);
+
+        for (size_t i = 0; i < keys->filter.n_args; ++i) {
+                arg = &keys->filter.args[i];
+
+                sprintf(key, "arg%u%s", arg->index, arg->path ? "path" : "");
+                n = match_format_pair(p, n, key, arg->value);
+        }
+
+        return n;
+}
+
+/**
+ * match_rule_format() - format a rule as string
+ * @rule:               rule to operate on
+ * @stringp:            output argument for the string
+ *
+ * This formats the keys of @rule as a match rule string, in canonical form.
+ * That is, all values are quoted and the keys are in a fixed order. Parsing
+ * the string yields keys equal to the keys of @rule. The caller owns the
+ * returned string.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+int match_rule_format(MatchRule *rule, char **stringp) {
+        char *string;
+        size_t n;
+
+        n = match_keys_format(&rule->keys, NULL);
+
+        string = malloc(n + 1);
+        if (!string)
+                return error_origin(-ENOMEM);
+
+        match_keys_format(&rule->keys, string);
+        string[n] = 0;
+
+        *stringp = string;
+        return 0;
 }
 
 /**
@@ -983,8 +1320,8 @@ void match_registry_init(MatchRegistry *registry) {
  * match_registry_deinit() - XXX
  */
 void match_registry_deinit(MatchRegistry *registry) {
-        assert(c_rbtree_is_empty(&registry->subscription_tree));
-        assert(c_rbtree_is_empty(&registry->monitor_tree));
+        assert(!registry->subscription_index.n_entries);
+        assert(!registry->monitor_index.n_entries);
 }
 
 static void match_registry_by_keys_get_destinations(MatchRegistryByKeys *registry, CList *destinations) {
@@ -999,67 +1336,242 @@ static void match_registry_by_keys_get_destinations(MatchRegistryByKeys *registr
         }
 }
 
-static void match_registry_by_member_get_destinations(MatchRegistryByMember *registry, CList *destinations, MessageMetadata *metadata) {
+static void match_trace_record(MatchTrace *trace, MatchRegistryByKeys *registry, bool hit) {
+        if (!trace || trace->truncated)
+                return;
+
+        if (trace->n_entries >= C_ARRAY_SIZE(trace->entries)) {
+                /* the trace is bounded, the caller must not rely on a truncated one */
+                trace->truncated = true;
+                return;
+        }
+
+        trace->entries[trace->n_entries++] = (MatchTraceEntry){
+                .registry = registry,
+                .hit = hit,
+        };
+}
+
+static bool match_registry_by_tree_get_destinations(CRBTree *keys_tree, unsigned int implied, CList *destinations, MessageMetadata *metadata, MatchTrace *trace) {
         MatchRegistryByKeys *registry_by_keys;
+        bool body = false, hit;
 
-        c_rbtree_for_each_entry_postorder(registry_by_keys, &registry->keys_tree, registry_node) {
-                if (!match_keys_match_metadata(&registry_by_keys->keys, metadata))
-                        continue;
+        c_rbtree_for_each_entry_postorder(registry_by_keys, keys_tree, registry_node) {
+                if (registry_by_keys->keys.filter.n_args)
+                        body = true;
+
+                hit = match_keys_match_metadata(&registry_by_keys->keys, metadata, implied);
+
+                ++registry_by_keys->n_evaluations;
+                if (hit)
+                        ++registry_by_keys->n_hits;
+                match_trace_record(trace, registry_by_keys, hit);
 
-                match_registry_by_keys_get_destinations(registry_by_keys, destinations);
+                if (hit)
+                        match_registry_by_keys_get_destinations(registry_by_keys, destinations);
         }
+
+        return body;
 }
 
-static void match_registry_by_interface_get_destinations(MatchRegistryByInterface *registry, CList *destinations, MessageMetadata *metadata) {
-        MatchRegistryByMember *registry_by_member;
+static bool match_registry_by_namespace_get_destinations(CRBTree *tree,
+                                                         const char *string,
+                                                         char delimiter,
+                                                         unsigned int implied,
+                                                         CList *destinations,
+                                                         MessageMetadata *metadata,
+                                                         MatchTrace *trace) {
+        MatchRegistryByValue *registry_by_value;
+        MatchPrefix prefix = { .string = string };
+        bool body = false;
+        size_t i;
+
+        if (c_rbtree_is_empty(tree))
+                return false;
 
-        registry_by_member = c_rbtree_find_entry(&registry->member_tree, match_registry_by_member_compare, NULL, MatchRegistryByMember, registry_node);
-        if (registry_by_member)
-                match_registry_by_member_get_destinations(registry_by_member, destinations, metadata);
+        /*
+         * A namespace matches @string if it is equal to @string, or to any
+         * of its prefixes that end right before a @delimiter. Look up each
+         * of those ancestors, rather than checking every namespace.
+         */
+        for (i = 0; ; ++i) {
+                if (i && (string[i] == delimiter || !string[i])) {
+                        prefix.n_string = i;
+                        registry_by_value = c_rbtree_find_entry(tree,
+                                                               match_registry_by_value_compare_prefix,
+                                                               &prefix,
+                                                               MatchRegistryByValue,
+                                                               registry_node);
+                        if (registry_by_value &&
+                            match_registry_by_tree_get_destinations(&registry_by_value->keys_tree, implied, destinations, metadata, trace))
+                                body = true;
+                }
 
-        if (metadata->fields.member) {
-                registry_by_member = c_rbtree_find_entry(&registry->member_tree, match_registry_by_member_compare, metadata->fields.member, MatchRegistryByMember, registry_node);
-                if (registry_by_member)
-                        match_registry_by_member_get_destinations(registry_by_member, destinations, metadata);
+                if (!string[i])
+                        break;
         }
+
+        return body;
 }
 
-static void match_registry_by_path_get_destinations(MatchRegistryByPath *registry, CList *destinations, MessageMetadata *metadata) {
-        MatchRegistryByInterface *registry_by_interface;
+static bool match_registry_by_fields_get_destinations(MatchRegistryByFields *registry, CList *destinations, MessageMetadata *metadata, MatchTrace *trace) {
+        MatchRegistryByValue *registry_by_value;
+        bool body;
 
-        registry_by_interface = c_rbtree_find_entry(&registry->interface_tree, match_registry_by_interface_compare, NULL, MatchRegistryByInterface, registry_node);
-        if (registry_by_interface)
-                match_registry_by_interface_get_destinations(registry_by_interface, destinations, metadata);
+        body = match_registry_by_tree_get_destinations(&registry->keys_tree, 0, destinations, metadata, trace);
 
-        if (metadata->fields.interface) {
-                registry_by_interface = c_rbtree_find_entry(&registry->interface_tree, match_registry_by_interface_compare, metadata->fields.interface, MatchRegistryByInterface, registry_node);
-                if (registry_by_interface)
-                        match_registry_by_interface_get_destinations(registry_by_interface, destinations, metadata);
-        }
+        if (metadata->fields.path &&
+            match_registry_by_namespace_get_destinations(&registry->path_namespace_tree,
+                                                         metadata->fields.path,
+                                                         '/',
+                                                         MATCH_IMPLIED_PATH_NAMESPACE,
+                                                         destinations,
+                                                         metadata,
+                                                         trace))
+                body = true;
 
+        /*
+         * Any arg0 or arg0namespace rule makes the result depend on the body,
+         * even if it cannot match this particular message.
+         */
+        if (c_rbtree_is_empty(&registry->arg0namespace_tree) && c_rbtree_is_empty(&registry->arg0_tree))
+                return body;
+
+        /* rules with arg0 matches can only match messages with a string arg0 */
+        if (!metadata->n_args || metadata->args[0].element != 's')
+                return true;
+
+        match_registry_by_namespace_get_destinations(&registry->arg0namespace_tree,
+                                                     metadata->args[0].value,
+                                                     '.',
+                                                     MATCH_IMPLIED_ARG0NAMESPACE,
+                                                     destinations,
+                                                     metadata,
+                                                     trace);
+
+        if (c_rbtree_is_empty(&registry->arg0_tree))
+                return true;
+
+        registry_by_value = c_rbtree_find_entry(&registry->arg0_tree,
+                                               match_registry_by_value_compare,
+                                               metadata->args[0].value,
+                                               MatchRegistryByValue,
+                                               registry_node);
+        if (registry_by_value)
+                match_registry_by_tree_get_destinations(&registry_by_value->keys_tree, MATCH_IMPLIED_ARG0, destinations, metadata, trace);
+
+        return true;
 }
 
-static void match_registry_get_destinations(CRBTree *tree, CList *destinations, MessageMetadata *metadata) {
-        MatchRegistryByPath *registry_by_path;
+static bool match_registry_get_destinations(MatchIndex *index, CList *destinations, MessageMetadata *metadata, MatchTrace *trace) {
+        const char *paths[] = { NULL, metadata->fields.path };
+        const char *interfaces[] = { NULL, metadata->fields.interface };
+        const char *members[] = { NULL, metadata->fields.member };
+        uint64_t hash_paths[2] = {}, hash_interfaces[2] = {}, hash_members[2] = {};
+        MatchRegistryByFields *registry;
+        bool body = false, candidates = false;
+        uint64_t hash;
+        size_t i, j, k;
+
+        if (!index->n_entries)
+                return false;
+
+        if (metadata->hashes.valid) {
+                hash_paths[1] = metadata->hashes.path;
+                hash_interfaces[1] = metadata->hashes.interface;
+                hash_members[1] = metadata->hashes.member;
+        } else {
+                hash_paths[1] = hash_string(metadata->fields.path);
+                hash_interfaces[1] = hash_string(metadata->fields.interface);
+                hash_members[1] = hash_string(metadata->fields.member);
+        }
+
+        for (j = 0; j < 2 && (!j || interfaces[j]); ++j)
+                for (k = 0; k < 2 && (!k || members[k]); ++k)
+                        if (match_index_may_contain(index, hash_interfaces[j], hash_members[k]))
+                                candidates = true;
 
-        registry_by_path = c_rbtree_find_entry(tree, match_registry_by_path_compare, NULL, MatchRegistryByPath, registry_node);
-        if (registry_by_path)
-                match_registry_by_path_get_destinations(registry_by_path, destinations, metadata);
+        if (!candidates)
+                return false;
 
-        if (metadata->fields.path) {
-                registry_by_path = c_rbtree_find_entry(tree, match_registry_by_path_compare, metadata->fields.path, MatchRegistryByPath, registry_node);
-                if (registry_by_path)
-                        match_registry_by_path_get_destinations(registry_by_path, destinations, metadata);
+        /*
+         * Rules are indexed by their path, interface and member, each of
+         * which might be unset and thus match anything. Look up all
+         * combinations of wildcards and the actual values of @metadata. If a
+         * field is not set on the message, only its wildcard can match.
+         */
+        for (i = 0; i < 2 && (!i || paths[i]); ++i) {
+                for (j = 0; j < 2 && (!j || interfaces[j]); ++j) {
+                        hash = hash_combine(hash_paths[i], hash_interfaces[j]);
+
+                        for (k = 0; k < 2 && (!k || members[k]); ++k) {
+                                registry = match_index_find(index,
+                                                            hash_combine(hash, hash_members[k]),
+                                                            paths[i],
+                                                            interfaces[j],
+                                                            members[k]);
+                                if (registry &&
+                                    match_registry_by_fields_get_destinations(registry, destinations, metadata, trace))
+                                        body = true;
+                        }
+                }
         }
 
+        return body;
+}
+
+/**
+ * match_registry_get_subscribers() - collect subscribers of a message
+ * @registry:           registry to operate on
+ * @destinations:       list to link the subscribers into
+ * @metadata:           metadata of the message
+ * @trace:              trace to record evaluated rules in, or NULL
+ *
+ * This links the owners of all subscriptions in @registry that match
+ * @metadata into @destinations. Owners that are already linked into a
+ * destination list are skipped.
+ *
+ * If @trace is given, every evaluation of a rule is appended to it, so the
+ * caller can credit the same evaluations again via match_trace_credit() if
+ * it re-uses the result for another message with the same routing fields.
+ * Once more than MATCH_TRACE_MAX rules were evaluated, the trace is marked as
+ * truncated instead.
+ *
+ * Return: True if the set of candidate rules depends on the message body
+ *         (i.e., any of them has argument matches), false if the result is
+ *         fully determined by the message type, sender, path, interface and
+ *         member.
+ */
+bool match_registry_get_subscribers(MatchRegistry *registry, CList *destinations, MessageMetadata *metadata, MatchTrace *trace) {
+        return match_registry_get_destinations(&registry->subscription_index, destinations, metadata, trace);
 }
 
-void match_registry_get_subscribers(MatchRegistry *registry, CList *destinations, MessageMetadata *metadata) {
-        match_registry_get_destinations(&registry->subscription_tree, destinations, metadata);
+/**
+ * match_registry_get_monitors() - collect monitors of a message
+ * @registry:           registry to operate on
+ * @destinations:       list to link the monitors into
+ * @metadata:           metadata of the message
+ *
+ * This is the equivalent of match_registry_get_subscribers() for monitor
+ * rules.
+ *
+ * Return: True if the result depends on the message body, false otherwise.
+ */
+bool match_registry_get_monitors(MatchRegistry *registry, CList *destinations, MessageMetadata *metadata) {
+        return match_registry_get_destinations(&registry->monitor_index, destinations, metadata, NULL);
 }
 
-void match_registry_get_monitors(MatchRegistry *registry, CList *destinations, MessageMetadata *metadata) {
-        match_registry_get_destinations(&registry->monitor_tree, destinations, metadata);
+/**
+ * match_registry_generation() - query generation of all registries
+ *
+ * This returns a counter that is bumped whenever a rule is linked into, or
+ * unlinked from, any match registry. As long as it is unchanged, lookups with
+ * equal message metadata yield equal results.
+ *
+ * Return: The current generation.
+ */
+uint64_t match_registry_generation(void) {
+        return match_generation;
 }
 
 static void match_registry_by_keys_flush(MatchRegistryByKeys *registry) {
@@ -1071,53 +1583,92 @@ static void match_registry_by_keys_flush(MatchRegistryByKeys *registry) {
         assert(c_list_is_empty(&registry->rule_list));
 }
 
-static void match_registry_by_member_flush(MatchRegistryByMember *registry) {
+static void match_registry_by_tree_flush(CRBTree *keys_tree) {
         MatchRegistryByKeys *registry_by_keys, *registry_by_keys_safe;
 
-        c_rbtree_for_each_entry_safe(registry_by_keys, registry_by_keys_safe, &registry->keys_tree, registry_node) {
+        c_rbtree_for_each_entry_safe(registry_by_keys, registry_by_keys_safe, keys_tree, registry_node) {
                 match_registry_by_keys_ref(registry_by_keys);
                 match_registry_by_keys_flush(registry_by_keys);
                 match_registry_by_keys_unref(registry_by_keys);
         }
 
-        assert(c_rbtree_is_empty(&registry->keys_tree));
+        assert(c_rbtree_is_empty(keys_tree));
 }
 
-static void match_registry_by_interface_flush(MatchRegistryByInterface *registry) {
-        MatchRegistryByMember *registry_by_member, *registry_by_member_safe;
+static void match_registry_by_values_flush(CRBTree *tree) {
+        MatchRegistryByValue *registry_by_value, *registry_by_value_safe;
 
-        c_rbtree_for_each_entry_safe(registry_by_member, registry_by_member_safe, &registry->member_tree, registry_node) {
-                match_registry_by_member_ref(registry_by_member);
-                match_registry_by_member_flush(registry_by_member);
-                match_registry_by_member_unref(registry_by_member);
+        c_rbtree_for_each_entry_safe(registry_by_value, registry_by_value_safe, tree, registry_node) {
+                match_registry_by_value_ref(registry_by_value);
+                match_registry_by_tree_flush(&registry_by_value->keys_tree);
+                match_registry_by_value_unref(registry_by_value);
         }
 
-        assert(c_rbtree_is_empty(&registry->member_tree));
+        assert(c_rbtree_is_empty(tree));
 }
 
-static void match_registry_by_path_flush(MatchRegistryByPath *registry) {
-        MatchRegistryByInterface *registry_by_interface, *registry_by_interface_safe;
-
-        c_rbtree_for_each_entry_safe(registry_by_interface, registry_by_interface_safe, &registry->interface_tree, registry_node) {
-                match_registry_by_interface_ref(registry_by_interface);
-                match_registry_by_interface_flush(registry_by_interface);
-                match_registry_by_interface_unref(registry_by_interface);
-        }
-
-        assert(c_rbtree_is_empty(&registry->interface_tree));
+static void match_registry_by_fields_flush(MatchRegistryByFields *registry) {
+        match_registry_by_tree_flush(&registry->keys_tree);
+        match_registry_by_values_flush(&registry->arg0_tree);
+        match_registry_by_values_flush(&registry->arg0namespace_tree);
+        match_registry_by_values_flush(&registry->path_namespace_tree);
 }
 
 /**
  * mach_registry_flush() - XXX
  */
 void match_registry_flush(MatchRegistry *registry) {
-        MatchRegistryByPath *registry_by_path, *registry_by_path_safe;
+        MatchIndex *index = &registry->subscription_index;
+        MatchRegistryByFields *registry_by_fields;
+        size_t i = 0;
 
-        c_rbtree_for_each_entry_safe(registry_by_path, registry_by_path_safe, &registry->subscription_tree, registry_node) {
-                match_registry_by_path_ref(registry_by_path);
-                match_registry_by_path_flush(registry_by_path);
-                match_registry_by_path_unref(registry_by_path);
+        /*
+         * Flushing an entry removes it from the index, which might shift a
+         * following entry into its bucket. Hence, only advance on empty
+         * buckets. Once the index runs empty, its buckets are released.
+         */
+        while (i < index->n_buckets) {
+                registry_by_fields = index->buckets[i];
+                if (!registry_by_fields) {
+                        ++i;
+                        continue;
+                }
+
+                match_registry_by_fields_ref(registry_by_fields);
+                match_registry_by_fields_flush(registry_by_fields);
+                match_registry_by_fields_unref(registry_by_fields);
         }
 
-        assert(c_rbtree_is_empty(&registry->subscription_tree));
+        assert(!index->n_entries);
+}
+
+/**
+ * match_trace_reset() - start a new trace
+ * @trace:              trace to operate on
+ *
+ * This drops all entries of @trace.
+ */
+void match_trace_reset(MatchTrace *trace) {
+        trace->n_entries = 0;
+        trace->truncated = false;
+}
+
+/**
+ * match_trace_credit() - credit recorded evaluations
+ * @entries:            recorded evaluations
+ * @n_entries:          number of entries in @entries
+ *
+ * This increments the counters of all the evaluated rules in @entries, as if
+ * they were evaluated again with the same outcome. The caller must make sure
+ * none of the rules were unlinked since they were recorded, which is the case
+ * as long as match_registry_generation() did not change.
+ */
+void match_trace_credit(const MatchTraceEntry *entries, size_t n_entries) {
+        size_t i;
+
+        for (i = 0; i < n_entries; ++i) {
+                ++entries[i].registry->n_evaluations;
+                if (entries[i].hit)
+                        ++entries[i].registry->n_hits;
+        }
 }
@@ -11,17 +11,23 @@
 #include "util/user.h"
 
 typedef struct MatchFilter MatchFilter;
+typedef struct MatchFilterArg MatchFilterArg;
+typedef struct MatchIndex MatchIndex;
 typedef struct MatchKeys MatchKeys;
 typedef struct MatchOwner MatchOwner;
+typedef struct MatchRegistryByValue MatchRegistryByValue;
 typedef struct MatchRegistryByKeys MatchRegistryByKeys;
-typedef struct MatchRegistryByMember MatchRegistryByMember;
-typedef struct MatchRegistryByInterface MatchRegistryByInterface;
-typedef struct MatchRegistryByPath MatchRegistryByPath;
+typedef struct MatchRegistryByFields MatchRegistryByFields;
 typedef struct MatchRegistry MatchRegistry;
 typedef struct MatchRule MatchRule;
+typedef struct MatchTrace MatchTrace;
+typedef struct MatchTraceEntry MatchTraceEntry;
 typedef struct MessageMetadata MessageMetadata;
+typedef struct Pool Pool;
 
 #define MATCH_RULE_LENGTH_MAX (1024UL) /* taken from dbus-daemon(1) */
+#define MATCH_ARGS_MAX (64UL) /* argN matches for N in [0, 63] */
+#define MATCH_TRACE_MAX (32UL) /* max evaluations recorded per trace */
 
 enum {
         _MATCH_E_SUCCESS,
@@ -31,16 +37,20 @@ enum {
         MATCH_E_QUOTA,
 };
 
+struct MatchFilterArg {
+        const char *value;
+        uint8_t index;
+        bool path;
+};
+
 struct MatchFilter {
         uint8_t type;
         uint64_t sender;
         const char *interface;
         const char *member;
         const char *path;
-        const char *args[64];
+        MatchFilterArg *args; /* argN and argNpath matches, sorted by N */
         size_t n_args;
-        const char *argpaths[64];
-        size_t n_argpaths;
 };
 
 #define MATCH_FILTER_INIT {                             \
@@ -70,6 +80,11 @@ struct MatchRule {
         MatchRegistry *registry;
         MatchOwner *owner;
         CRBNode owner_node;
+        Pool *pool;
+
+        /* counters of @registry_by_keys when the rule was linked */
+        uint64_t n_evaluations_base;
+        uint64_t n_hits_base;
 
         UserCharge charge[2];
         MatchKeys keys;
@@ -96,8 +111,11 @@ struct MatchOwner {
 struct MatchRegistryByKeys {
         unsigned long n_refs;
         CList rule_list;
-        MatchRegistryByMember *registry_by_member;
+        MatchRegistryByFields *registry_by_fields;
+        MatchRegistryByValue *registry_by_value;
         CRBNode registry_node;
+        uint64_t n_evaluations;
+        uint64_t n_hits;
         MatchKeys keys;
         /* @keys must be last, as it contains a VLA */
 };
@@ -109,57 +127,76 @@ struct MatchRegistryByKeys {
                 .keys = MATCH_KEYS_NULL,                                \
         }
 
-struct MatchRegistryByMember {
+struct MatchRegistryByValue {
         unsigned long n_refs;
         CRBTree keys_tree;
-        MatchRegistryByInterface *registry_by_interface;
+        MatchRegistryByFields *registry_by_fields;
         CRBNode registry_node;
-        char member[];
+        char value[];
 };
 
-#define MATCH_REGISTRY_BY_MEMBER_INIT(_x) {                             \
+#define MATCH_REGISTRY_BY_VALUE_INIT(_x) {                               \
                 .n_refs = 1,                                            \
                 .keys_tree = C_RBTREE_INIT,                             \
                 .registry_node = C_RBNODE_INIT((_x).registry_node),     \
         }
 
-struct MatchRegistryByInterface {
+struct MatchRegistryByFields {
         unsigned long n_refs;
-        CRBTree member_tree;
-        MatchRegistryByPath *registry_by_path;
-        CRBNode registry_node;
-        char interface[];
+        CRBTree keys_tree;
+        CRBTree arg0_tree;
+        CRBTree arg0namespace_tree;
+        CRBTree path_namespace_tree;
+        MatchIndex *index;
+        uint64_t hash;
+        uint64_t summary;
+        const char *path;
+        const char *interface;
+        const char *member;
+        char buffer[];
 };
 
-#define MATCH_REGISTRY_BY_INTERFACE_INIT(_x) {                          \
+#define MATCH_REGISTRY_BY_FIELDS_INIT {                                 \
                 .n_refs = 1,                                            \
-                .member_tree = C_RBTREE_INIT,                           \
-                .registry_node = C_RBNODE_INIT((_x).registry_node),     \
+                .keys_tree = C_RBTREE_INIT,                             \
+                .arg0_tree = C_RBTREE_INIT,                             \
+                .arg0namespace_tree = C_RBTREE_INIT,                    \
+                .path_namespace_tree = C_RBTREE_INIT,                   \
         }
 
-struct MatchRegistryByPath {
-        unsigned long n_refs;
-        CRBTree interface_tree;
-        CRBNode registry_node;
-        char path[];
+struct MatchIndex {
+        MatchRegistryByFields **buckets;
+        size_t n_buckets;
+        size_t n_entries;
+        uint64_t summary;
+        size_t n_stale;
 };
 
-#define MATCH_REGISTRY_BY_PATH_INIT(_x) {                               \
-                .n_refs = 1,                                            \
-                .interface_tree = C_RBTREE_INIT,                        \
-                .registry_node = C_RBNODE_INIT((_x).registry_node),     \
-        }
+#define MATCH_INDEX_NULL {}
 
 struct MatchRegistry {
-        CRBTree subscription_tree;
-        CRBTree monitor_tree;
+        MatchIndex subscription_index;
+        MatchIndex monitor_index;
 };
 
-#define MATCH_REGISTRY_INIT(_x) {                       \
-                .subscription_tree = C_RBTREE_INIT,     \
-                .monitor_tree = C_RBTREE_INIT,          \
+#define MATCH_REGISTRY_INIT(_x) {                               \
+                .subscription_index = MATCH_INDEX_NULL,         \
+                .monitor_index = MATCH_INDEX_NULL,              \
         }
 
+struct MatchTraceEntry {
+        MatchRegistryByKeys *registry;
+        bool hit;
+};
+
+struct MatchTrace {
+        MatchTraceEntry entries[MATCH_TRACE_MAX];
+        size_t n_entries;
+        bool truncated;
+};
+
+#define MATCH_TRACE_INIT {}
+
 /* rules */
 
 MatchRule *match_rule_user_ref(MatchRule *rule);
@@ -168,6 +205,9 @@ MatchRule *match_rule_user_unref(MatchRule *rule);
 int match_rule_link(MatchRule *rule, MatchRegistry *registry, bool monitor);
 void match_rule_unlink(MatchRule *rule);
 
+void match_rule_get_counters(MatchRule *rule, uint64_t *n_evaluationsp, uint64_t *n_hitsp);
+int match_rule_format(MatchRule *rule, char **stringp);
+
 C_DEFINE_CLEANUP(MatchRule *, match_rule_user_unref);
 
 /* owners */
@@ -184,7 +224,33 @@ int match_owner_find_rule(MatchOwner *owner, MatchRule **rulep, const char *rule
 void match_registry_init(MatchRegistry *registry);
 void match_registry_deinit(MatchRegistry *registry);
 
-void match_registry_get_subscribers(MatchRegistry *matches, CList *destinations, MessageMetadata *metadata);
-void match_registry_get_monitors(MatchRegistry *matches, CList *destinations, MessageMetadata *metadata);
+bool match_registry_get_subscribers(MatchRegistry *matches, CList *destinations, MessageMetadata *metadata, MatchTrace *trace);
+bool match_registry_get_monitors(MatchRegistry *matches, CList *destinations, MessageMetadata *metadata);
+uint64_t match_registry_generation(void);
 
 void match_registry_flush(MatchRegistry *registry);
+
+/* traces */
+
+void match_trace_reset(MatchTrace *trace);
+void match_trace_credit(const MatchTraceEntry *entries, size_t n_entries);
+
+/* inline helpers */
+
+static inline bool match_registry_is_empty(MatchRegistry *registry) {
+        return !registry->subscription_index.n_entries && !registry->monitor_index.n_entries;
+}
+
+static inline MatchFilterArg *match_filter_find_arg(MatchFilter *filter, unsigned int index) {
+        for (size_t i = 0; i < filter->n_args && filter->args[i].index <= index; ++i)
+                if (filter->args[i].index == index)
+                        return &filter->args[i];
+
+        return NULL;
+}
+
+static inline const char *match_filter_get_arg(MatchFilter *filter, unsigned int index) {
+        MatchFilterArg *arg = match_filter_find_arg(filter, index);
+
+        return (arg && !arg->path) ? arg->value : NULL;
+}
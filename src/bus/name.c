@@ -13,6 +13,13 @@
 #include "util/error.h"
 #include "util/user.h"
 
+/*
+ * Generation of all name registries. It is bumped whenever an ownership is
+ * linked to, or unlinked from, any owner, so users can cache results that
+ * depend on the set of names of an owner, including queued ones.
+ */
+static uint64_t name_generation;
+
 /**
  * name_change_init() - initialize notification
  * @change:             object to operate on
@@ -51,6 +58,7 @@ static void name_ownership_link(NameOwnership *ownership, CRBNode *parent, CRBNo
         assert(!c_rbnode_is_linked(&ownership->owner_node));
 
         c_rbtree_add(&ownership->owner->ownership_tree, parent, slot, &ownership->owner_node);
+        ++name_generation;
 }
 
 static NameOwnership *name_ownership_free(NameOwnership *ownership) {
@@ -59,6 +67,9 @@ static NameOwnership *name_ownership_free(NameOwnership *ownership) {
 
         assert(!c_list_is_linked(&ownership->name_link));
 
+        if (c_rbnode_is_linked(&ownership->owner_node))
+                ++name_generation;
+
         user_charge_deinit(&ownership->charge);
         c_rbnode_unlink(&ownership->owner_node);
         name_unref(ownership->name);
@@ -408,6 +419,19 @@ int name_registry_release_name(NameRegistry *registry,
         return 0;
 }
 
+/**
+ * name_registry_generation() - query generation of all registries
+ *
+ * This returns a counter that is bumped whenever a name ownership, primary or
+ * queued, is added to or removed from any owner. As long as it is unchanged,
+ * the names of every owner are unchanged as well.
+ *
+ * Return: The current generation.
+ */
+uint64_t name_registry_generation(void) {
+        return name_generation;
+}
+
 /**
  * name_snapshot_new() - create a snapshot of a name owner
  * @snapshotp:          output argument for snapshot
@@ -160,6 +160,8 @@ int name_registry_release_name(NameRegistry *registry,
                                const char *name_str,
                                NameChange *change);
 
+uint64_t name_registry_generation(void);
+
 /* snapshots */
 
 int name_snapshot_new(NameSnapshot **snapshotp, NameOwner *owner);
@@ -40,6 +40,16 @@ static int peer_dispatch_connection(Peer *peer, uint32_t events) {
         for (;;) {
                 _c_cleanup_(message_unrefp) Message *m = NULL;
 
+                if (!dispatch_file_has_budget(&peer->connection.socket_file)) {
+                        /*
+                         * This peer used up its share of the current dispatch
+                         * round. Leave the remaining input queued and get
+                         * rescheduled after all other peers had their turn.
+                         */
+                        dispatch_file_yield(&peer->connection.socket_file, EPOLLIN);
+                        return 0;
+                }
+
                 r = connection_dequeue(&peer->connection, &m);
                 if (r || !m) {
                         if (r == CONNECTION_E_EOF)
@@ -48,6 +58,8 @@ static int peer_dispatch_connection(Peer *peer, uint32_t events) {
                         return error_fold(r);
                 }
 
+                dispatch_file_consume(&peer->connection.socket_file, m->n_data);
+
                 metrics_sample_start(&peer->bus->metrics);
                 r = driver_dispatch(peer, m);
                 metrics_sample_end(&peer->bus->metrics);
@@ -223,6 +235,15 @@ int peer_new_with_fd(Peer **peerp,
         if (r < 0)
                 return error_fold(r);
 
+        socket_set_write_limits(&peer->connection.socket, bus->write_vectors, bus->write_bytes);
+
+        /*
+         * Until the peer completed its Hello() call, it cannot do anything
+         * but register. Dispatch it ahead of bulk traffic, so new peers are
+         * not stalled by busy peers (e.g., during boot). See peer_register().
+         */
+        dispatch_file_set_priority(&peer->connection.socket_file, DISPATCH_PRIORITY_REGISTRATION);
+
         peer->id = bus->peers.ids++;
         slot = c_rbtree_find_slot(&bus->peers.peer_tree, peer_compare, &peer->id, &parent);
         assert(slot); /* peer->id is guaranteed to be unique */
@@ -249,18 +270,23 @@ Peer *peer_free(Peer *peer) {
 
         fd = peer->connection.socket.fd;
 
+        peer->bus->write_stats.n_syscalls += peer->connection.socket.out.n_syscalls;
+        peer->bus->write_stats.n_msgs += peer->connection.socket.out.n_msgs;
+        peer->bus->write_stats.n_buffers += peer->connection.socket.out.n_buffers;
+
         reply_owner_deinit(&peer->owned_replies);
         reply_registry_deinit(&peer->replies);
         match_owner_deinit(&peer->owned_matches);
         match_registry_deinit(&peer->name_owner_changed_matches);
         match_registry_deinit(&peer->sender_matches);
         name_owner_deinit(&peer->owned_names);
-        policy_snapshot_free(peer->policy);
+        policy_snapshot_unref(peer->policy);
         connection_deinit(&peer->connection);
         user_unref(peer->user);
         user_charge_deinit(&peer->charges[2]);
         user_charge_deinit(&peer->charges[1]);
         user_charge_deinit(&peer->charges[0]);
+        free(peer->name_matches);
         free(peer->seclabel);
         free(peer->gids);
         free(peer);
@@ -279,6 +305,7 @@ void peer_register(Peer *peer) {
         assert(!peer->monitor);
 
         peer->registered = true;
+        dispatch_file_set_priority(&peer->connection.socket_file, DISPATCH_PRIORITY_BULK);
 }
 
 void peer_unregister(Peer *peer) {
@@ -359,7 +386,19 @@ void peer_release_name_ownership(Peer *peer, NameOwnership *ownership, NameChang
         name_ownership_release(ownership, change);
 }
 
+static void peer_invalidate_name_owner(Name *name) {
+        NameOwnership *primary;
+
+        if (!name)
+                return;
+
+        primary = name_primary(name);
+        if (primary)
+                peer_invalidate_name_matches(c_container_of(primary->owner, Peer, owned_names));
+}
+
 static int peer_link_match(Peer *peer, MatchRule *rule, bool monitor) {
+        const char *arg0 = match_filter_get_arg(&rule->keys.filter, 0);
         Address addr;
         Peer *sender, *owner;
         int r;
@@ -371,13 +410,13 @@ static int peer_link_match(Peer *peer, MatchRule *rule, bool monitor) {
         } else if (strcmp(rule->keys.sender, "org.freedesktop.DBus") == 0) {
                 if (rule->keys.filter.member &&
                     strcmp(rule->keys.filter.member, "NameOwnerChanged") == 0 &&
-                    rule->keys.filter.args[0] &&
-                    strcmp(rule->keys.filter.args[0], "org.freedesktop.DBus") != 0) {
+                    arg0 &&
+                    strcmp(arg0, "org.freedesktop.DBus") != 0) {
                         /*
                          * This rule is a subscription to NameOwnerChanged signals on a specific name,
                          * link it on the name or peer that may trigger it.
                          */
-                        address_from_string(&addr, rule->keys.filter.args[0]);
+                        address_from_string(&addr, arg0);
                         switch (addr.type) {
                         case ADDRESS_TYPE_ID: {
                                 owner = peer_registry_find_peer(&peer->bus->peers, addr.id);
@@ -416,7 +455,7 @@ static int peer_link_match(Peer *peer, MatchRule *rule, bool monitor) {
                         case ADDRESS_TYPE_OTHER: {
                                 _c_cleanup_(name_unrefp) Name *name = NULL;
 
-                                r = name_registry_ref_name(&peer->bus->names, &name, rule->keys.filter.args[0]);
+                                r = name_registry_ref_name(&peer->bus->names, &name, arg0);
                                 if (r)
                                         return error_fold(r);
 
@@ -476,6 +515,9 @@ static int peer_link_match(Peer *peer, MatchRule *rule, bool monitor) {
                         if (r)
                                 return error_fold(r);
                         name_ref(name); /* this reference must be explicitly released */
+
+                        /* the owner of the name might not have had any sender matches on it */
+                        peer_invalidate_name_owner(name);
                         break;
                 }
                 default:
@@ -510,6 +552,8 @@ int peer_add_match(Peer *peer, const char *rule_string) {
 }
 
 static Name *peer_match_rule_to_name(MatchRule *rule) {
+        const char *arg0 = match_filter_get_arg(&rule->keys.filter, 0);
+
         if (!rule->keys.sender)
                 return NULL;
         /*
@@ -519,8 +563,8 @@ static Name *peer_match_rule_to_name(MatchRule *rule) {
          */
         if (strcmp(rule->keys.sender, "org.freedesktop.DBus") == 0) {
                 if (rule->keys.filter.member && strcmp(rule->keys.filter.member, "NameOwnerChanged") == 0 &&
-                    rule->keys.filter.args[0] && strcmp(rule->keys.filter.args[0], "org.freedesktop.DBus") != 0 &&
-                    rule->keys.filter.args[0][0] != ':')
+                    arg0 && strcmp(arg0, "org.freedesktop.DBus") != 0 &&
+                    arg0[0] != ':')
                         return c_container_of(rule->registry, Name, name_owner_changed_matches);
         } else if (rule->keys.sender[0] != ':') {
                 return c_container_of(rule->registry, Name, sender_matches);
@@ -529,6 +573,18 @@ static Name *peer_match_rule_to_name(MatchRule *rule) {
         return NULL;
 }
 
+int peer_find_match(Peer *peer, MatchRule **rulep, const char *rule_string) {
+        int r;
+
+        r = match_owner_find_rule(&peer->owned_matches, rulep, rule_string);
+        if (r == MATCH_E_INVALID)
+                return PEER_E_MATCH_INVALID;
+        else if (r)
+                return error_fold(r);
+
+        return 0;
+}
+
 int peer_remove_match(Peer *peer, const char *rule_string) {
         _c_cleanup_(name_unrefp) Name *name = NULL;
         MatchRule *rule;
@@ -549,6 +605,7 @@ int peer_remove_match(Peer *peer, const char *rule_string) {
         name = peer_match_rule_to_name(rule);
 
         match_rule_user_unref(rule);
+        peer_invalidate_name_owner(name);
 
         return 0;
 }
@@ -605,6 +662,7 @@ void peer_flush_matches(Peer *peer) {
                 name = peer_match_rule_to_name(rule);
 
                 match_rule_user_unref(rule);
+                peer_invalidate_name_owner(name);
         }
 }
 
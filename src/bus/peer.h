@@ -71,6 +71,10 @@ struct Peer {
         PolicySnapshot *policy;
         NameOwner owned_names;
         MatchRegistry sender_matches;
+        MatchRegistry **name_matches;
+        size_t n_name_matches;
+        size_t z_name_matches;
+        bool name_matches_stale;
         MatchRegistry name_owner_changed_matches;
         MatchOwner owned_matches;
         ReplyRegistry replies;
@@ -85,6 +89,7 @@ struct Peer {
                 .listener_link = C_LIST_INIT((_x).listener_link),                                       \
                 .connection = CONNECTION_NULL((_x).connection),                                         \
                 .owned_names = NAME_OWNER_INIT,                                                         \
+                .name_matches_stale = true,                                                             \
                 .sender_matches = MATCH_REGISTRY_INIT((_x).sender_matches),                             \
                 .name_owner_changed_matches = MATCH_REGISTRY_INIT((_x).name_owner_changed_matches),     \
                 .owned_matches = MATCH_OWNER_INIT((_x).owned_matches),                                  \
@@ -115,6 +120,7 @@ int peer_release_name(Peer *peer, const char *name, NameChange *change);
 void peer_release_name_ownership(Peer *peer, NameOwnership *ownership, NameChange *change);
 
 int peer_add_match(Peer *peer, const char *rule_string);
+int peer_find_match(Peer *peer, MatchRule **rulep, const char *rule_string);
 int peer_remove_match(Peer *peer, const char *rule_string);
 int peer_become_monitor(Peer *peer, MatchOwner *owner);
 void peer_stop_monitor(Peer *peer);
@@ -136,4 +142,15 @@ static inline bool peer_is_monitor(Peer *peer) {
         return peer->monitor;
 }
 
+/*
+ * The registries of the names a peer is the primary owner of are cached on
+ * the peer, see bus_get_broadcast_destinations(). This must be called when
+ * the peer gains or loses a primary ownership, or the sender registry of one
+ * of its names gains or loses its rules.
+ */
+static inline void peer_invalidate_name_matches(Peer *peer) {
+        if (peer)
+                peer->name_matches_stale = true;
+}
+
 C_DEFINE_CLEANUP(Peer *, peer_free);
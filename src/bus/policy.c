@@ -6,19 +6,22 @@
 #include <c-list.h>
 #include <c-macro.h>
 #include <c-rbtree.h>
+#include <c-string.h>
 #include <stdlib.h>
+#include <string.h>
 #include "bus/name.h"
 #include "bus/policy.h"
 #include "dbus/protocol.h"
 #include "util/common.h"
 #include "util/error.h"
+#include "util/hash.h"
 #include "util/selinux.h"
 
 static PolicyXmit *policy_xmit_free(PolicyXmit *xmit) {
         if (!xmit)
                 return NULL;
 
-        c_list_unlink(&xmit->batch_link);
+        c_list_unlink(&xmit->bucket_link);
         free(xmit);
 
         return NULL;
@@ -71,6 +74,124 @@ static int policy_xmit_new(PolicyXmit **xmitp,
         return 0;
 }
 
+typedef struct PolicyXmitKey PolicyXmitKey;
+
+struct PolicyXmitKey {
+        const char *interface;
+        const char *member;
+};
+
+static int policy_xmit_bucket_compare(CRBTree *t, void *k, CRBNode *n) {
+        PolicyXmitBucket *bucket = c_container_of(n, PolicyXmitBucket, index_node);
+        PolicyXmitKey *key = k;
+        int r;
+
+        if ((r = c_string_compare(key->interface, bucket->interface)) ||
+            (r = c_string_compare(key->member, bucket->member)))
+                return r;
+
+        return 0;
+}
+
+static PolicyXmitBucket *policy_xmit_bucket_free(PolicyXmitBucket *bucket) {
+        PolicyXmit *xmit;
+
+        if (!bucket)
+                return NULL;
+
+        while ((xmit = c_list_first_entry(&bucket->xmit_list, PolicyXmit, bucket_link)))
+                policy_xmit_free(xmit);
+
+        c_rbnode_unlink(&bucket->index_node);
+        free(bucket);
+
+        return NULL;
+}
+
+C_DEFINE_CLEANUP(PolicyXmitBucket *, policy_xmit_bucket_free);
+
+static int policy_xmit_bucket_new(PolicyXmitBucket **bucketp, const char *interface, const char *member) {
+        _c_cleanup_(policy_xmit_bucket_freep) PolicyXmitBucket *bucket = NULL;
+        size_t n_interface, n_member;
+        void *p;
+
+        n_interface = interface ? strlen(interface) + 1 : 0;
+        n_member = member ? strlen(member) + 1 : 0;
+
+        bucket = calloc(1, sizeof(*bucket) + n_interface + n_member);
+        if (!bucket)
+                return error_origin(-ENOMEM);
+
+        *bucket = (PolicyXmitBucket)POLICY_XMIT_BUCKET_NULL(*bucket);
+
+        p = bucket + 1;
+        if (n_interface) {
+                bucket->interface = p;
+                p = stpcpy(p, interface) + 1;
+        }
+        if (n_member) {
+                bucket->member = p;
+                p = stpcpy(p, member) + 1;
+        }
+
+        *bucketp = bucket;
+        bucket = NULL;
+        return 0;
+}
+
+static PolicyXmitBucket *policy_xmit_bucket_find(CRBTree *index, const char *interface, const char *member) {
+        PolicyXmitKey key = {
+                .interface = interface,
+                .member = member,
+        };
+
+        return c_rbtree_find_entry(index,
+                                   policy_xmit_bucket_compare,
+                                   &key,
+                                   PolicyXmitBucket,
+                                   index_node);
+}
+
+/*
+ * Xmit rules of a name are indexed by their interface and member, either of
+ * which can be a wildcard. Rules with equal interface and member share a
+ * bucket, which keeps them ordered by descending priority. This way, a check
+ * only needs to look at the four buckets that can apply, and can stop at the
+ * first matching rule in each.
+ */
+static int policy_xmit_index_add(CRBTree *index, PolicyXmit *xmit) {
+        PolicyXmitKey key = {
+                .interface = xmit->interface,
+                .member = xmit->member,
+        };
+        PolicyXmitBucket *bucket;
+        CRBNode *parent, **slot;
+        PolicyXmit *pos;
+        int r;
+
+        slot = c_rbtree_find_slot(index, policy_xmit_bucket_compare, &key, &parent);
+        if (slot) {
+                r = policy_xmit_bucket_new(&bucket, xmit->interface, xmit->member);
+                if (r)
+                        return error_trace(r);
+
+                c_rbtree_add(index, parent, slot, &bucket->index_node);
+        } else {
+                bucket = c_container_of(parent, PolicyXmitBucket, index_node);
+        }
+
+        /*
+         * Rules of equal priority retain their order, so the first one still
+         * takes precedence, just like with a linear scan.
+         */
+        c_list_for_each_entry(pos, &bucket->xmit_list, bucket_link)
+                if (pos->verdict.priority < xmit->verdict.priority)
+                        break;
+
+        c_list_link_before(&pos->bucket_link, &xmit->bucket_link);
+        return 0;
+}
+
 static int policy_batch_name_compare(CRBTree *t, void *k, CRBNode *n) {
         PolicyBatchName *name = c_container_of(n, PolicyBatchName, batch_node);
 
@@ -78,15 +199,15 @@ static int policy_batch_name_compare(CRBTree *t, void *k, CRBNode *n) {
 }
 
 static PolicyBatchName *policy_batch_name_free(PolicyBatchName *name) {
-        PolicyXmit *xmit;
+        PolicyXmitBucket *bucket, *t_bucket;
 
         if (!name)
                 return NULL;
 
-        while ((xmit = c_list_first_entry(&name->recv_unindexed, PolicyXmit, batch_link)))
-                policy_xmit_free(xmit);
-        while ((xmit = c_list_first_entry(&name->send_unindexed, PolicyXmit, batch_link)))
-                policy_xmit_free(xmit);
+        c_rbtree_for_each_entry_safe_postorder_unlink(bucket, t_bucket, &name->recv_index, index_node)
+                policy_xmit_bucket_free(bucket);
+        c_rbtree_for_each_entry_safe_postorder_unlink(bucket, t_bucket, &name->send_index, index_node)
+                policy_xmit_bucket_free(bucket);
 
         c_rbnode_unlink(&name->batch_node);
         free(name);
@@ -232,7 +353,10 @@ static int policy_batch_add_send(PolicyBatch *batch,
         if (r)
                 return error_trace(r);
 
-        c_list_link_tail(&name->send_unindexed, &xmit->batch_link);
+        r = policy_xmit_index_add(&name->send_index, xmit);
+        if (r)
+                return error_trace(r);
+
         xmit = NULL;
         return 0;
 }
@@ -261,11 +385,167 @@ static int policy_batch_add_recv(PolicyBatch *batch,
         if (r)
                 return error_trace(r);
 
-        c_list_link_tail(&name->recv_unindexed, &xmit->batch_link);
+        r = policy_xmit_index_add(&name->recv_index, xmit);
+        if (r)
+                return error_trace(r);
+
         xmit = NULL;
         return 0;
 }
 
+static bool policy_xmit_is_unconditional(PolicyXmit *xmit) {
+        return !xmit->type &&
+               !xmit->path &&
+               !xmit->interface &&
+               !xmit->member &&
+               xmit->broadcast == UTIL_TRISTATE_UNSET &&
+               !xmit->min_fds &&
+               xmit->max_fds == UINT64_MAX;
+}
+
+/*
+ * A verdict is constant if a rule that applies to every input outranks all
+ * other rules, or if there are no rules with a non-zero priority at all (in
+ * which case everything is denied). This returns UTIL_TRISTATE_YES or
+ * UTIL_TRISTATE_NO for constant verdicts, and UTIL_TRISTATE_UNSET otherwise.
+ */
+static unsigned int policy_verdict_constant(PolicyVerdict top, uint64_t max_priority) {
+        if (max_priority && top.priority <= max_priority)
+                return UTIL_TRISTATE_UNSET;
+
+        return top.verdict ? UTIL_TRISTATE_YES : UTIL_TRISTATE_NO;
+}
+
+static unsigned int policy_batch_analyze_xmit(PolicyBatch *batch, bool is_send) {
+        PolicyVerdict top = POLICY_VERDICT_INIT;
+        PolicyXmitBucket *bucket;
+        PolicyBatchName *name;
+        uint64_t max_priority = 0;
+        PolicyXmit *xmit;
+
+        c_rbtree_for_each_entry(name, &batch->name_tree, batch_node) {
+                c_rbtree_for_each_entry(bucket, is_send ? &name->send_index : &name->recv_index, index_node) {
+                        c_list_for_each_entry(xmit, &bucket->xmit_list, bucket_link) {
+                                /* the catch-all name applies to all subjects */
+                                if (!*name->name && policy_xmit_is_unconditional(xmit)) {
+                                        if (top.priority < xmit->verdict.priority)
+                                                top = xmit->verdict;
+                                } else if (max_priority < xmit->verdict.priority) {
+                                        max_priority = xmit->verdict.priority;
+                                }
+                        }
+                }
+        }
+
+        return policy_verdict_constant(top, max_priority);
+}
+
+static bool policy_batch_analyze_path(PolicyBatch *batch, bool is_send) {
+        PolicyXmitBucket *bucket;
+        PolicyBatchName *name;
+        PolicyXmit *xmit;
+
+        c_rbtree_for_each_entry(name, &batch->name_tree, batch_node)
+                c_rbtree_for_each_entry(bucket, is_send ? &name->send_index : &name->recv_index, index_node)
+                        c_list_for_each_entry(xmit, &bucket->xmit_list, bucket_link)
+                                if (xmit->path)
+                                        return true;
+
+        return false;
+}
+
+static unsigned int policy_batch_analyze_own(PolicyBatch *batch) {
+        PolicyVerdict top = POLICY_VERDICT_INIT;
+        PolicyBatchName *name;
+        uint64_t max_priority = 0;
+
+        c_rbtree_for_each_entry(name, &batch->name_tree, batch_node) {
+                if (!*name->name) {
+                        /* the empty prefix is checked for all names */
+                        if (top.priority < name->own_verdict.priority)
+                                top = name->own_verdict;
+                        if (top.priority < name->own_prefix_verdict.priority)
+                                top = name->own_prefix_verdict;
+                } else {
+                        max_priority = c_max(max_priority, name->own_verdict.priority);
+                        max_priority = c_max(max_priority, name->own_prefix_verdict.priority);
+                }
+        }
+
+        return policy_verdict_constant(top, max_priority);
+}
+
+/*
+ * Most batches either allow or deny all transactions and name requests
+ * unconditionally. Figure out which verdicts of @batch are constant, so the
+ * checks can return right away. Furthermore, figure out whether any xmit rule
+ * matches on the object path, since the verdict cache can ignore the path
+ * otherwise.
+ */
+static void policy_batch_analyze(PolicyBatch *batch) {
+        batch->own_constant = policy_batch_analyze_own(batch);
+        batch->send_constant = policy_batch_analyze_xmit(batch, true);
+        batch->recv_constant = policy_batch_analyze_xmit(batch, false);
+        batch->send_path = policy_batch_analyze_path(batch, true);
+        batch->recv_path = policy_batch_analyze_path(batch, false);
+}
+
+static int policy_batch_merge(PolicyBatch *batch, PolicyBatch *from) {
+        PolicyXmitBucket *bucket;
+        PolicyBatchName *name;
+        PolicyXmit *xmit;
+        int r;
+
+        if (batch->connect_verdict.priority < from->connect_verdict.priority)
+                batch->connect_verdict = from->connect_verdict;
+
+        c_rbtree_for_each_entry(name, &from->name_tree, batch_node) {
+                r = policy_batch_add_own(batch, name->name, name->own_verdict);
+                if (r)
+                        return error_trace(r);
+
+                r = policy_batch_add_own_prefix(batch, name->name, name->own_prefix_verdict);
+                if (r)
+                        return error_trace(r);
+
+                c_rbtree_for_each_entry(bucket, &name->send_index, index_node) {
+                        c_list_for_each_entry(xmit, &bucket->xmit_list, bucket_link) {
+                                r = policy_batch_add_send(batch,
+                                                          name->name,
+                                                          xmit->verdict,
+                                                          xmit->type,
+                                                          xmit->broadcast,
+                                                          xmit->path,
+                                                          xmit->interface,
+                                                          xmit->member,
+                                                          xmit->min_fds,
+                                                          xmit->max_fds);
+                                if (r)
+                                        return error_trace(r);
+                        }
+                }
+
+                c_rbtree_for_each_entry(bucket, &name->recv_index, index_node) {
+                        c_list_for_each_entry(xmit, &bucket->xmit_list, bucket_link) {
+                                r = policy_batch_add_recv(batch,
+                                                          name->name,
+                                                          xmit->verdict,
+                                                          xmit->type,
+                                                          xmit->broadcast,
+                                                          xmit->path,
+                                                          xmit->interface,
+                                                          xmit->member,
+                                                          xmit->min_fds,
+                                                          xmit->max_fds);
+                                if (r)
+                                        return error_trace(r);
+                        }
+                }
+        }
+
+        return 0;
+}
+
 static int policy_registry_node_compare(CRBTree *t, void *k, CRBNode *n) {
         PolicyRegistryNode *node = c_container_of(n, PolicyRegistryNode, registry_node);
         PolicyRegistryNodeIndex *index = k;
@@ -347,10 +627,15 @@ int policy_registry_new(PolicyRegistry **registryp, const char *fallback_seclabe
  */
 PolicyRegistry *policy_registry_free(PolicyRegistry *registry) {
         PolicyRegistryNode *node, *t_node;
+        PolicySnapshot *snapshot, *t_snapshot;
 
         if (!registry)
                 return NULL;
 
+        /* snapshots may outlive their registry, but are no longer shared */
+        c_rbtree_for_each_entry_safe_postorder_unlink(snapshot, t_snapshot, &registry->snapshot_tree, registry_node)
+                snapshot->registry = NULL;
+
         c_rbtree_for_each_entry_safe_postorder_unlink(node, t_node, &registry->gid_tree, registry_node)
                 policy_registry_node_free(node);
         c_rbtree_for_each_entry_safe_postorder_unlink(node, t_node, &registry->uid_tree, registry_node)
@@ -615,11 +900,249 @@ int policy_registry_import(PolicyRegistry *registry, CDVar *v) {
         if (r)
                 return POLICY_E_INVALID;
 
+        policy_batch_analyze(registry->default_batch);
+        c_rbtree_for_each_entry(node, &registry->uid_tree, registry_node)
+                policy_batch_analyze(node->batch);
+        c_rbtree_for_each_entry(node, &registry->uid_range_tree, registry_node)
+                policy_batch_analyze(node->batch);
+        c_rbtree_for_each_entry(node, &registry->gid_tree, registry_node)
+                policy_batch_analyze(node->batch);
+
         return 0;
 }
 
+/*
+ * Every transaction is checked against the send policy of the sender and the
+ * receive policy of the receiver. Either check walks all batches of a
+ * snapshot, looks up every name of the subject and scans its rules. Yet, the
+ * verdict only depends on the shape of the message and the names of the
+ * subject, and both repeat a lot in real-world traffic. Hence, every snapshot
+ * caches its recent xmit verdicts.
+ *
+ * The names of a subject are identified by their NameOwner, and entries are
+ * tagged with the generation of the name registries, so any change to name
+ * ownership invalidates them. Name snapshots lack a stable identity, so checks
+ * against them are never cached. A policy reload replaces the snapshots of
+ * all peers, and their caches go away with them. Note that SELinux checks are
+ * never cached, since the SELinux policy may change underneath us.
+ *
+ * Object paths are only part of the key if a rule of the batch matches on
+ * them. Otherwise, all paths share an entry. Paths longer than
+ * POLICY_CACHE_PATH_MAX are never cached, since every entry holds a copy.
+ */
+
+static void policy_cache_key_init(PolicyCacheEntry *key,
+                                  bool is_send,
+                                  NameSet *subject,
+                                  const char *interface,
+                                  const char *member,
+                                  const char *path,
+                                  unsigned int type,
+                                  bool broadcast,
+                                  size_t n_fds) {
+        *key = (PolicyCacheEntry){
+                .generation = name_registry_generation(),
+                .is_send = is_send,
+                .driver = !subject,
+                .subject = (subject && subject->type == NAME_SET_TYPE_OWNER) ? subject->owner : NULL,
+                .type = type,
+                .broadcast = broadcast,
+                .n_fds = n_fds,
+                .path = path,
+                .interface = interface,
+                .member = member,
+        };
+
+        key->hash = hash_combine(hash_combine(hash_string(path),
+                                              hash_string(interface)),
+                                 hash_string(member));
+        key->hash = hash_combine(key->hash, (uintptr_t)key->subject);
+        key->hash = hash_combine(key->hash, (type << 3) | (key->driver << 2) | (is_send << 1) | broadcast);
+        key->hash = hash_combine(key->hash, n_fds);
+}
+
+static int policy_cache_entry_compare(CRBTree *tree, void *k, CRBNode *rb) {
+        PolicyCacheEntry *entry = c_container_of(rb, PolicyCacheEntry, cache_node);
+        PolicyCacheEntry *key = k;
+        int r;
+
+        if (key->hash != entry->hash)
+                return key->hash < entry->hash ? -1 : 1;
+        if (key->subject != entry->subject)
+                return (uintptr_t)key->subject < (uintptr_t)entry->subject ? -1 : 1;
+        if (key->driver != entry->driver)
+                return key->driver < entry->driver ? -1 : 1;
+        if (key->is_send != entry->is_send)
+                return key->is_send < entry->is_send ? -1 : 1;
+        if (key->type != entry->type)
+                return key->type < entry->type ? -1 : 1;
+        if (key->broadcast != entry->broadcast)
+                return key->broadcast < entry->broadcast ? -1 : 1;
+        if (key->n_fds != entry->n_fds)
+                return key->n_fds < entry->n_fds ? -1 : 1;
+
+        if ((r = c_string_compare(key->path, entry->path)) ||
+            (r = c_string_compare(key->interface, entry->interface)) ||
+            (r = c_string_compare(key->member, entry->member)))
+                return r;
+
+        return 0;
+}
+
+static void policy_cache_entry_free(PolicyCache *cache, PolicyCacheEntry *entry) {
+        c_rbnode_unlink(&entry->cache_node);
+        c_list_unlink(&entry->lru_link);
+        --cache->n_entries;
+        free(entry);
+}
+
+static const char *policy_cache_entry_copy(char **p, const char *string) {
+        char *copy = *p;
+
+        if (!string)
+                return NULL;
+
+        *p = stpcpy(copy, string) + 1;
+        return copy;
+}
+
+static PolicyCacheEntry *policy_cache_entry_new(PolicyCacheEntry *key, PolicyVerdict verdict) {
+        PolicyCacheEntry *entry;
+        size_t n_strings = 0;
+        char *p;
+
+        if (key->path)
+                n_strings += strlen(key->path) + 1;
+        if (key->interface)
+                n_strings += strlen(key->interface) + 1;
+        if (key->member)
+                n_strings += strlen(key->member) + 1;
+
+        entry = malloc(sizeof(*entry) + n_strings);
+        if (!entry)
+                return NULL;
+
+        *entry = *key;
+        entry->cache_node = (CRBNode)C_RBNODE_INIT(entry->cache_node);
+        entry->lru_link = (CList)C_LIST_INIT(entry->lru_link);
+        entry->verdict = verdict;
+
+        p = (char *)(entry + 1);
+        entry->path = policy_cache_entry_copy(&p, key->path);
+        entry->interface = policy_cache_entry_copy(&p, key->interface);
+        entry->member = policy_cache_entry_copy(&p, key->member);
+
+        return entry;
+}
+
+static bool policy_cache_get(PolicyCache *cache, PolicyCacheEntry *key, PolicyVerdict *verdictp) {
+        PolicyCacheEntry *entry;
+
+        entry = c_rbtree_find_entry(&cache->entry_tree,
+                                    policy_cache_entry_compare,
+                                    key,
+                                    PolicyCacheEntry,
+                                    cache_node);
+        if (!entry || entry->generation != key->generation) {
+                ++cache->n_misses;
+                return false;
+        }
+
+        ++cache->n_hits;
+        c_list_unlink(&entry->lru_link);
+        c_list_link_front(&cache->lru_list, &entry->lru_link);
+
+        *verdictp = entry->verdict;
+        return true;
+}
+
+static void policy_cache_add(PolicyCache *cache, PolicyCacheEntry *key, PolicyVerdict verdict) {
+        PolicyCacheEntry *entry;
+        CRBNode *parent, **slot;
+
+        entry = c_rbtree_find_entry(&cache->entry_tree,
+                                    policy_cache_entry_compare,
+                                    key,
+                                    PolicyCacheEntry,
+                                    cache_node);
+        if (entry)
+                policy_cache_entry_free(cache, entry);
+
+        /* caching is best-effort, so allocation failures are ignored */
+        entry = policy_cache_entry_new(key, verdict);
+        if (!entry)
+                return;
+
+        if (cache->n_entries && cache->n_entries >= cache->max_entries)
+                policy_cache_entry_free(cache,
+                                        c_list_last_entry(&cache->lru_list,
+                                                          PolicyCacheEntry,
+                                                          lru_link));
+
+        slot = c_rbtree_find_slot(&cache->entry_tree, policy_cache_entry_compare, key, &parent);
+        assert(slot);
+        c_rbtree_add(&cache->entry_tree, parent, slot, &entry->cache_node);
+        c_list_link_front(&cache->lru_list, &entry->lru_link);
+        ++cache->n_entries;
+}
+
+static void policy_cache_flush(PolicyCache *cache) {
+        PolicyCacheEntry *entry, *safe;
+
+        c_list_for_each_entry_safe(entry, safe, &cache->lru_list, lru_link)
+                policy_cache_entry_free(cache, entry);
+
+        assert(!cache->n_entries);
+}
+
+typedef struct PolicySnapshotKey PolicySnapshotKey;
+
+struct PolicySnapshotKey {
+        const char *seclabel;
+        uint32_t uid;
+        const uint32_t *gids;
+        size_t n_gids;
+};
+
+static int policy_snapshot_compare(CRBTree *t, void *k, CRBNode *n) {
+        PolicySnapshot *snapshot = c_container_of(n, PolicySnapshot, registry_node);
+        PolicySnapshotKey *key = k;
+        size_t i;
+        int r;
+
+        if (key->uid != snapshot->uid)
+                return key->uid < snapshot->uid ? -1 : 1;
+        if (key->n_gids != snapshot->n_gids)
+                return key->n_gids < snapshot->n_gids ? -1 : 1;
+
+        for (i = 0; i < key->n_gids; ++i)
+                if (key->gids[i] != snapshot->gids[i])
+                        return key->gids[i] < snapshot->gids[i] ? -1 : 1;
+
+        r = strcmp(key->seclabel, snapshot->seclabel);
+        if (r)
+                return r;
+
+        return 0;
+}
+
+static int policy_gid_compare(const void *a, const void *b) {
+        uint32_t gid_a = *(const uint32_t *)a, gid_b = *(const uint32_t *)b;
+
+        return (gid_a > gid_b) - (gid_a < gid_b);
+}
+
 /**
  * policy_snapshot_new() - XXX
+ *
+ * A peer is subject to the batch of its uid (or the default batch), the
+ * batches of all uid-ranges it is part of, and the batches of all its groups.
+ * Their verdicts are combined by priority, so rather than walking all of them
+ * on every check, they are merged into a single batch right here. If only a
+ * single batch applies, it is shared rather than copied.
+ *
+ * Snapshots are interned in their registry. Peers with equal security label,
+ * uid and groups share a single snapshot, including its verdict cache.
  */
 int policy_snapshot_new(PolicySnapshot **snapshotp,
                         PolicyRegistry *registry,
@@ -627,9 +1150,40 @@ int policy_snapshot_new(PolicySnapshot **snapshotp,
                         uint32_t uid,
                         const uint32_t *gids,
                         size_t n_gids) {
-        _c_cleanup_(policy_snapshot_freep) PolicySnapshot *snapshot = NULL;
+        _c_cleanup_(policy_snapshot_unrefp) PolicySnapshot *snapshot = NULL;
+        _c_cleanup_(c_freep) PolicyBatch **batches = NULL;
+        PolicySnapshotKey key;
         PolicyRegistryNode *node;
-        size_t n_batches = 1 + n_gids;
+        CRBNode *parent, **slot;
+        size_t i, n_batches = 0, z_batches = 1 + n_gids;
+        int r;
+
+        snapshot = calloc(1, sizeof(*snapshot) + n_gids * sizeof(*snapshot->gids));
+        if (!snapshot)
+                return error_origin(-ENOMEM);
+
+        *snapshot = (PolicySnapshot)POLICY_SNAPSHOT_NULL(*snapshot);
+        snapshot->uid = uid;
+        snapshot->n_gids = n_gids;
+
+        /* the order of the groups has no effect, so normalize it */
+        if (n_gids) {
+                memcpy(snapshot->gids, gids, n_gids * sizeof(*gids));
+                qsort(snapshot->gids, n_gids, sizeof(*gids), policy_gid_compare);
+        }
+
+        key = (PolicySnapshotKey){
+                .seclabel = seclabel,
+                .uid = uid,
+                .gids = snapshot->gids,
+                .n_gids = n_gids,
+        };
+
+        slot = c_rbtree_find_slot(&registry->snapshot_tree, policy_snapshot_compare, &key, &parent);
+        if (!slot) {
+                *snapshotp = policy_snapshot_ref(c_container_of(parent, PolicySnapshot, registry_node));
+                return 0;
+        }
 
         c_rbtree_for_each_entry(node, &registry->uid_range_tree, registry_node) {
                 if (node->index.uidgid_start > uid)
@@ -637,27 +1191,19 @@ int policy_snapshot_new(PolicySnapshot **snapshotp,
                 if (node->index.uidgid_end < uid)
                         continue;
 
-                ++n_batches;
+                ++z_batches;
         }
 
-        snapshot = calloc(1, sizeof(*snapshot) + n_batches * sizeof(*snapshot->batches));
-        if (!snapshot)
-                return error_origin(-ENOMEM);
-
-        *snapshot = (PolicySnapshot)POLICY_SNAPSHOT_NULL;
-
-        snapshot->selinux = bus_selinux_registry_ref(registry->selinux);
-
-        snapshot->seclabel = strdup(seclabel);
-        if (!snapshot->seclabel)
+        batches = malloc(z_batches * sizeof(*batches));
+        if (!batches)
                 return error_origin(-ENOMEM);
 
         /* fetch matching uid policy */
         node = policy_registry_find_uid(registry, uid);
         if (node)
-                snapshot->batches[snapshot->n_batches++] = policy_batch_ref(node->batch);
+                batches[n_batches++] = node->batch;
         else
-                snapshot->batches[snapshot->n_batches++] = policy_batch_ref(registry->default_batch);
+                batches[n_batches++] = registry->default_batch;
 
         /* fetch all matching uid-range policies */
         c_rbtree_for_each_entry(node, &registry->uid_range_tree, registry_node) {
@@ -666,64 +1212,60 @@ int policy_snapshot_new(PolicySnapshot **snapshotp,
                 if (node->index.uidgid_end < uid)
                         continue;
 
-                snapshot->batches[snapshot->n_batches++] = policy_batch_ref(node->batch);
+                batches[n_batches++] = node->batch;
         }
 
         /* fetch all matching gid policies */
         while (n_gids-- > 0) {
                 node = policy_registry_find_gid(registry, gids[n_gids]);
                 if (node)
-                        snapshot->batches[snapshot->n_batches++] = policy_batch_ref(node->batch);
+                        batches[n_batches++] = node->batch;
         }
 
-        assert(snapshot->n_batches <= n_batches);
+        assert(n_batches <= z_batches);
 
-        *snapshotp = snapshot;
-        snapshot = NULL;
-        return 0;
-}
-
-/**
- * policy_snapshot_free() - XXX
- */
-PolicySnapshot *policy_snapshot_free(PolicySnapshot *snapshot) {
-        if (!snapshot)
-                return NULL;
+        snapshot->selinux = bus_selinux_registry_ref(registry->selinux);
 
-        while (snapshot->n_batches-- > 0)
-                policy_batch_unref(snapshot->batches[snapshot->n_batches]);
-        free(snapshot->seclabel);
-        bus_selinux_registry_unref(snapshot->selinux);
-        free(snapshot);
+        snapshot->seclabel = strdup(seclabel);
+        if (!snapshot->seclabel)
+                return error_origin(-ENOMEM);
 
-        return NULL;
-}
+        if (n_batches == 1) {
+                snapshot->batch = policy_batch_ref(batches[0]);
+        } else {
+                r = policy_batch_new(&snapshot->batch);
+                if (r)
+                        return error_trace(r);
 
-/**
- * policy_snapshot_dup() - XXX
- */
-int policy_snapshot_dup(PolicySnapshot *snapshot, PolicySnapshot **newp) {
-        _c_cleanup_(policy_snapshot_freep) PolicySnapshot *new = NULL;
-        size_t i;
+                for (i = 0; i < n_batches; ++i) {
+                        r = policy_batch_merge(snapshot->batch, batches[i]);
+                        if (r)
+                                return error_trace(r);
+                }
 
-        new = calloc(1, sizeof(*new) + snapshot->n_batches * sizeof(*new->batches));
-        if (!new)
-                return error_origin(-ENOMEM);
+                policy_batch_analyze(snapshot->batch);
+        }
 
-        *new = (PolicySnapshot)POLICY_SNAPSHOT_NULL;
+        snapshot->registry = registry;
+        c_rbtree_add(&registry->snapshot_tree, parent, slot, &snapshot->registry_node);
 
-        new->selinux = bus_selinux_registry_ref(snapshot->selinux);
+        *snapshotp = snapshot;
+        snapshot = NULL;
+        return 0;
+}
 
-        new->seclabel = strdup(snapshot->seclabel);
-        if (!new->seclabel)
-                return error_origin(-ENOMEM);
+/* internal callback for policy_snapshot_unref() */
+void policy_snapshot_free(_Atomic unsigned long *n_refs, void *userdata) {
+        PolicySnapshot *snapshot = c_container_of(n_refs, PolicySnapshot, n_refs);
 
-        for (i = 0; i < snapshot->n_batches; ++i)
-                new->batches[new->n_batches++] = policy_batch_ref(snapshot->batches[i]);
+        if (snapshot->registry)
+                c_rbnode_unlink(&snapshot->registry_node);
 
-        *newp = new;
-        new = NULL;
-        return 0;
+        policy_cache_flush(&snapshot->cache);
+        policy_batch_unref(snapshot->batch);
+        free(snapshot->seclabel);
+        bus_selinux_registry_unref(snapshot->selinux);
+        free(snapshot);
 }
 
 /**
@@ -731,11 +1273,9 @@ int policy_snapshot_dup(PolicySnapshot *snapshot, PolicySnapshot **newp) {
  */
 int policy_snapshot_check_connect(PolicySnapshot *snapshot) {
         PolicyVerdict verdict = POLICY_VERDICT_INIT;
-        size_t i;
 
-        for (i = 0; i < snapshot->n_batches; ++i)
-                if (verdict.priority < snapshot->batches[i]->connect_verdict.priority)
-                        verdict = snapshot->batches[i]->connect_verdict;
+        if (verdict.priority < snapshot->batch->connect_verdict.priority)
+                verdict = snapshot->batch->connect_verdict;
 
         return verdict.verdict ? 0 : POLICY_E_ACCESS_DENIED;
 }
@@ -748,7 +1288,6 @@ int policy_snapshot_check_own(PolicySnapshot *snapshot, const char *name_str) {
         PolicyBatchName *name;
         const char *end;
         CRBNode *rb;
-        size_t i;
         int v, r;
 
         r = bus_selinux_check_own(snapshot->selinux, snapshot->seclabel, name_str);
@@ -759,66 +1298,59 @@ int policy_snapshot_check_own(PolicySnapshot *snapshot, const char *name_str) {
                 return error_fold(r);
         }
 
-        for (i = 0; i < snapshot->n_batches; ++i) {
-                /*
-                 * Iterate all prefixes of @name_str, including the empty
-                 * prefix and the full string.
-                 */
-                for (end = name_str;
-                     ;
-                     end = strchrnul(end + 1, '.')) {
-                        rb = snapshot->batches[i]->name_tree.root;
-                        while (rb) {
-                                name = c_container_of(rb, PolicyBatchName, batch_node);
-                                v = strncmp(name_str, name->name, end - name_str);
-                                if (v < 0)
-                                        rb = rb->left;
-                                else if (v > 0)
-                                        rb = rb->right;
-                                else if (name->name[end - name_str])
-                                        rb = rb->left;
-                                else
-                                        break;
-                        }
+        if (snapshot->batch->own_constant != UTIL_TRISTATE_UNSET)
+                return snapshot->batch->own_constant == UTIL_TRISTATE_YES ? 0 : POLICY_E_ACCESS_DENIED;
 
-                        if (rb) {
-                                if (verdict.priority < name->own_verdict.priority)
-                                        verdict = name->own_verdict;
-                                if (verdict.priority < name->own_prefix_verdict.priority)
-                                        verdict = name->own_prefix_verdict;
-                        }
-
-                        if (!*end)
+        /*
+         * Iterate all prefixes of @name_str, including the empty prefix and
+         * the full string.
+         */
+        for (end = name_str;
+             ;
+             end = strchrnul(end + 1, '.')) {
+                rb = snapshot->batch->name_tree.root;
+                while (rb) {
+                        name = c_container_of(rb, PolicyBatchName, batch_node);
+                        v = strncmp(name_str, name->name, end - name_str);
+                        if (v < 0)
+                                rb = rb->left;
+                        else if (v > 0)
+                                rb = rb->right;
+                        else if (name->name[end - name_str])
+                                rb = rb->left;
+                        else
                                 break;
                 }
+
+                if (rb) {
+                        if (verdict.priority < name->own_verdict.priority)
+                                verdict = name->own_verdict;
+                        if (verdict.priority < name->own_prefix_verdict.priority)
+                                verdict = name->own_prefix_verdict;
+                }
+
+                if (!*end)
+                        break;
         }
 
         return verdict.verdict ? 0 : POLICY_E_ACCESS_DENIED;
 }
 
-static void policy_snapshot_check_xmit_name(PolicyBatch *batch,
-                                            bool is_send,
-                                            PolicyVerdict *verdict,
-                                            const char *name_str,
-                                            const char *interface,
-                                            const char *member,
-                                            const char *path,
-                                            unsigned int type,
-                                            bool broadcast,
-                                            size_t n_fds) {
-        PolicyBatchName *name;
+static void policy_snapshot_check_xmit_bucket(PolicyXmitBucket *bucket,
+                                              PolicyVerdict *verdict,
+                                              const char *path,
+                                              unsigned int type,
+                                              bool broadcast,
+                                              size_t n_fds) {
         PolicyXmit *xmit;
-        CList *list;
 
-        name = policy_batch_find_name(batch, name_str);
-        if (!name)
+        if (!bucket)
                 return;
 
-        list = is_send ? &name->send_unindexed : &name->recv_unindexed;
-
-        c_list_for_each_entry(xmit, list, batch_link) {
+        c_list_for_each_entry(xmit, &bucket->xmit_list, bucket_link) {
+                /* rules are sorted by priority, none of the remaining can win */
                 if (verdict->priority >= xmit->verdict.priority)
-                        continue;
+                        return;
 
                 if (xmit->type)
                         if (type != xmit->type)
@@ -828,14 +1360,6 @@ static void policy_snapshot_check_xmit_name(PolicyBatch *batch,
                         if (!path || strcmp(path, xmit->path))
                                 continue;
 
-                if (xmit->interface)
-                        if (!interface || strcmp(interface, xmit->interface))
-                                continue;
-
-                if (xmit->member)
-                        if (!member || strcmp(member, xmit->member))
-                                continue;
-
                 switch (xmit->broadcast) {
                 case UTIL_TRISTATE_YES:
                         if (!broadcast)
@@ -854,9 +1378,46 @@ static void policy_snapshot_check_xmit_name(PolicyBatch *batch,
                         continue;
 
                 *verdict = xmit->verdict;
+                return;
         }
 }
 
+static void policy_snapshot_check_xmit_name(PolicyBatch *batch,
+                                            bool is_send,
+                                            PolicyVerdict *verdict,
+                                            const char *name_str,
+                                            const char *interface,
+                                            const char *member,
+                                            const char *path,
+                                            unsigned int type,
+                                            bool broadcast,
+                                            size_t n_fds) {
+        PolicyBatchName *name;
+        CRBTree *index;
+
+        name = policy_batch_find_name(batch, name_str);
+        if (!name)
+                return;
+
+        index = is_send ? &name->send_index : &name->recv_index;
+
+        /*
+         * Interface and member of a bucket match by construction. Look at
+         * every combination of them, and their wildcards, that can apply.
+         */
+        if (interface && member)
+                policy_snapshot_check_xmit_bucket(policy_xmit_bucket_find(index, interface, member),
+                                                  verdict, path, type, broadcast, n_fds);
+        if (interface)
+                policy_snapshot_check_xmit_bucket(policy_xmit_bucket_find(index, interface, NULL),
+                                                  verdict, path, type, broadcast, n_fds);
+        if (member)
+                policy_snapshot_check_xmit_bucket(policy_xmit_bucket_find(index, NULL, member),
+                                                  verdict, path, type, broadcast, n_fds);
+        policy_snapshot_check_xmit_bucket(policy_xmit_bucket_find(index, NULL, NULL),
+                                          verdict, path, type, broadcast, n_fds);
+}
+
 static void policy_snapshot_check_xmit(PolicyBatch *batch,
                                        bool is_send,
                                        PolicyVerdict *verdict,
@@ -946,6 +1507,48 @@ static void policy_snapshot_check_xmit(PolicyBatch *batch,
         }
 }
 
+static PolicyVerdict policy_snapshot_evaluate_xmit(PolicySnapshot *snapshot,
+                                                   bool is_send,
+                                                   NameSet *subject,
+                                                   const char *interface,
+                                                   const char *method,
+                                                   const char *path,
+                                                   unsigned int type,
+                                                   bool broadcast,
+                                                   size_t n_fds) {
+        PolicyVerdict verdict = POLICY_VERDICT_INIT;
+        PolicyCacheEntry key;
+        bool cacheable, has_path;
+
+        has_path = is_send ? snapshot->batch->send_path : snapshot->batch->recv_path;
+
+        cacheable = !subject || subject->type != NAME_SET_TYPE_SNAPSHOT;
+        if (has_path && path && strnlen(path, POLICY_CACHE_PATH_MAX + 1) > POLICY_CACHE_PATH_MAX)
+                cacheable = false;
+
+        if (cacheable) {
+                policy_cache_key_init(&key, is_send, subject, interface, method, has_path ? path : NULL, type, broadcast, n_fds);
+                if (policy_cache_get(&snapshot->cache, &key, &verdict))
+                        return verdict;
+        }
+
+        policy_snapshot_check_xmit(snapshot->batch,
+                                   is_send,
+                                   &verdict,
+                                   subject,
+                                   interface,
+                                   method,
+                                   path,
+                                   type,
+                                   broadcast,
+                                   n_fds);
+
+        if (cacheable)
+                policy_cache_add(&snapshot->cache, &key, verdict);
+
+        return verdict;
+}
+
 /**
  * policy_snapshot_check_send() - XXX
  */
@@ -958,8 +1561,7 @@ int policy_snapshot_check_send(PolicySnapshot *snapshot,
                                unsigned int type,
                                bool broadcast,
                                size_t n_fds) {
-        PolicyVerdict verdict = POLICY_VERDICT_INIT;
-        size_t i;
+        PolicyVerdict verdict;
         int r;
 
         r = bus_selinux_check_send(snapshot->selinux, snapshot->seclabel, subject_seclabel);
@@ -970,17 +1572,18 @@ int policy_snapshot_check_send(PolicySnapshot *snapshot,
                 return error_fold(r);
         }
 
-        for (i = 0; i < snapshot->n_batches; ++i)
-                policy_snapshot_check_xmit(snapshot->batches[i],
-                                           true,
-                                           &verdict,
-                                           subject,
-                                           interface,
-                                           method,
-                                           path,
-                                           type,
-                                           broadcast,
-                                           n_fds);
+        if (snapshot->batch->send_constant != UTIL_TRISTATE_UNSET)
+                return snapshot->batch->send_constant == UTIL_TRISTATE_YES ? 0 : POLICY_E_ACCESS_DENIED;
+
+        verdict = policy_snapshot_evaluate_xmit(snapshot,
+                                                true,
+                                                subject,
+                                                interface,
+                                                method,
+                                                path,
+                                                type,
+                                                broadcast,
+                                                n_fds);
 
         return verdict.verdict ? 0 : POLICY_E_ACCESS_DENIED;
 }
@@ -996,20 +1599,20 @@ int policy_snapshot_check_receive(PolicySnapshot *snapshot,
                                   unsigned int type,
                                   bool broadcast,
                                   size_t n_fds) {
-        PolicyVerdict verdict = POLICY_VERDICT_INIT;
-        size_t i;
+        PolicyVerdict verdict;
 
-        for (i = 0; i < snapshot->n_batches; ++i)
-                policy_snapshot_check_xmit(snapshot->batches[i],
-                                           false,
-                                           &verdict,
-                                           subject,
-                                           interface,
-                                           method,
-                                           path,
-                                           type,
-                                           broadcast,
-                                           n_fds);
+        if (snapshot->batch->recv_constant != UTIL_TRISTATE_UNSET)
+                return snapshot->batch->recv_constant == UTIL_TRISTATE_YES ? 0 : POLICY_E_ACCESS_DENIED;
+
+        verdict = policy_snapshot_evaluate_xmit(snapshot,
+                                                false,
+                                                subject,
+                                                interface,
+                                                method,
+                                                path,
+                                                type,
+                                                broadcast,
+                                                n_fds);
 
         return verdict.verdict ? 0 : POLICY_E_ACCESS_DENIED;
 }
@@ -11,17 +11,22 @@
 #include <c-ref.h>
 #include <stdlib.h>
 #include "dbus/protocol.h"
+#include "util/common.h"
 
 typedef struct BusSELinuxRegistry BusSELinuxRegistry;
+typedef struct NameOwner NameOwner;
 typedef struct NameSet NameSet;
 typedef struct PolicyBatch PolicyBatch;
 typedef struct PolicyBatchName PolicyBatchName;
+typedef struct PolicyCache PolicyCache;
+typedef struct PolicyCacheEntry PolicyCacheEntry;
 typedef struct PolicyRegistry PolicyRegistry;
 typedef struct PolicyRegistryNode PolicyRegistryNode;
 typedef struct PolicyRegistryNodeIndex PolicyRegistryNodeIndex;
 typedef struct PolicySnapshot PolicySnapshot;
 typedef struct PolicyVerdict PolicyVerdict;
 typedef struct PolicyXmit PolicyXmit;
+typedef struct PolicyXmitBucket PolicyXmitBucket;
 
 enum {
         _POLICY_E_SUCCESS,
@@ -40,7 +45,7 @@ struct PolicyVerdict {
 #define POLICY_VERDICT_INIT_WITH(_v, _p) { .verdict = (_v), .priority = (_p) }
 
 struct PolicyXmit {
-        CList batch_link;
+        CList bucket_link;
         PolicyVerdict verdict;
         unsigned int type;
         unsigned int broadcast;
@@ -52,19 +57,31 @@ struct PolicyXmit {
 };
 
 #define POLICY_XMIT_NULL(_x) {                                                  \
-                .batch_link = C_LIST_INIT((_x).batch_link),                     \
+                .bucket_link = C_LIST_INIT((_x).bucket_link),                   \
                 .verdict = POLICY_VERDICT_INIT,                                 \
                 .type = DBUS_MESSAGE_TYPE_INVALID,                              \
                 .max_fds = UINT64_MAX,                                          \
         }
 
+struct PolicyXmitBucket {
+        CRBNode index_node;
+        CList xmit_list;
+        const char *interface;
+        const char *member;
+};
+
+#define POLICY_XMIT_BUCKET_NULL(_x) {                                           \
+                .index_node = C_RBNODE_INIT((_x).index_node),                   \
+                .xmit_list = C_LIST_INIT((_x).xmit_list),                       \
+        }
+
 struct PolicyBatchName {
         PolicyBatch *batch;
         CRBNode batch_node;
         PolicyVerdict own_verdict;
         PolicyVerdict own_prefix_verdict;
-        CList send_unindexed;
-        CList recv_unindexed;
+        CRBTree send_index;
+        CRBTree recv_index;
         char name[];
 };
 
@@ -72,20 +89,30 @@ struct PolicyBatchName {
                 .batch_node = C_RBNODE_INIT((_x).batch_node),                   \
                 .own_verdict = POLICY_VERDICT_INIT,                             \
                 .own_prefix_verdict = POLICY_VERDICT_INIT,                      \
-                .send_unindexed = C_LIST_INIT((_x).send_unindexed),             \
-                .recv_unindexed = C_LIST_INIT((_x).recv_unindexed),             \
+                .send_index = C_RBTREE_INIT,                                    \
+                .recv_index = C_RBTREE_INIT,                                    \
         }
 
 struct PolicyBatch {
         _Atomic unsigned long n_refs;
         PolicyVerdict connect_verdict;
         CRBTree name_tree;
+        unsigned int own_constant;
+        unsigned int send_constant;
+        unsigned int recv_constant;
+        bool send_path : 1;
+        bool recv_path : 1;
 };
 
 #define POLICY_BATCH_NULL(_x) {                                                 \
                 .n_refs = C_REF_INIT,                                           \
                 .connect_verdict = POLICY_VERDICT_INIT,                         \
                 .name_tree = C_RBTREE_INIT,                                     \
+                .own_constant = UTIL_TRISTATE_UNSET,                            \
+                .send_constant = UTIL_TRISTATE_UNSET,                           \
+                .recv_constant = UTIL_TRISTATE_UNSET,                           \
+                .send_path = true,                                              \
+                .recv_path = true,                                              \
         }
 
 struct PolicyRegistryNodeIndex {
@@ -116,22 +143,72 @@ struct PolicyRegistry {
         CRBTree uid_range_tree;
         CRBTree uid_tree;
         CRBTree gid_tree;
+        CRBTree snapshot_tree;
 };
 
 #define POLICY_REGISTRY_NULL {                                                  \
                 .uid_range_tree = C_RBTREE_INIT,                                \
                 .uid_tree = C_RBTREE_INIT,                                      \
                 .gid_tree = C_RBTREE_INIT,                                      \
+                .snapshot_tree = C_RBTREE_INIT,                                 \
+        }
+
+#define POLICY_CACHE_MAX (64UL)
+#define POLICY_CACHE_PATH_MAX (128UL)
+
+struct PolicyCacheEntry {
+        CRBNode cache_node;
+        CList lru_link;
+        uint64_t generation;
+
+        uint64_t hash;
+        bool is_send;
+        bool driver;
+        NameOwner *subject;
+        unsigned int type;
+        bool broadcast;
+        size_t n_fds;
+        const char *path;
+        const char *interface;
+        const char *member;
+
+        PolicyVerdict verdict;
+};
+
+struct PolicyCache {
+        CRBTree entry_tree;
+        CList lru_list;
+        size_t n_entries;
+        size_t max_entries;
+
+        uint64_t n_hits;
+        uint64_t n_misses;
+};
+
+#define POLICY_CACHE_INIT(_x) {                                                 \
+                .entry_tree = C_RBTREE_INIT,                                    \
+                .lru_list = C_LIST_INIT((_x).lru_list),                         \
+                .max_entries = POLICY_CACHE_MAX,                                \
         }
 
 struct PolicySnapshot {
+        _Atomic unsigned long n_refs;
+        PolicyRegistry *registry;
+        CRBNode registry_node;
         BusSELinuxRegistry *selinux;
         char *seclabel;
-        size_t n_batches;
-        PolicyBatch *batches[];
+        PolicyCache cache;
+        PolicyBatch *batch;
+        uint32_t uid;
+        size_t n_gids;
+        uint32_t gids[];
 };
 
-#define POLICY_SNAPSHOT_NULL {}
+#define POLICY_SNAPSHOT_NULL(_x) {                                              \
+                .n_refs = C_REF_INIT,                                           \
+                .registry_node = C_RBNODE_INIT((_x).registry_node),             \
+                .cache = POLICY_CACHE_INIT((_x).cache),                         \
+        }
 
 /* batches */
 
@@ -155,9 +232,7 @@ int policy_snapshot_new(PolicySnapshot **snapshotp,
                         uint32_t uid,
                         const uint32_t *gids,
                         size_t n_gids);
-PolicySnapshot *policy_snapshot_free(PolicySnapshot *snapshot);
-
-int policy_snapshot_dup(PolicySnapshot *snapshot, PolicySnapshot **newp);
+void policy_snapshot_free(_Atomic unsigned long *n_refs, void *userdata);
 
 int policy_snapshot_check_connect(PolicySnapshot *snapshot);
 int policy_snapshot_check_own(PolicySnapshot *snapshot, const char *name);
@@ -179,8 +254,6 @@ int policy_snapshot_check_receive(PolicySnapshot *snapshot,
                                   bool broadcast,
                                   size_t n_fds);
 
-C_DEFINE_CLEANUP(PolicySnapshot *, policy_snapshot_free);
-
 /* inline helpers */
 
 static inline PolicyBatch *policy_batch_ref(PolicyBatch *batch) {
@@ -196,3 +269,17 @@ static inline PolicyBatch *policy_batch_unref(PolicyBatch *batch) {
 }
 
 C_DEFINE_CLEANUP(PolicyBatch *, policy_batch_unref);
+
+static inline PolicySnapshot *policy_snapshot_ref(PolicySnapshot *snapshot) {
+        if (snapshot)
+                c_ref_inc(&snapshot->n_refs);
+        return snapshot;
+}
+
+static inline PolicySnapshot *policy_snapshot_unref(PolicySnapshot *snapshot) {
+        if (snapshot)
+                c_ref_dec(&snapshot->n_refs, policy_snapshot_free, NULL);
+        return NULL;
+}
+
+C_DEFINE_CLEANUP(PolicySnapshot *, policy_snapshot_unref);
@@ -8,6 +8,7 @@
 #include <stdlib.h>
 #include "bus/reply.h"
 #include "util/error.h"
+#include "util/pool.h"
 #include "util/user.h"
 
 typedef struct ReplySlotKey ReplySlotKey;
@@ -17,6 +18,8 @@ struct ReplySlotKey {
         uint32_t serial;
 };
 
+static Pool reply_slot_pool = POOL_INIT(reply_slot_pool, sizeof(ReplySlot));
+
 static int reply_slot_compare(CRBTree *tree, void *k, CRBNode *rb) {
         ReplySlot *slot = c_container_of(rb, ReplySlot, registry_node);
         ReplySlotKey *key = k;
@@ -47,7 +50,7 @@ int reply_slot_new(ReplySlot **replyp, ReplyRegistry *registry, ReplyOwner *owne
         if (!slot)
                 return REPLY_E_EXISTS;
 
-        reply = calloc(1, sizeof(*reply));
+        reply = pool_alloc0(&reply_slot_pool, sizeof(*reply));
         if (!reply)
                 return error_origin(-ENOMEM);
 
@@ -79,7 +82,7 @@ ReplySlot *reply_slot_free(ReplySlot *slot) {
         c_list_unlink(&slot->owner_link);
         c_rbnode_unlink(&slot->registry_node);
 
-        free(slot);
+        pool_free(&reply_slot_pool, slot);
 
         return NULL;
 }
@@ -0,0 +1,325 @@
+/*
+ * Test Broadcast Destination Cache
+ */
+
+#include <c-list.h>
+#include <c-macro.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "bus/broadcast.h"
+#include "bus/match.h"
+#include "dbus/message.h"
+#include "dbus/protocol.h"
+
+static size_t test_count(CList *destinations) {
+        MatchOwner *owner;
+        size_t n = 0;
+
+        c_list_for_each_entry(owner, destinations, destinations_link)
+                ++n;
+
+        c_list_flush(destinations);
+        return n;
+}
+
+static void test_setup(void) {
+        BroadcastCache cache = BROADCAST_CACHE_INIT(cache);
+
+        broadcast_cache_flush(&cache);
+        assert(!cache.n_entries);
+}
+
+static void test_lookup(void) {
+        static const char *rules[] = {
+                "interface=com.example",
+                "member=Foo",
+                "path=/com/example,member=Bar",
+        };
+        BroadcastCache cache = BROADCAST_CACHE_INIT(cache);
+        MatchRegistry registry = MATCH_REGISTRY_INIT(registry);
+        CList destinations = C_LIST_INIT(destinations);
+        MessageMetadata metadata = {
+                .header = {
+                        .type = DBUS_MESSAGE_TYPE_SIGNAL,
+                },
+                .sender_id = 1,
+                .fields = {
+                        .path = "/com/example",
+                        .interface = "com.example",
+                        .member = "Foo",
+                },
+        };
+        MatchOwner owners[C_ARRAY_SIZE(rules)];
+        MatchRule *rule[C_ARRAY_SIZE(rules)];
+        uint64_t generation, n_evaluations, n_hits;
+        bool hit, body;
+        size_t i;
+        int r;
+
+        for (i = 0; i < C_ARRAY_SIZE(rules); ++i) {
+                match_owner_init(&owners[i]);
+
+                r = match_owner_ref_rule(&owners[i], &rule[i], NULL, rules[i]);
+                assert(!r);
+
+                r = match_rule_link(rule[i], &registry, false);
+                assert(!r);
+        }
+
+        generation = match_registry_generation();
+
+        hit = broadcast_cache_get_destinations(&cache, generation, &registry, &metadata, &destinations);
+        assert(!hit);
+        assert(cache.n_misses == 1 && cache.n_hits == 0);
+
+        body = match_registry_get_subscribers(&registry, &destinations, &metadata, &cache.trace);
+        assert(!body);
+
+        broadcast_cache_add(&cache, generation, &registry, &metadata, &destinations);
+        assert(cache.n_entries == 1);
+        assert(test_count(&destinations) == 2);
+
+        hit = broadcast_cache_get_destinations(&cache, generation, &registry, &metadata, &destinations);
+        assert(hit);
+        assert(cache.n_misses == 1 && cache.n_hits == 1);
+        assert(test_count(&destinations) == 2);
+
+        /* a hit credits the evaluations of the rules it was resolved with */
+        match_rule_get_counters(rule[0], &n_evaluations, &n_hits);
+        assert(n_evaluations == 2 && n_hits == 2);
+        match_rule_get_counters(rule[1], &n_evaluations, &n_hits);
+        assert(n_evaluations == 2 && n_hits == 2);
+        match_rule_get_counters(rule[2], &n_evaluations, &n_hits);
+        assert(n_evaluations == 0 && n_hits == 0);
+
+        /* a different sender, member or registry must not hit */
+        metadata.sender_id = 2;
+        hit = broadcast_cache_get_destinations(&cache, generation, &registry, &metadata, &destinations);
+        assert(!hit);
+        metadata.sender_id = 1;
+
+        metadata.fields.member = "Bar";
+        hit = broadcast_cache_get_destinations(&cache, generation, &registry, &metadata, &destinations);
+        assert(!hit);
+        metadata.fields.member = "Foo";
+
+        hit = broadcast_cache_get_destinations(&cache, generation, NULL, &metadata, &destinations);
+        assert(!hit);
+        assert(cache.n_misses == 4 && cache.n_hits == 1);
+
+        /* dropping a rule bumps the generation and invalidates the entry */
+        match_rule_user_unref(rule[0]);
+        assert(match_registry_generation() != generation);
+        generation = match_registry_generation();
+
+        hit = broadcast_cache_get_destinations(&cache, generation, &registry, &metadata, &destinations);
+        assert(!hit);
+        assert(c_list_is_empty(&destinations));
+
+        match_trace_reset(&cache.trace);
+        body = match_registry_get_subscribers(&registry, &destinations, &metadata, &cache.trace);
+        assert(!body);
+
+        broadcast_cache_add(&cache, generation, &registry, &metadata, &destinations);
+        assert(cache.n_entries == 1);
+        assert(test_count(&destinations) == 1);
+
+        hit = broadcast_cache_get_destinations(&cache, generation, &registry, &metadata, &destinations);
+        assert(hit);
+        assert(test_count(&destinations) == 1);
+
+        for (i = 1; i < C_ARRAY_SIZE(rules); ++i)
+                match_rule_user_unref(rule[i]);
+
+        for (i = 0; i < C_ARRAY_SIZE(rules); ++i)
+                match_owner_deinit(&owners[i]);
+
+        match_registry_deinit(&registry);
+        broadcast_cache_flush(&cache);
+}
+
+static void test_body(void) {
+        static const struct {
+                const char *rule;
+                bool body;
+        } rules[] = {
+                { "interface=com.example,member=Foo", false },
+                { "path_namespace=/com", false },
+                { "interface=com.example,arg0=foo", true },
+                { "interface=com.example,arg1=foo", true },
+                { "interface=com.example,arg0path=/foo/", true },
+                { "interface=com.example,arg0namespace=com.example", true },
+                { "path_namespace=/com,arg2=foo", true },
+        };
+        MessageMetadata metadata = {
+                .header = {
+                        .type = DBUS_MESSAGE_TYPE_SIGNAL,
+                },
+                .sender_id = 1,
+                .fields = {
+                        .path = "/com/example",
+                        .interface = "com.example",
+                        .member = "Foo",
+                },
+        };
+        CList destinations = C_LIST_INIT(destinations);
+        MatchOwner owner;
+        MatchRule *rule;
+        size_t i;
+        int r;
+
+        /*
+         * Any candidate rule with argument matches makes the lookup depend on
+         * the body, even if the message has no arguments at all.
+         */
+        for (i = 0; i < C_ARRAY_SIZE(rules); ++i) {
+                MatchRegistry registry = MATCH_REGISTRY_INIT(registry);
+
+                match_owner_init(&owner);
+
+                r = match_owner_ref_rule(&owner, &rule, NULL, rules[i].rule);
+                assert(!r);
+
+                r = match_rule_link(rule, &registry, false);
+                assert(!r);
+
+                assert(match_registry_get_subscribers(&registry, &destinations, &metadata, NULL) == rules[i].body);
+                c_list_flush(&destinations);
+
+                match_rule_user_unref(rule);
+                match_owner_deinit(&owner);
+                match_registry_deinit(&registry);
+        }
+}
+
+static void test_eviction(void) {
+        BroadcastCache cache = BROADCAST_CACHE_INIT(cache);
+        CList destinations = C_LIST_INIT(destinations);
+        MessageMetadata metadata = {
+                .header = {
+                        .type = DBUS_MESSAGE_TYPE_SIGNAL,
+                },
+                .fields = {
+                        .interface = "com.example",
+                },
+        };
+        bool hit;
+
+        cache.max_entries = 2;
+
+        metadata.sender_id = 1;
+        broadcast_cache_add(&cache, 0, NULL, &metadata, &destinations);
+        metadata.sender_id = 2;
+        broadcast_cache_add(&cache, 0, NULL, &metadata, &destinations);
+
+        /* refresh the first entry, so the second is the least recently used */
+        metadata.sender_id = 1;
+        hit = broadcast_cache_get_destinations(&cache, 0, NULL, &metadata, &destinations);
+        assert(hit);
+
+        metadata.sender_id = 3;
+        broadcast_cache_add(&cache, 0, NULL, &metadata, &destinations);
+        assert(cache.n_entries == 2);
+
+        metadata.sender_id = 1;
+        hit = broadcast_cache_get_destinations(&cache, 0, NULL, &metadata, &destinations);
+        assert(hit);
+
+        metadata.sender_id = 2;
+        hit = broadcast_cache_get_destinations(&cache, 0, NULL, &metadata, &destinations);
+        assert(!hit);
+
+        broadcast_cache_flush(&cache);
+}
+
+static void test_trace_bound(void) {
+        BroadcastCache cache = BROADCAST_CACHE_INIT(cache);
+        MatchRegistry registry = MATCH_REGISTRY_INIT(registry);
+        CList destinations = C_LIST_INIT(destinations);
+        MessageMetadata metadata = {
+                .header = {
+                        .type = DBUS_MESSAGE_TYPE_SIGNAL,
+                },
+                .sender_id = 1,
+                .fields = {
+                        .path = "/com/example",
+                        .interface = "com.example",
+                        .member = "Foo",
+                },
+        };
+        MatchOwner owners[MATCH_TRACE_MAX + 1];
+        MatchRule *rule[MATCH_TRACE_MAX + 1];
+        char rule_string[64];
+        uint64_t generation;
+        bool hit, body;
+        size_t i;
+        int r;
+
+        /*
+         * Every rule is a candidate with its own set of keys, so resolving
+         * the destinations evaluates one rule more than a trace can hold. The
+         * result must not be cached, since its hits could not be credited.
+         */
+        for (i = 0; i < C_ARRAY_SIZE(rule); ++i) {
+                match_owner_init(&owners[i]);
+
+                sprintf(rule_string, "member=Foo,destination=:1.%zu", i);
+
+                r = match_owner_ref_rule(&owners[i], &rule[i], NULL, rule_string);
+                assert(!r);
+
+                r = match_rule_link(rule[i], &registry, false);
+                assert(!r);
+        }
+
+        generation = match_registry_generation();
+
+        match_trace_reset(&cache.trace);
+        body = match_registry_get_subscribers(&registry, &destinations, &metadata, &cache.trace);
+        assert(!body);
+        assert(cache.trace.truncated);
+        assert(cache.trace.n_entries == MATCH_TRACE_MAX);
+
+        broadcast_cache_add(&cache, generation, &registry, &metadata, &destinations);
+        assert(!cache.n_entries);
+        c_list_flush(&destinations);
+
+        hit = broadcast_cache_get_destinations(&cache, generation, &registry, &metadata, &destinations);
+        assert(!hit);
+
+        /* with one rule less, the trace fits and the result is cached */
+        match_rule_user_unref(rule[MATCH_TRACE_MAX]);
+        match_owner_deinit(&owners[MATCH_TRACE_MAX]);
+        generation = match_registry_generation();
+
+        match_trace_reset(&cache.trace);
+        body = match_registry_get_subscribers(&registry, &destinations, &metadata, &cache.trace);
+        assert(!body);
+        assert(!cache.trace.truncated);
+        assert(cache.trace.n_entries == MATCH_TRACE_MAX);
+
+        broadcast_cache_add(&cache, generation, &registry, &metadata, &destinations);
+        assert(cache.n_entries == 1);
+        c_list_flush(&destinations);
+
+        hit = broadcast_cache_get_destinations(&cache, generation, &registry, &metadata, &destinations);
+        assert(hit);
+        c_list_flush(&destinations);
+
+        for (i = 0; i < MATCH_TRACE_MAX; ++i) {
+                match_rule_user_unref(rule[i]);
+                match_owner_deinit(&owners[i]);
+        }
+
+        match_registry_deinit(&registry);
+        broadcast_cache_flush(&cache);
+}
+
+int main(int argc, char **argv) {
+        test_setup();
+        test_lookup();
+        test_body();
+        test_eviction();
+        test_trace_bound();
+        return 0;
+}
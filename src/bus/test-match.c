@@ -18,7 +18,7 @@ static void test_arg(MatchOwner *owner,
 
         r = match_owner_ref_rule(owner, &rule, NULL, match);
         assert(r == 0);
-        assert(strcmp(rule->keys.filter.args[0], arg0) == 0);
+        assert(strcmp(match_filter_get_arg(&rule->keys.filter, 0), arg0) == 0);
 }
 
 static void test_parse_key(MatchOwner *owner) {
@@ -38,10 +38,10 @@ static void test_args(MatchOwner *owner,
 
         r = match_owner_ref_rule(owner,  &rule, NULL, match);
         assert(r == 0);
-        assert(strcmp(rule->keys.filter.args[0], arg0) == 0);
-        assert(strcmp(rule->keys.filter.args[1], arg1) == 0);
-        assert(strcmp(rule->keys.filter.args[2], arg2) == 0);
-        assert(strcmp(rule->keys.filter.args[3], arg3) == 0);
+        assert(strcmp(match_filter_get_arg(&rule->keys.filter, 0), arg0) == 0);
+        assert(strcmp(match_filter_get_arg(&rule->keys.filter, 1), arg1) == 0);
+        assert(strcmp(match_filter_get_arg(&rule->keys.filter, 2), arg2) == 0);
+        assert(strcmp(match_filter_get_arg(&rule->keys.filter, 3), arg3) == 0);
 }
 
 static void test_parse_value(MatchOwner *owner) {
@@ -131,7 +131,7 @@ static bool test_match(const char *match_string, MessageMetadata *metadata) {
         r = match_rule_link(rule, &registry, false);
         assert(!r);
 
-        match_registry_get_subscribers(&registry, &subscribers, metadata);
+        match_registry_get_subscribers(&registry, &subscribers, metadata, NULL);
         owner1 = c_list_first_entry(&subscribers, MatchOwner, destinations_link);
         assert(!owner1 || owner1 == &owner);
         c_list_flush(&subscribers);
@@ -145,6 +145,7 @@ static bool test_match(const char *match_string, MessageMetadata *metadata) {
 
 static void test_individual_matches(void) {
         MessageMetadata metadata = MESSAGE_METADATA_INIT;
+        MessageMetadataArg args[1] = {};
 
         assert(test_match("", &metadata));
 
@@ -199,6 +200,7 @@ static void test_individual_matches(void) {
         /* arg0 */
         metadata = (MessageMetadata)MESSAGE_METADATA_INIT;
         assert(!test_match("arg0=/com/example/foo/", &metadata));
+        metadata.args = args;
         metadata.args[0].value = "/com/example/foo/";
         metadata.args[0].element = 's';
         metadata.n_args = 1;
@@ -224,6 +226,7 @@ static void test_individual_matches(void) {
         /* arg0path - parent */
         metadata = (MessageMetadata)MESSAGE_METADATA_INIT;
         assert(!test_match("arg0path=/com/example/foo/", &metadata));
+        metadata.args = args;
         metadata.args[0].value = "/com/example/foo/";
         metadata.args[0].element = 'o';
         metadata.n_args = 1;
@@ -236,6 +239,7 @@ static void test_individual_matches(void) {
         /* arg0path - child */
         metadata = (MessageMetadata)MESSAGE_METADATA_INIT;
         assert(!test_match("arg0path=/com/example/foo", &metadata));
+        metadata.args = args;
         metadata.args[0].value = "/com/example/foo";
         metadata.args[0].element = 'o';
         metadata.n_args = 1;
@@ -248,6 +252,7 @@ static void test_individual_matches(void) {
         /* arg0namespace */
         metadata = (MessageMetadata)MESSAGE_METADATA_INIT;
         assert(!test_match("arg0namespace=com.example.foo", &metadata));
+        metadata.args = args;
         metadata.args[0].value = "com.example.foo";
         metadata.args[0].element = 's';
         metadata.n_args = 1;
@@ -294,7 +299,7 @@ static void test_iterator(void) {
         r = match_rule_link(rule4, &registry, false);
         assert(!r);
 
-        match_registry_get_subscribers(&registry, &subscribers, &metadata);
+        match_registry_get_subscribers(&registry, &subscribers, &metadata, NULL);
 
         owner = c_list_first_entry(&subscribers, MatchOwner, destinations_link);
         c_list_unlink(&owner->destinations_link);
@@ -314,6 +319,402 @@ static void test_iterator(void) {
 
 }
 
+static size_t test_count_subscribers(MatchRegistry *registry, MessageMetadata *metadata) {
+        CList subscribers = C_LIST_INIT(subscribers);
+        MatchOwner *owner;
+        size_t n = 0;
+
+        match_registry_get_subscribers(registry, &subscribers, metadata, NULL);
+
+        while ((owner = c_list_first_entry(&subscribers, MatchOwner, destinations_link))) {
+                c_list_unlink(&owner->destinations_link);
+                ++n;
+        }
+
+        return n;
+}
+
+static void test_sparse_args(void) {
+        MatchOwner owner = MATCH_OWNER_INIT(owner);
+        MessageMetadata metadata = MESSAGE_METADATA_INIT;
+        MatchRule *rule1, *rule2;
+        MessageMetadataArg args[4] = {
+                { 's', "foo" },
+                { 's', "/bar/baz" },
+                { 's', "" },
+                { 's', "foo" },
+        };
+        int r;
+
+        /* argument matches are stored sorted, regardless of their order in the rule */
+        r = match_owner_ref_rule(&owner, &rule1, NULL, "arg3=foo,arg1path=/bar/");
+        assert(!r);
+        r = match_owner_ref_rule(&owner, &rule2, NULL, "arg1path=/bar/,arg3=foo");
+        assert(!r);
+        assert(rule1 == rule2);
+
+        assert(rule1->keys.filter.n_args == 2);
+        assert(rule1->keys.filter.args[0].index == 1 && rule1->keys.filter.args[0].path);
+        assert(rule1->keys.filter.args[1].index == 3 && !rule1->keys.filter.args[1].path);
+        assert(!match_filter_get_arg(&rule1->keys.filter, 1));
+        assert(!strcmp(match_filter_get_arg(&rule1->keys.filter, 3), "foo"));
+
+        metadata.args = args;
+        metadata.n_args = C_ARRAY_SIZE(args);
+        assert(test_match("arg3=foo,arg1path=/bar/", &metadata));
+        assert(!test_match("arg3=bar,arg1path=/bar/", &metadata));
+        assert(!test_match("arg3=foo,arg1path=/baz/", &metadata));
+
+        metadata.n_args = 3;
+        assert(!test_match("arg3=foo,arg1path=/bar/", &metadata));
+        assert(test_match("arg1path=/bar/", &metadata));
+
+        match_rule_user_unref(rule2);
+        match_rule_user_unref(rule1);
+        match_owner_deinit(&owner);
+}
+
+static void test_index(void) {
+        static const char *rules[] = {
+                "",
+                "path=/com/example",
+                "interface=com.example",
+                "member=Foo",
+                "path=/com/example,member=Foo",
+                "path=/com/example,interface=com.example,member=Foo",
+                "path=/com/example,interface=com.example,member=Bar",
+                "path=/com/example/foo",
+                "interface=com.example.foo",
+        };
+        MatchRegistry registry = MATCH_REGISTRY_INIT(registry);
+        MessageMetadata metadata = MESSAGE_METADATA_INIT;
+        MatchOwner owners[C_ARRAY_SIZE(rules)];
+        MatchRule *rule[C_ARRAY_SIZE(rules)];
+        size_t i;
+        int r;
+
+        /*
+         * Register rules with all kinds of wildcards in the indexed fields,
+         * each with its own owner, and verify that lookups find exactly the
+         * matching ones.
+         */
+        for (i = 0; i < C_ARRAY_SIZE(rules); ++i) {
+                match_owner_init(&owners[i]);
+
+                r = match_owner_ref_rule(&owners[i], &rule[i], NULL, rules[i]);
+                assert(!r);
+
+                r = match_rule_link(rule[i], &registry, false);
+                assert(!r);
+        }
+
+        assert(test_count_subscribers(&registry, &metadata) == 1);
+
+        metadata.fields.path = "/com/example";
+        assert(test_count_subscribers(&registry, &metadata) == 2);
+
+        metadata.fields.interface = "com.example";
+        assert(test_count_subscribers(&registry, &metadata) == 3);
+
+        metadata.fields.member = "Foo";
+        assert(test_count_subscribers(&registry, &metadata) == 6);
+
+        metadata.fields.member = "Bar";
+        assert(test_count_subscribers(&registry, &metadata) == 4);
+
+        metadata.fields.path = NULL;
+        metadata.fields.interface = NULL;
+        metadata.fields.member = "Foo";
+        assert(test_count_subscribers(&registry, &metadata) == 2);
+
+        /* drop some rules, and verify the index stays consistent */
+        for (i = 0; i < C_ARRAY_SIZE(rules); i += 2)
+                match_rule_user_unref(rule[i]);
+
+        metadata.fields.path = "/com/example";
+        metadata.fields.interface = "com.example";
+        assert(test_count_subscribers(&registry, &metadata) == 3);
+
+        match_registry_flush(&registry);
+        assert(test_count_subscribers(&registry, &metadata) == 0);
+
+        for (i = 1; i < C_ARRAY_SIZE(rules); i += 2)
+                match_rule_user_unref(rule[i]);
+
+        for (i = 0; i < C_ARRAY_SIZE(rules); ++i)
+                match_owner_deinit(&owners[i]);
+
+        match_registry_deinit(&registry);
+}
+
+static void test_arg0(void) {
+        static const char *rules[] = {
+                "member=NameOwnerChanged",
+                "member=NameOwnerChanged,arg0=com.example.foo",
+                "member=NameOwnerChanged,arg0=com.example.foo,arg1=:1.0",
+                "member=NameOwnerChanged,arg0=com.example.bar",
+                "arg0=com.example.foo",
+        };
+        MatchRegistry registry = MATCH_REGISTRY_INIT(registry);
+        MessageMetadata metadata = MESSAGE_METADATA_INIT;
+        MessageMetadataArg args[2] = {};
+        MatchOwner owners[C_ARRAY_SIZE(rules)];
+        MatchRule *rule[C_ARRAY_SIZE(rules)];
+        size_t i;
+        int r;
+
+        for (i = 0; i < C_ARRAY_SIZE(rules); ++i) {
+                match_owner_init(&owners[i]);
+
+                r = match_owner_ref_rule(&owners[i], &rule[i], NULL, rules[i]);
+                assert(!r);
+
+                r = match_rule_link(rule[i], &registry, false);
+                assert(!r);
+        }
+
+        metadata.fields.member = "NameOwnerChanged";
+        assert(test_count_subscribers(&registry, &metadata) == 1);
+
+        metadata.args = args;
+        metadata.n_args = 2;
+        args[0] = (MessageMetadataArg){ 's', "com.example.foo" };
+        args[1] = (MessageMetadataArg){ 's', ":1.1" };
+        assert(test_count_subscribers(&registry, &metadata) == 3);
+
+        args[1].value = ":1.0";
+        assert(test_count_subscribers(&registry, &metadata) == 4);
+
+        args[0].value = "com.example.bar";
+        assert(test_count_subscribers(&registry, &metadata) == 2);
+
+        args[0].value = "com.example.baz";
+        assert(test_count_subscribers(&registry, &metadata) == 1);
+
+        /* only string arguments can match */
+        args[0] = (MessageMetadataArg){ 'o', "com.example.foo" };
+        assert(test_count_subscribers(&registry, &metadata) == 1);
+
+        match_rule_user_unref(rule[1]);
+        match_rule_user_unref(rule[3]);
+
+        args[0] = (MessageMetadataArg){ 's', "com.example.foo" };
+        assert(test_count_subscribers(&registry, &metadata) == 3);
+
+        match_registry_flush(&registry);
+        assert(test_count_subscribers(&registry, &metadata) == 0);
+
+        for (i = 0; i < C_ARRAY_SIZE(rules); ++i) {
+                if (i != 1 && i != 3)
+                        match_rule_user_unref(rule[i]);
+                match_owner_deinit(&owners[i]);
+        }
+
+        match_registry_deinit(&registry);
+}
+
+static void test_namespace(void) {
+        static const char *rules[] = {
+                "path_namespace=/org/example",
+                "path_namespace=/org/example/foo",
+                "path_namespace=/org/examples",
+                "member=Foo,path_namespace=/org",
+                "arg0namespace=com.example",
+                "arg0namespace=com.example.foo",
+                "path_namespace=/org,arg0namespace=com.example",
+        };
+        MatchRegistry registry = MATCH_REGISTRY_INIT(registry);
+        MessageMetadata metadata = MESSAGE_METADATA_INIT;
+        MessageMetadataArg args[1] = {};
+        MatchOwner owners[C_ARRAY_SIZE(rules)];
+        MatchRule *rule[C_ARRAY_SIZE(rules)];
+        size_t i;
+        int r;
+
+        for (i = 0; i < C_ARRAY_SIZE(rules); ++i) {
+                match_owner_init(&owners[i]);
+
+                r = match_owner_ref_rule(&owners[i], &rule[i], NULL, rules[i]);
+                assert(!r);
+
+                r = match_rule_link(rule[i], &registry, false);
+                assert(!r);
+        }
+
+        assert(test_count_subscribers(&registry, &metadata) == 0);
+
+        metadata.fields.path = "/org/example/foo/bar";
+        assert(test_count_subscribers(&registry, &metadata) == 2);
+
+        metadata.fields.member = "Foo";
+        assert(test_count_subscribers(&registry, &metadata) == 3);
+
+        metadata.fields.path = "/org/examples";
+        assert(test_count_subscribers(&registry, &metadata) == 2);
+
+        metadata.fields.path = "/org/exam";
+        assert(test_count_subscribers(&registry, &metadata) == 1);
+
+        metadata.fields.path = NULL;
+        metadata.fields.member = NULL;
+        metadata.args = args;
+        metadata.n_args = C_ARRAY_SIZE(args);
+        args[0] = (MessageMetadataArg){ 's', "com.example.foo.Bar" };
+        assert(test_count_subscribers(&registry, &metadata) == 2);
+
+        args[0].value = "com.examplefoo";
+        assert(test_count_subscribers(&registry, &metadata) == 0);
+
+        metadata.fields.path = "/org";
+        args[0].value = "com.example";
+        assert(test_count_subscribers(&registry, &metadata) == 2);
+
+        match_registry_flush(&registry);
+        assert(test_count_subscribers(&registry, &metadata) == 0);
+
+        for (i = 0; i < C_ARRAY_SIZE(rules); ++i) {
+                match_rule_user_unref(rule[i]);
+                match_owner_deinit(&owners[i]);
+        }
+
+        match_registry_deinit(&registry);
+}
+
+static void test_summary(void) {
+        static const char *rules[] = {
+                "interface=com.example,member=Foo",
+                "interface=com.example,member=Bar",
+                "path=/com/example,interface=com.example.foo",
+        };
+        MatchRegistry registry = MATCH_REGISTRY_INIT(registry);
+        MessageMetadata metadata = MESSAGE_METADATA_INIT;
+        MatchOwner owners[C_ARRAY_SIZE(rules)];
+        MatchRule *rule[C_ARRAY_SIZE(rules)];
+        MatchIndex *index = &registry.subscription_index;
+        size_t i;
+        int r;
+
+        for (i = 0; i < C_ARRAY_SIZE(rules); ++i) {
+                match_owner_init(&owners[i]);
+
+                r = match_owner_ref_rule(&owners[i], &rule[i], NULL, rules[i]);
+                assert(!r);
+
+                r = match_rule_link(rule[i], &registry, false);
+                assert(!r);
+
+                assert((index->summary & rule[i]->registry_by_keys->registry_by_fields->summary) ==
+                       rule[i]->registry_by_keys->registry_by_fields->summary);
+        }
+
+        metadata.fields.path = "/com/example";
+        metadata.fields.interface = "com.example";
+        metadata.fields.member = "Foo";
+        assert(test_count_subscribers(&registry, &metadata) == 1);
+
+        metadata.fields.interface = "com.example.foo";
+        assert(test_count_subscribers(&registry, &metadata) == 1);
+
+        metadata.fields.interface = "com.example.bar";
+        assert(test_count_subscribers(&registry, &metadata) == 0);
+
+        /* the filter is rebuilt once more entries were removed than are left */
+        match_rule_user_unref(rule[0]);
+        assert(index->n_stale == 1);
+        match_rule_user_unref(rule[1]);
+        assert(index->n_stale == 0);
+        assert(index->summary == rule[2]->registry_by_keys->registry_by_fields->summary);
+
+        metadata.fields.interface = "com.example.foo";
+        assert(test_count_subscribers(&registry, &metadata) == 1);
+
+        match_rule_user_unref(rule[2]);
+        assert(!index->summary);
+
+        for (i = 0; i < C_ARRAY_SIZE(rules); ++i)
+                match_owner_deinit(&owners[i]);
+
+        match_registry_deinit(&registry);
+}
+
+static void test_format(const char *string, const char *expected) {
+        MatchOwner owner = MATCH_OWNER_INIT(owner);
+        _c_cleanup_(c_freep) char *formatted = NULL;
+        MatchRule *rule1, *rule2;
+        int r;
+
+        r = match_owner_ref_rule(&owner, &rule1, NULL, string);
+        assert(!r);
+
+        r = match_rule_format(rule1, &formatted);
+        assert(!r);
+        assert(!strcmp(formatted, expected));
+
+        /* the formatted string must parse into the same rule */
+        r = match_owner_ref_rule(&owner, &rule2, NULL, formatted);
+        assert(!r);
+        assert(rule1 == rule2);
+
+        match_rule_user_unref(rule2);
+        match_rule_user_unref(rule1);
+        match_owner_deinit(&owner);
+}
+
+static void test_stats(void) {
+        MatchRegistry registry = MATCH_REGISTRY_INIT(registry);
+        MatchOwner owner1 = MATCH_OWNER_INIT(owner1), owner2 = MATCH_OWNER_INIT(owner2);
+        MessageMetadata metadata = MESSAGE_METADATA_INIT;
+        MatchRule *rule1, *rule2;
+        uint64_t n_evaluations, n_hits;
+        int r;
+
+        test_format("", "");
+        test_format("member=Foo,type=signal,interface=com.example",
+                    "type='signal',interface='com.example',member='Foo'");
+        test_format("arg3='it'\\''s',arg0namespace=com.example,arg1path=/foo/",
+                    "arg0namespace='com.example',arg1path='/foo/',arg3='it'\\''s'");
+
+        /* rules with equal keys share their counters, starting from their link */
+        r = match_owner_ref_rule(&owner1, &rule1, NULL, "interface=com.example,member=Foo");
+        assert(!r);
+        r = match_rule_link(rule1, &registry, false);
+        assert(!r);
+
+        match_rule_get_counters(rule1, &n_evaluations, &n_hits);
+        assert(n_evaluations == 0 && n_hits == 0);
+
+        metadata.fields.interface = "com.example";
+        metadata.fields.member = "Foo";
+        metadata.fields.path = "/com/example";
+        metadata.header.type = DBUS_MESSAGE_TYPE_SIGNAL;
+        assert(test_count_subscribers(&registry, &metadata) == 1);
+
+        r = match_owner_ref_rule(&owner2, &rule2, NULL, "member=Foo,interface=com.example");
+        assert(!r);
+        r = match_rule_link(rule2, &registry, false);
+        assert(!r);
+
+        assert(test_count_subscribers(&registry, &metadata) == 2);
+
+        match_rule_get_counters(rule1, &n_evaluations, &n_hits);
+        assert(n_evaluations == 2 && n_hits == 2);
+        match_rule_get_counters(rule2, &n_evaluations, &n_hits);
+        assert(n_evaluations == 1 && n_hits == 1);
+
+        /* rules are only evaluated for messages their index entry covers */
+        metadata.fields.member = "Bar";
+        assert(test_count_subscribers(&registry, &metadata) == 0);
+
+        match_rule_get_counters(rule1, &n_evaluations, &n_hits);
+        assert(n_evaluations == 2 && n_hits == 2);
+
+        match_rule_user_unref(rule2);
+        match_rule_user_unref(rule1);
+        match_owner_deinit(&owner2);
+        match_owner_deinit(&owner1);
+        match_registry_deinit(&registry);
+}
+
 int main(int argc, char **argv) {
         MatchOwner owner = MATCH_OWNER_INIT(owner);
 
@@ -326,6 +727,12 @@ int main(int argc, char **argv) {
         test_individual_matches();
 
         test_iterator();
+        test_sparse_args();
+        test_index();
+        test_arg0();
+        test_namespace();
+        test_summary();
+        test_stats();
 
         match_owner_deinit(&owner);
         return 0;
@@ -0,0 +1,820 @@
+/*
+ * Test Policy
+ */
+
+#include <c-dvar.h>
+#include <c-dvar-type.h>
+#include <c-macro.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bus/name.h"
+#include "bus/policy.h"
+#include "dbus/protocol.h"
+#include "util/common.h"
+#include "util/selinux.h"
+
+#define TEST_T_BATCH "(bta(btbs)a(btssssuutt)a(btssssuutt))"
+#define TEST_T "(a(u" TEST_T_BATCH ")a(buu" TEST_T_BATCH ")a(ss)b)"
+
+enum {
+        TEST_RULE_CONNECT,
+        TEST_RULE_OWN,
+        TEST_RULE_OWN_PREFIX,
+        TEST_RULE_SEND,
+        TEST_RULE_RECV,
+};
+
+enum {
+        TEST_BATCH_DEFAULT,
+        TEST_BATCH_UID,
+        TEST_BATCH_UID_RANGE,
+        TEST_BATCH_GID,
+};
+
+typedef struct TestRule {
+        unsigned int kind;
+        bool verdict;
+        uint64_t priority;
+        const char *name;
+        const char *path;
+        const char *interface;
+        const char *member;
+        unsigned int type;
+} TestRule;
+
+typedef struct TestBatch {
+        unsigned int kind;
+        uint32_t start;
+        uint32_t end;
+        const TestRule *rules;
+        size_t n_rules;
+} TestBatch;
+
+#define TEST_BATCH(_kind, _start, _end, _rules) { (_kind), (_start), (_end), (_rules), C_ARRAY_SIZE(_rules) }
+
+static void test_write_xmit(CDVar *v, const TestBatch *batch, unsigned int kind) {
+        const TestRule *rule;
+        size_t i;
+
+        c_dvar_write(v, "[");
+        for (i = 0; i < batch->n_rules; ++i) {
+                rule = &batch->rules[i];
+                if (rule->kind != kind)
+                        continue;
+
+                c_dvar_write(v, "(btssssuutt)",
+                             rule->verdict, rule->priority,
+                             rule->name ?: "", rule->path ?: "", rule->interface ?: "", rule->member ?: "",
+                             rule->type, UTIL_TRISTATE_UNSET,
+                             (uint64_t)0, UINT64_MAX);
+        }
+        c_dvar_write(v, "]");
+}
+
+static void test_write_batch(CDVar *v, const TestBatch *batch) {
+        bool connect_verdict = false;
+        uint64_t connect_priority = 0;
+        const TestRule *rule;
+        size_t i;
+
+        for (i = 0; i < batch->n_rules; ++i) {
+                rule = &batch->rules[i];
+                if (rule->kind == TEST_RULE_CONNECT && rule->priority > connect_priority) {
+                        connect_verdict = rule->verdict;
+                        connect_priority = rule->priority;
+                }
+        }
+
+        c_dvar_write(v, "(bt[", connect_verdict, connect_priority);
+        for (i = 0; i < batch->n_rules; ++i) {
+                rule = &batch->rules[i];
+                if (rule->kind != TEST_RULE_OWN && rule->kind != TEST_RULE_OWN_PREFIX)
+                        continue;
+
+                c_dvar_write(v, "(btbs)", rule->verdict, rule->priority, rule->kind == TEST_RULE_OWN_PREFIX, rule->name ?: "");
+        }
+        c_dvar_write(v, "]");
+
+        test_write_xmit(v, batch, TEST_RULE_SEND);
+        test_write_xmit(v, batch, TEST_RULE_RECV);
+
+        c_dvar_write(v, ")");
+}
+
+/*
+ * Import the given batches into @registry, in the format the launcher sends.
+ * Unset strings are written as empty strings, just like the launcher does.
+ */
+static void test_import(PolicyRegistry *registry, const TestBatch *batches, size_t n_batches) {
+        _c_cleanup_(c_dvar_deinit) CDVar v = C_DVAR_INIT;
+        _c_cleanup_(c_freep) void *data = NULL;
+        CDVarType *type;
+        size_t i, n_data;
+        int r;
+
+        r = c_dvar_type_new_from_signature(&type, TEST_T, strlen(TEST_T));
+        assert(!r);
+
+        c_dvar_begin_write(&v, false, c_dvar_type_v, 1);
+        c_dvar_write(&v, "<([", type);
+
+        for (i = 0; i < n_batches; ++i) {
+                if (batches[i].kind == TEST_BATCH_DEFAULT) {
+                        c_dvar_write(&v, "(u", (uint32_t)-1);
+                } else if (batches[i].kind == TEST_BATCH_UID) {
+                        c_dvar_write(&v, "(u", batches[i].start);
+                } else {
+                        continue;
+                }
+
+                test_write_batch(&v, &batches[i]);
+                c_dvar_write(&v, ")");
+        }
+
+        c_dvar_write(&v, "][");
+
+        for (i = 0; i < n_batches; ++i) {
+                if (batches[i].kind != TEST_BATCH_UID_RANGE && batches[i].kind != TEST_BATCH_GID)
+                        continue;
+
+                c_dvar_write(&v, "(buu", batches[i].kind == TEST_BATCH_GID, batches[i].start, batches[i].end);
+                test_write_batch(&v, &batches[i]);
+                c_dvar_write(&v, ")");
+        }
+
+        c_dvar_write(&v, "][]b)>", false);
+
+        r = c_dvar_end_write(&v, &data, &n_data);
+        assert(!r);
+
+        c_dvar_deinit(&v);
+        c_dvar_begin_read(&v, false, c_dvar_type_v, 1, data, n_data);
+
+        r = policy_registry_import(registry, &v);
+        assert(!r);
+
+        r = c_dvar_end_read(&v);
+        assert(!r);
+
+        c_dvar_type_free(type);
+}
+
+/*
+ * The bus library is linked statically, so these replace util/selinux.c and
+ * its fallback, and let the tests observe and control the SELinux checks.
+ */
+static unsigned int test_selinux_n_checks;
+static bool test_selinux_deny;
+
+bool bus_selinux_is_enabled(void) {
+        return true;
+}
+
+const char *bus_selinux_policy_root(void) {
+        return NULL;
+}
+
+int bus_selinux_registry_new(BusSELinuxRegistry **registryp, const char *fallback_context) {
+        *registryp = NULL;
+        return 0;
+}
+
+BusSELinuxRegistry *bus_selinux_registry_ref(BusSELinuxRegistry *registry) {
+        return registry;
+}
+
+BusSELinuxRegistry *bus_selinux_registry_unref(BusSELinuxRegistry *registry) {
+        return NULL;
+}
+
+int bus_selinux_registry_add_name(BusSELinuxRegistry *registry, const char *name, const char *context) {
+        return 0;
+}
+
+int bus_selinux_check_own(BusSELinuxRegistry *registry, const char *context_owner, const char *name) {
+        ++test_selinux_n_checks;
+        return test_selinux_deny ? SELINUX_E_DENIED : 0;
+}
+
+int bus_selinux_check_send(BusSELinuxRegistry *registry, const char *context_sender, const char *context_receiver) {
+        ++test_selinux_n_checks;
+        return test_selinux_deny ? SELINUX_E_DENIED : 0;
+}
+
+int bus_selinux_init_global(void) {
+        return 0;
+}
+
+void bus_selinux_deinit_global(void) {
+}
+
+static void test_setup(void) {
+        _c_cleanup_(policy_registry_freep) PolicyRegistry *registry = NULL;
+        _c_cleanup_(policy_snapshot_unrefp) PolicySnapshot *snapshot = NULL;
+        int r;
+
+        r = policy_registry_new(&registry, "label");
+        assert(!r);
+
+        r = policy_snapshot_new(&snapshot, registry, "label", 0, NULL, 0);
+        assert(!r);
+        assert(!snapshot->cache.n_entries);
+
+        /* a single applicable batch is shared rather than merged */
+        assert(snapshot->batch == registry->default_batch);
+}
+
+static void test_cache(void) {
+        _c_cleanup_(policy_registry_freep) PolicyRegistry *registry = NULL;
+        _c_cleanup_(policy_snapshot_unrefp) PolicySnapshot *snapshot = NULL, *dup = NULL;
+        NameRegistry names;
+        NameOwner owner;
+        NameChange change;
+        NameSet subject = NAME_SET_INIT_FROM_OWNER(&owner);
+        int r;
+
+        name_registry_init(&names);
+        name_owner_init(&owner);
+        name_change_init(&change);
+
+        r = policy_registry_new(&registry, "label");
+        assert(!r);
+
+        r = policy_snapshot_new(&snapshot, registry, "label", 0, NULL, 0);
+        assert(!r);
+
+        /* an empty policy denies everything, but the verdict is still cached */
+        r = policy_snapshot_check_receive(snapshot, &subject, "com.example", "Foo", "/", DBUS_MESSAGE_TYPE_SIGNAL, true, 0);
+        assert(r == POLICY_E_ACCESS_DENIED);
+        assert(snapshot->cache.n_misses == 1 && snapshot->cache.n_hits == 0);
+
+        r = policy_snapshot_check_receive(snapshot, &subject, "com.example", "Foo", "/", DBUS_MESSAGE_TYPE_SIGNAL, true, 0);
+        assert(r == POLICY_E_ACCESS_DENIED);
+        assert(snapshot->cache.n_misses == 1 && snapshot->cache.n_hits == 1);
+
+        /* send and receive checks, as well as different shapes, are distinct */
+        r = policy_snapshot_check_send(snapshot, "label", &subject, "com.example", "Foo", "/", DBUS_MESSAGE_TYPE_SIGNAL, true, 0);
+        assert(r == POLICY_E_ACCESS_DENIED);
+        r = policy_snapshot_check_receive(snapshot, &subject, "com.example", "Foo", "/", DBUS_MESSAGE_TYPE_SIGNAL, false, 0);
+        assert(r == POLICY_E_ACCESS_DENIED);
+        r = policy_snapshot_check_receive(snapshot, &subject, "com.example", "Foo", "/", DBUS_MESSAGE_TYPE_SIGNAL, true, 1);
+        assert(r == POLICY_E_ACCESS_DENIED);
+        r = policy_snapshot_check_receive(snapshot, &subject, NULL, "Foo", "/", DBUS_MESSAGE_TYPE_SIGNAL, true, 0);
+        assert(r == POLICY_E_ACCESS_DENIED);
+        r = policy_snapshot_check_receive(snapshot, NULL, "com.example", "Foo", "/", DBUS_MESSAGE_TYPE_SIGNAL, true, 0);
+        assert(r == POLICY_E_ACCESS_DENIED);
+        assert(snapshot->cache.n_misses == 6 && snapshot->cache.n_hits == 1);
+        assert(snapshot->cache.n_entries == 6);
+
+        /* any change to name ownership invalidates the verdicts */
+        r = name_registry_request_name(&names, &owner, NULL, "com.example", 0, &change);
+        assert(!r);
+        name_change_deinit(&change);
+
+        r = policy_snapshot_check_receive(snapshot, &subject, "com.example", "Foo", "/", DBUS_MESSAGE_TYPE_SIGNAL, true, 0);
+        assert(r == POLICY_E_ACCESS_DENIED);
+        assert(snapshot->cache.n_misses == 7 && snapshot->cache.n_hits == 1);
+        assert(snapshot->cache.n_entries == 6);
+
+        r = policy_snapshot_check_receive(snapshot, &subject, "com.example", "Foo", "/", DBUS_MESSAGE_TYPE_SIGNAL, true, 0);
+        assert(r == POLICY_E_ACCESS_DENIED);
+        assert(snapshot->cache.n_misses == 7 && snapshot->cache.n_hits == 2);
+
+        /* peers with equal credentials share the snapshot, and its cache */
+        r = policy_snapshot_new(&dup, registry, "label", 0, NULL, 0);
+        assert(!r);
+        assert(dup == snapshot);
+        assert(dup->cache.n_entries == 6);
+
+        r = name_registry_release_name(&names, &owner, "com.example", &change);
+        assert(!r);
+        name_change_deinit(&change);
+
+        name_owner_deinit(&owner);
+        name_registry_deinit(&names);
+}
+
+static void test_intern(void) {
+        _c_cleanup_(policy_registry_freep) PolicyRegistry *registry = NULL;
+        _c_cleanup_(policy_snapshot_unrefp) PolicySnapshot *snapshot1 = NULL, *snapshot2 = NULL, *snapshot3 = NULL;
+        _c_cleanup_(policy_snapshot_unrefp) PolicySnapshot *snapshot4 = NULL, *snapshot5 = NULL;
+        static const uint32_t gids1[] = { 1, 2, 3 };
+        static const uint32_t gids2[] = { 3, 1, 2 };
+        int r;
+
+        r = policy_registry_new(&registry, "label");
+        assert(!r);
+
+        r = policy_snapshot_new(&snapshot1, registry, "label", 0, gids1, C_ARRAY_SIZE(gids1));
+        assert(!r);
+
+        /* the order of the groups does not matter */
+        r = policy_snapshot_new(&snapshot2, registry, "label", 0, gids2, C_ARRAY_SIZE(gids2));
+        assert(!r);
+        assert(snapshot2 == snapshot1);
+
+        /* but the uid, the groups and the security label do */
+        r = policy_snapshot_new(&snapshot3, registry, "label", 1, gids1, C_ARRAY_SIZE(gids1));
+        assert(!r);
+        assert(snapshot3 != snapshot1);
+
+        r = policy_snapshot_new(&snapshot4, registry, "label", 0, gids1, 2);
+        assert(!r);
+        assert(snapshot4 != snapshot1);
+
+        r = policy_snapshot_new(&snapshot5, registry, "other", 0, gids1, C_ARRAY_SIZE(gids1));
+        assert(!r);
+        assert(snapshot5 != snapshot1);
+
+        /* snapshots may outlive their registry */
+        registry = policy_registry_free(registry);
+}
+
+static void test_eviction(void) {
+        _c_cleanup_(policy_registry_freep) PolicyRegistry *registry = NULL;
+        _c_cleanup_(policy_snapshot_unrefp) PolicySnapshot *snapshot = NULL;
+        int r;
+
+        r = policy_registry_new(&registry, "label");
+        assert(!r);
+
+        r = policy_snapshot_new(&snapshot, registry, "label", 0, NULL, 0);
+        assert(!r);
+
+        snapshot->cache.max_entries = 2;
+
+        policy_snapshot_check_receive(snapshot, NULL, "com.example", "Foo", NULL, DBUS_MESSAGE_TYPE_SIGNAL, true, 0);
+        policy_snapshot_check_receive(snapshot, NULL, "com.example", "Bar", NULL, DBUS_MESSAGE_TYPE_SIGNAL, true, 0);
+
+        /* refresh "Foo", so "Bar" is the least recently used entry */
+        policy_snapshot_check_receive(snapshot, NULL, "com.example", "Foo", NULL, DBUS_MESSAGE_TYPE_SIGNAL, true, 0);
+        assert(snapshot->cache.n_misses == 2 && snapshot->cache.n_hits == 1);
+
+        policy_snapshot_check_receive(snapshot, NULL, "com.example", "Baz", NULL, DBUS_MESSAGE_TYPE_SIGNAL, true, 0);
+        assert(snapshot->cache.n_entries == 2);
+
+        policy_snapshot_check_receive(snapshot, NULL, "com.example", "Foo", NULL, DBUS_MESSAGE_TYPE_SIGNAL, true, 0);
+        assert(snapshot->cache.n_misses == 3 && snapshot->cache.n_hits == 2);
+
+        policy_snapshot_check_receive(snapshot, NULL, "com.example", "Bar", NULL, DBUS_MESSAGE_TYPE_SIGNAL, true, 0);
+        assert(snapshot->cache.n_misses == 4 && snapshot->cache.n_hits == 2);
+        assert(snapshot->cache.n_entries == 2);
+}
+
+static void test_cache_path(void) {
+        static const TestRule rules_interface[] = {
+                { .kind = TEST_RULE_RECV, .verdict = true, .priority = 1, .interface = "com.example" },
+        };
+        static const TestRule rules_path[] = {
+                { .kind = TEST_RULE_RECV, .verdict = true, .priority = 1, .path = "/a" },
+        };
+        static const TestBatch batches_interface[] = {
+                TEST_BATCH(TEST_BATCH_DEFAULT, 0, 0, rules_interface),
+        };
+        static const TestBatch batches_path[] = {
+                TEST_BATCH(TEST_BATCH_DEFAULT, 0, 0, rules_path),
+        };
+        char long_path[POLICY_CACHE_PATH_MAX + 2];
+        int r;
+
+        long_path[0] = '/';
+        memset(long_path + 1, 'a', sizeof(long_path) - 2);
+        long_path[sizeof(long_path) - 1] = 0;
+
+        /* without path rules, all paths share an entry */
+        {
+                _c_cleanup_(policy_registry_freep) PolicyRegistry *registry = NULL;
+                _c_cleanup_(policy_snapshot_unrefp) PolicySnapshot *snapshot = NULL;
+
+                r = policy_registry_new(&registry, "label");
+                assert(!r);
+
+                test_import(registry, batches_interface, C_ARRAY_SIZE(batches_interface));
+
+                r = policy_snapshot_new(&snapshot, registry, "label", 0, NULL, 0);
+                assert(!r);
+
+                r = policy_snapshot_check_receive(snapshot, NULL, "com.example", "Foo", "/a", DBUS_MESSAGE_TYPE_SIGNAL, true, 0);
+                assert(!r);
+                r = policy_snapshot_check_receive(snapshot, NULL, "com.example", "Foo", "/b", DBUS_MESSAGE_TYPE_SIGNAL, true, 0);
+                assert(!r);
+                r = policy_snapshot_check_receive(snapshot, NULL, "com.example", "Foo", long_path, DBUS_MESSAGE_TYPE_SIGNAL, true, 0);
+                assert(!r);
+                assert(snapshot->cache.n_misses == 1 && snapshot->cache.n_hits == 2);
+                assert(snapshot->cache.n_entries == 1);
+        }
+
+        /* with path rules, paths are distinct, and overlong ones are not cached */
+        {
+                _c_cleanup_(policy_registry_freep) PolicyRegistry *registry = NULL;
+                _c_cleanup_(policy_snapshot_unrefp) PolicySnapshot *snapshot = NULL;
+
+                r = policy_registry_new(&registry, "label");
+                assert(!r);
+
+                test_import(registry, batches_path, C_ARRAY_SIZE(batches_path));
+
+                r = policy_snapshot_new(&snapshot, registry, "label", 0, NULL, 0);
+                assert(!r);
+
+                r = policy_snapshot_check_receive(snapshot, NULL, "com.example", "Foo", "/a", DBUS_MESSAGE_TYPE_SIGNAL, true, 0);
+                assert(!r);
+                r = policy_snapshot_check_receive(snapshot, NULL, "com.example", "Foo", "/b", DBUS_MESSAGE_TYPE_SIGNAL, true, 0);
+                assert(r == POLICY_E_ACCESS_DENIED);
+                r = policy_snapshot_check_receive(snapshot, NULL, "com.example", "Foo", "/a", DBUS_MESSAGE_TYPE_SIGNAL, true, 0);
+                assert(!r);
+                assert(snapshot->cache.n_misses == 2 && snapshot->cache.n_hits == 1);
+                assert(snapshot->cache.n_entries == 2);
+
+                r = policy_snapshot_check_receive(snapshot, NULL, "com.example", "Foo", long_path, DBUS_MESSAGE_TYPE_SIGNAL, true, 0);
+                assert(r == POLICY_E_ACCESS_DENIED);
+                r = policy_snapshot_check_receive(snapshot, NULL, "com.example", "Foo", long_path, DBUS_MESSAGE_TYPE_SIGNAL, true, 0);
+                assert(r == POLICY_E_ACCESS_DENIED);
+                assert(snapshot->cache.n_misses == 2 && snapshot->cache.n_hits == 1);
+                assert(snapshot->cache.n_entries == 2);
+        }
+}
+
+static int test_check_send(PolicySnapshot *snapshot, const char *interface, const char *member, const char *path, unsigned int type) {
+        return policy_snapshot_check_send(snapshot, "label", NULL, interface, member, path, type, false, 0);
+}
+
+static void test_xmit_buckets(void) {
+        static const TestRule rules[] = {
+                { .kind = TEST_RULE_SEND, .verdict = true, .priority = 10, .interface = "com.example", .member = "Foo" },
+                { .kind = TEST_RULE_SEND, .verdict = false, .priority = 20, .interface = "com.example" },
+                { .kind = TEST_RULE_SEND, .verdict = true, .priority = 25, .interface = "com.example", .path = "/p" },
+                { .kind = TEST_RULE_SEND, .verdict = true, .priority = 30, .member = "Foo" },
+                { .kind = TEST_RULE_SEND, .verdict = false, .priority = 40, .type = DBUS_MESSAGE_TYPE_METHOD_CALL },
+                { .kind = TEST_RULE_SEND, .verdict = true, .priority = 5, .interface = "com.example", .member = "Bar" },
+        };
+        static const TestBatch batches[] = {
+                TEST_BATCH(TEST_BATCH_DEFAULT, 0, 0, rules),
+        };
+        _c_cleanup_(policy_registry_freep) PolicyRegistry *registry = NULL;
+        _c_cleanup_(policy_snapshot_unrefp) PolicySnapshot *snapshot = NULL;
+        int r;
+
+        r = policy_registry_new(&registry, "label");
+        assert(!r);
+
+        test_import(registry, batches, C_ARRAY_SIZE(batches));
+
+        r = policy_snapshot_new(&snapshot, registry, "label", 0, NULL, 0);
+        assert(!r);
+        assert(snapshot->batch->send_constant == UTIL_TRISTATE_UNSET);
+
+        /* all four buckets apply, the highest priority wins, wherever it is */
+        r = test_check_send(snapshot, "com.example", "Foo", "/", DBUS_MESSAGE_TYPE_METHOD_CALL);
+        assert(r == POLICY_E_ACCESS_DENIED);
+        r = test_check_send(snapshot, "com.example", "Foo", "/", DBUS_MESSAGE_TYPE_SIGNAL);
+        assert(!r);
+
+        /* rules with an interface never match messages without one */
+        r = test_check_send(snapshot, NULL, "Foo", "/", DBUS_MESSAGE_TYPE_SIGNAL);
+        assert(!r);
+        r = test_check_send(snapshot, NULL, "Bar", "/", DBUS_MESSAGE_TYPE_SIGNAL);
+        assert(r == POLICY_E_ACCESS_DENIED);
+
+        /* member-only rules match any interface, and none */
+        r = test_check_send(snapshot, "org.other", "Foo", "/", DBUS_MESSAGE_TYPE_SIGNAL);
+        assert(!r);
+        r = test_check_send(snapshot, "org.other", "Baz", "/", DBUS_MESSAGE_TYPE_SIGNAL);
+        assert(r == POLICY_E_ACCESS_DENIED);
+
+        /* a lower-priority rule that matches must not win over a higher one */
+        r = test_check_send(snapshot, "com.example", "Bar", "/", DBUS_MESSAGE_TYPE_SIGNAL);
+        assert(r == POLICY_E_ACCESS_DENIED);
+
+        /* within a bucket, a higher-priority rule is not shadowed by an earlier one */
+        r = test_check_send(snapshot, "com.example", "Bar", "/p", DBUS_MESSAGE_TYPE_SIGNAL);
+        assert(!r);
+}
+
+static void test_merge(void) {
+        static const TestRule rules_default[] = {
+                { .kind = TEST_RULE_CONNECT, .verdict = false, .priority = 100 },
+        };
+        static const TestRule rules_uid[] = {
+                { .kind = TEST_RULE_CONNECT, .verdict = true, .priority = 10 },
+                { .kind = TEST_RULE_OWN, .verdict = true, .priority = 10, .name = "com.example" },
+                { .kind = TEST_RULE_SEND, .verdict = false, .priority = 10, .interface = "com.example" },
+                { .kind = TEST_RULE_RECV, .verdict = true, .priority = 10, .member = "Foo" },
+        };
+        static const TestRule rules_range[] = {
+                { .kind = TEST_RULE_CONNECT, .verdict = false, .priority = 20 },
+                { .kind = TEST_RULE_OWN, .verdict = false, .priority = 20, .name = "com.example" },
+                { .kind = TEST_RULE_OWN_PREFIX, .verdict = true, .priority = 15, .name = "com" },
+                { .kind = TEST_RULE_SEND, .verdict = true, .priority = 20, .interface = "com.example" },
+                { .kind = TEST_RULE_RECV, .verdict = false, .priority = 5, .member = "Foo" },
+        };
+        static const TestRule rules_gid10[] = {
+                { .kind = TEST_RULE_CONNECT, .verdict = true, .priority = 30 },
+                { .kind = TEST_RULE_OWN, .verdict = true, .priority = 5, .name = "com.example" },
+                { .kind = TEST_RULE_SEND, .verdict = false, .priority = 30, .interface = "com.example", .member = "Foo" },
+        };
+        static const TestRule rules_gid20[] = {
+                { .kind = TEST_RULE_CONNECT, .verdict = false, .priority = 25 },
+                { .kind = TEST_RULE_OWN, .verdict = true, .priority = 45, .name = "com.example" },
+                { .kind = TEST_RULE_OWN, .verdict = true, .priority = 40, .name = "org.test" },
+                { .kind = TEST_RULE_SEND, .verdict = true, .priority = 5 },
+        };
+        static const TestRule rules_gid30[] = {
+                { .kind = TEST_RULE_OWN_PREFIX, .verdict = false, .priority = 35, .name = "com.example" },
+                { .kind = TEST_RULE_RECV, .verdict = false, .priority = 1 },
+        };
+        static const TestBatch batches[] = {
+                TEST_BATCH(TEST_BATCH_DEFAULT, 0, 0, rules_default),
+                TEST_BATCH(TEST_BATCH_UID, 1000, 1000, rules_uid),
+                TEST_BATCH(TEST_BATCH_UID_RANGE, 500, 2000, rules_range),
+                TEST_BATCH(TEST_BATCH_GID, 10, 10, rules_gid10),
+                TEST_BATCH(TEST_BATCH_GID, 20, 20, rules_gid20),
+                TEST_BATCH(TEST_BATCH_GID, 30, 30, rules_gid30),
+        };
+        static const uint32_t gids[] = { 30, 10, 20 };
+        _c_cleanup_(policy_registry_freep) PolicyRegistry *registry = NULL;
+        _c_cleanup_(policy_snapshot_unrefp) PolicySnapshot *snapshot = NULL;
+        int r;
+
+        r = policy_registry_new(&registry, "label");
+        assert(!r);
+
+        test_import(registry, batches, C_ARRAY_SIZE(batches));
+
+        r = policy_snapshot_new(&snapshot, registry, "label", 1000, gids, C_ARRAY_SIZE(gids));
+        assert(!r);
+        assert(snapshot->batch != registry->default_batch);
+
+        /* the uid batch replaces the default batch, the group batch with priority 30 wins */
+        r = policy_snapshot_check_connect(snapshot);
+        assert(!r);
+
+        /* own: the exact rule of group 20 outranks the prefix rule of group 30 */
+        r = policy_snapshot_check_own(snapshot, "com.example");
+        assert(!r);
+        r = policy_snapshot_check_own(snapshot, "com.other");
+        assert(!r);
+        r = policy_snapshot_check_own(snapshot, "org.test");
+        assert(!r);
+        r = policy_snapshot_check_own(snapshot, "org.none");
+        assert(r == POLICY_E_ACCESS_DENIED);
+
+        /* send: group 10 outranks the uid-range, which outranks the uid */
+        r = test_check_send(snapshot, "com.example", "Foo", "/", DBUS_MESSAGE_TYPE_SIGNAL);
+        assert(r == POLICY_E_ACCESS_DENIED);
+        r = test_check_send(snapshot, "com.example", "Bar", "/", DBUS_MESSAGE_TYPE_SIGNAL);
+        assert(!r);
+        r = test_check_send(snapshot, "org.other", "Bar", "/", DBUS_MESSAGE_TYPE_SIGNAL);
+        assert(!r);
+
+        /* receive: the uid outranks the uid-range and the catch-all of group 30 */
+        r = policy_snapshot_check_receive(snapshot, NULL, "org.other", "Foo", "/", DBUS_MESSAGE_TYPE_SIGNAL, true, 0);
+        assert(!r);
+        r = policy_snapshot_check_receive(snapshot, NULL, "org.other", "Bar", "/", DBUS_MESSAGE_TYPE_SIGNAL, true, 0);
+        assert(r == POLICY_E_ACCESS_DENIED);
+
+        /* without the groups, the uid-range outranks the uid */
+        snapshot = policy_snapshot_unref(snapshot);
+        r = policy_snapshot_new(&snapshot, registry, "label", 1000, NULL, 0);
+        assert(!r);
+
+        r = policy_snapshot_check_connect(snapshot);
+        assert(r == POLICY_E_ACCESS_DENIED);
+        r = policy_snapshot_check_own(snapshot, "com.example");
+        assert(r == POLICY_E_ACCESS_DENIED);
+        r = policy_snapshot_check_own(snapshot, "org.test");
+        assert(r == POLICY_E_ACCESS_DENIED);
+        r = test_check_send(snapshot, "com.example", "Foo", "/", DBUS_MESSAGE_TYPE_SIGNAL);
+        assert(!r);
+        r = test_check_send(snapshot, "org.other", "Bar", "/", DBUS_MESSAGE_TYPE_SIGNAL);
+        assert(r == POLICY_E_ACCESS_DENIED);
+}
+
+static void test_constant_snapshot(const TestRule *rules, size_t n_rules, PolicyRegistry **registryp, PolicySnapshot **snapshotp) {
+        TestBatch batch = { TEST_BATCH_DEFAULT, 0, 0, rules, n_rules };
+        int r;
+
+        r = policy_registry_new(registryp, "label");
+        assert(!r);
+
+        test_import(*registryp, &batch, 1);
+
+        r = policy_snapshot_new(snapshotp, *registryp, "label", 0, NULL, 0);
+        assert(!r);
+}
+
+static void test_constant(void) {
+        static const TestRule rules_allow[] = {
+                { .kind = TEST_RULE_OWN, .verdict = true, .priority = 100 },
+                { .kind = TEST_RULE_OWN, .verdict = false, .priority = 50, .name = "com.example" },
+                { .kind = TEST_RULE_SEND, .verdict = true, .priority = 100 },
+                { .kind = TEST_RULE_SEND, .verdict = false, .priority = 50, .member = "Foo" },
+                { .kind = TEST_RULE_RECV, .verdict = true, .priority = 100 },
+                { .kind = TEST_RULE_RECV, .verdict = false, .priority = 50, .name = "com.example" },
+        };
+        static const TestRule rules_deny[] = {
+                { .kind = TEST_RULE_OWN_PREFIX, .verdict = false, .priority = 100 },
+                { .kind = TEST_RULE_OWN, .verdict = true, .priority = 50, .name = "com.example" },
+                { .kind = TEST_RULE_SEND, .verdict = false, .priority = 100 },
+                { .kind = TEST_RULE_SEND, .verdict = true, .priority = 50, .member = "Foo" },
+                { .kind = TEST_RULE_RECV, .verdict = false, .priority = 100 },
+                { .kind = TEST_RULE_RECV, .verdict = true, .priority = 50, .type = DBUS_MESSAGE_TYPE_SIGNAL },
+        };
+        static const TestRule rules_outranked[] = {
+                { .kind = TEST_RULE_OWN_PREFIX, .verdict = true, .priority = 10 },
+                { .kind = TEST_RULE_OWN_PREFIX, .verdict = false, .priority = 20, .name = "com.example" },
+                { .kind = TEST_RULE_SEND, .verdict = true, .priority = 10 },
+                { .kind = TEST_RULE_SEND, .verdict = false, .priority = 20, .member = "Foo" },
+                { .kind = TEST_RULE_RECV, .verdict = true, .priority = 10 },
+                { .kind = TEST_RULE_RECV, .verdict = false, .priority = 20, .path = "/foo" },
+        };
+        static const TestRule rules_empty[] = {
+                { .kind = TEST_RULE_CONNECT, .verdict = true, .priority = 1 },
+        };
+        int r;
+
+        /* an unconditional catch-all allow outranking all other rules */
+        {
+                _c_cleanup_(policy_registry_freep) PolicyRegistry *registry = NULL;
+                _c_cleanup_(policy_snapshot_unrefp) PolicySnapshot *snapshot = NULL;
+
+                test_constant_snapshot(rules_allow, C_ARRAY_SIZE(rules_allow), &registry, &snapshot);
+                assert(snapshot->batch->own_constant == UTIL_TRISTATE_YES);
+                assert(snapshot->batch->send_constant == UTIL_TRISTATE_YES);
+                assert(snapshot->batch->recv_constant == UTIL_TRISTATE_YES);
+
+                r = policy_snapshot_check_own(snapshot, "com.example");
+                assert(!r);
+                r = test_check_send(snapshot, "com.example", "Foo", "/", DBUS_MESSAGE_TYPE_SIGNAL);
+                assert(!r);
+                r = policy_snapshot_check_receive(snapshot, NULL, "com.example", "Foo", "/", DBUS_MESSAGE_TYPE_SIGNAL, true, 0);
+                assert(!r);
+
+                /* constant verdicts bypass the cache */
+                assert(!snapshot->cache.n_misses && !snapshot->cache.n_entries);
+        }
+
+        /* an unconditional catch-all deny, via the catch-all own prefix */
+        {
+                _c_cleanup_(policy_registry_freep) PolicyRegistry *registry = NULL;
+                _c_cleanup_(policy_snapshot_unrefp) PolicySnapshot *snapshot = NULL;
+
+                test_constant_snapshot(rules_deny, C_ARRAY_SIZE(rules_deny), &registry, &snapshot);
+                assert(snapshot->batch->own_constant == UTIL_TRISTATE_NO);
+                assert(snapshot->batch->send_constant == UTIL_TRISTATE_NO);
+                assert(snapshot->batch->recv_constant == UTIL_TRISTATE_NO);
+
+                r = policy_snapshot_check_own(snapshot, "com.example");
+                assert(r == POLICY_E_ACCESS_DENIED);
+                r = test_check_send(snapshot, "com.example", "Foo", "/", DBUS_MESSAGE_TYPE_SIGNAL);
+                assert(r == POLICY_E_ACCESS_DENIED);
+                r = policy_snapshot_check_receive(snapshot, NULL, "com.example", "Foo", "/", DBUS_MESSAGE_TYPE_SIGNAL, true, 0);
+                assert(r == POLICY_E_ACCESS_DENIED);
+        }
+
+        /* a catch-all outranked by a conditional rule is not constant */
+        {
+                _c_cleanup_(policy_registry_freep) PolicyRegistry *registry = NULL;
+                _c_cleanup_(policy_snapshot_unrefp) PolicySnapshot *snapshot = NULL;
+
+                test_constant_snapshot(rules_outranked, C_ARRAY_SIZE(rules_outranked), &registry, &snapshot);
+                assert(snapshot->batch->own_constant == UTIL_TRISTATE_UNSET);
+                assert(snapshot->batch->send_constant == UTIL_TRISTATE_UNSET);
+                assert(snapshot->batch->recv_constant == UTIL_TRISTATE_UNSET);
+
+                r = policy_snapshot_check_own(snapshot, "com.example.foo");
+                assert(r == POLICY_E_ACCESS_DENIED);
+                r = policy_snapshot_check_own(snapshot, "org.example");
+                assert(!r);
+                r = test_check_send(snapshot, "com.example", "Foo", "/", DBUS_MESSAGE_TYPE_SIGNAL);
+                assert(r == POLICY_E_ACCESS_DENIED);
+                r = test_check_send(snapshot, "com.example", "Bar", "/", DBUS_MESSAGE_TYPE_SIGNAL);
+                assert(!r);
+                r = policy_snapshot_check_receive(snapshot, NULL, "com.example", "Foo", "/foo", DBUS_MESSAGE_TYPE_SIGNAL, true, 0);
+                assert(r == POLICY_E_ACCESS_DENIED);
+                r = policy_snapshot_check_receive(snapshot, NULL, "com.example", "Foo", "/bar", DBUS_MESSAGE_TYPE_SIGNAL, true, 0);
+                assert(!r);
+        }
+
+        /* a batch without own or xmit rules denies everything */
+        {
+                _c_cleanup_(policy_registry_freep) PolicyRegistry *registry = NULL;
+                _c_cleanup_(policy_snapshot_unrefp) PolicySnapshot *snapshot = NULL;
+
+                test_constant_snapshot(rules_empty, C_ARRAY_SIZE(rules_empty), &registry, &snapshot);
+                assert(snapshot->batch->own_constant == UTIL_TRISTATE_NO);
+                assert(snapshot->batch->send_constant == UTIL_TRISTATE_NO);
+                assert(snapshot->batch->recv_constant == UTIL_TRISTATE_NO);
+
+                r = policy_snapshot_check_connect(snapshot);
+                assert(!r);
+                r = policy_snapshot_check_own(snapshot, "com.example");
+                assert(r == POLICY_E_ACCESS_DENIED);
+                r = test_check_send(snapshot, "com.example", "Foo", "/", DBUS_MESSAGE_TYPE_SIGNAL);
+                assert(r == POLICY_E_ACCESS_DENIED);
+        }
+}
+
+static void test_constant_merge(void) {
+        static const TestRule rules_default[] = {
+                { .kind = TEST_RULE_SEND, .verdict = true, .priority = 10 },
+        };
+        static const TestRule rules_gid10[] = {
+                { .kind = TEST_RULE_SEND, .verdict = false, .priority = 20, .member = "Foo" },
+        };
+        static const TestRule rules_gid20[] = {
+                { .kind = TEST_RULE_CONNECT, .verdict = true, .priority = 1 },
+        };
+        static const TestRule rules_gid30[] = {
+                { .kind = TEST_RULE_SEND, .verdict = false, .priority = 30 },
+        };
+        static const TestBatch batches[] = {
+                TEST_BATCH(TEST_BATCH_DEFAULT, 0, 0, rules_default),
+                TEST_BATCH(TEST_BATCH_GID, 10, 10, rules_gid10),
+                TEST_BATCH(TEST_BATCH_GID, 20, 20, rules_gid20),
+                TEST_BATCH(TEST_BATCH_GID, 30, 30, rules_gid30),
+        };
+        static const uint32_t gids10[] = { 10 }, gids20[] = { 20 }, gids30[] = { 30 };
+        _c_cleanup_(policy_registry_freep) PolicyRegistry *registry = NULL;
+        _c_cleanup_(policy_snapshot_unrefp) PolicySnapshot *snapshot10 = NULL, *snapshot20 = NULL, *snapshot30 = NULL;
+        int r;
+
+        r = policy_registry_new(&registry, "label");
+        assert(!r);
+
+        test_import(registry, batches, C_ARRAY_SIZE(batches));
+        assert(registry->default_batch->send_constant == UTIL_TRISTATE_YES);
+
+        /* a conditional rule of a group outranks the catch-all of the default */
+        r = policy_snapshot_new(&snapshot10, registry, "label", 0, gids10, C_ARRAY_SIZE(gids10));
+        assert(!r);
+        assert(snapshot10->batch->send_constant == UTIL_TRISTATE_UNSET);
+
+        r = test_check_send(snapshot10, "com.example", "Foo", "/", DBUS_MESSAGE_TYPE_SIGNAL);
+        assert(r == POLICY_E_ACCESS_DENIED);
+        r = test_check_send(snapshot10, "com.example", "Bar", "/", DBUS_MESSAGE_TYPE_SIGNAL);
+        assert(!r);
+
+        /* a group without rules denies everything on its own, but not when merged */
+        r = policy_snapshot_new(&snapshot20, registry, "label", 0, gids20, C_ARRAY_SIZE(gids20));
+        assert(!r);
+        assert(snapshot20->batch->send_constant == UTIL_TRISTATE_YES);
+
+        r = test_check_send(snapshot20, "com.example", "Foo", "/", DBUS_MESSAGE_TYPE_SIGNAL);
+        assert(!r);
+
+        /* a catch-all of a group outranks the catch-all of the default */
+        r = policy_snapshot_new(&snapshot30, registry, "label", 0, gids30, C_ARRAY_SIZE(gids30));
+        assert(!r);
+        assert(snapshot30->batch->send_constant == UTIL_TRISTATE_NO);
+
+        r = test_check_send(snapshot30, "com.example", "Bar", "/", DBUS_MESSAGE_TYPE_SIGNAL);
+        assert(r == POLICY_E_ACCESS_DENIED);
+}
+
+static void test_constant_selinux(void) {
+        static const TestRule rules[] = {
+                { .kind = TEST_RULE_OWN, .verdict = true, .priority = 1 },
+                { .kind = TEST_RULE_SEND, .verdict = true, .priority = 1 },
+        };
+        _c_cleanup_(policy_registry_freep) PolicyRegistry *registry = NULL;
+        _c_cleanup_(policy_snapshot_unrefp) PolicySnapshot *snapshot = NULL;
+        unsigned int n_checks;
+        int r;
+
+        test_constant_snapshot(rules, C_ARRAY_SIZE(rules), &registry, &snapshot);
+        assert(snapshot->batch->own_constant == UTIL_TRISTATE_YES);
+        assert(snapshot->batch->send_constant == UTIL_TRISTATE_YES);
+
+        /* constant verdicts still consult SELinux first */
+        n_checks = test_selinux_n_checks;
+        test_selinux_deny = true;
+
+        r = policy_snapshot_check_own(snapshot, "com.example");
+        assert(r == POLICY_E_SELINUX_ACCESS_DENIED);
+        r = test_check_send(snapshot, "com.example", "Foo", "/", DBUS_MESSAGE_TYPE_SIGNAL);
+        assert(r == POLICY_E_SELINUX_ACCESS_DENIED);
+        assert(test_selinux_n_checks == n_checks + 2);
+
+        test_selinux_deny = false;
+
+        r = policy_snapshot_check_own(snapshot, "com.example");
+        assert(!r);
+        r = test_check_send(snapshot, "com.example", "Foo", "/", DBUS_MESSAGE_TYPE_SIGNAL);
+        assert(!r);
+        assert(test_selinux_n_checks == n_checks + 4);
+}
+
+int main(int argc, char **argv) {
+        test_setup();
+        test_cache();
+        test_intern();
+        test_eviction();
+        test_cache_path();
+        test_xmit_buckets();
+        test_merge();
+        test_constant();
+        test_constant_merge();
+        test_constant_selinux();
+        return 0;
+}
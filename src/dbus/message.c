@@ -10,23 +10,51 @@
 #include <stdlib.h>
 #include "dbus/message.h"
 #include "dbus/protocol.h"
+#include "dbus/signature.h"
 #include "util/error.h"
 #include "util/fdlist.h"
+#include "util/hash.h"
 #include "util/log.h"
+#include "util/pool.h"
+
+/*
+ * Messages are allocated together with their payload. Hence, we keep one pool
+ * per size class of the payload, and only fall back to malloc(3) for big
+ * messages. Outgoing messages carry their payload separately and use the
+ * first size class.
+ */
+#define MESSAGE_POOL(_x, _n) POOL_INIT(_x, sizeof(Message) + (_n))
+static Pool message_pools[] = {
+        MESSAGE_POOL(message_pools[0], 0),
+        MESSAGE_POOL(message_pools[1], 256),
+        MESSAGE_POOL(message_pools[2], 512),
+        MESSAGE_POOL(message_pools[3], 1024),
+        MESSAGE_POOL(message_pools[4], 2048),
+        MESSAGE_POOL(message_pools[5], 4096),
+};
+
+/* body-signatures of incoming messages, see message_parse_body() */
+static SignatureCache message_signatures = SIGNATURE_CACHE_INIT(message_signatures);
 
 static_assert(_DBUS_MESSAGE_FIELD_N <= 8 * sizeof(unsigned int), "Header fields exceed bitmap");
 
 static int message_new(Message **messagep, bool big_endian, size_t n_extra) {
         _c_cleanup_(message_unrefp) Message *message = NULL;
+        Pool *pool;
 
         static_assert(alignof(message->extra) >= 8,
                       "Message payload has insufficient alignment");
 
-        message = malloc(sizeof(*message) + c_align8(n_extra));
+        pool = pool_select(message_pools,
+                           C_ARRAY_SIZE(message_pools),
+                           sizeof(*message) + c_align8(n_extra));
+
+        message = pool_alloc(pool, sizeof(*message) + c_align8(n_extra));
         if (!message)
                 return error_origin(-ENOMEM);
 
         *message = (Message)MESSAGE_INIT(big_endian);
+        message->pool = pool;
 
         *messagep = message;
         message = NULL;
@@ -125,8 +153,10 @@ void message_free(_Atomic unsigned long *n_refs, void *userdata) {
 
         if (message->allocated_data)
                 free(message->data);
+        if (message->metadata.args != message->args)
+                free(message->metadata.args);
         fdlist_free(message->fds);
-        free(message);
+        pool_free(message->pool, message);
 }
 
 static int message_parse_header(Message *message, MessageMetadata *metadata) {
@@ -344,28 +374,37 @@ static int message_parse_header(Message *message, MessageMetadata *metadata) {
 
 static int message_parse_body(Message *message, MessageMetadata *metadata) {
         _c_cleanup_(c_dvar_deinit) CDVar v = C_DVAR_INIT;
-        const char *signature = metadata->fields.signature;
-        size_t i, n_signature, n_types;
-        CDVarType *t, *types;
+        const CDVarType *t, *types;
+        size_t i, n_types, n_args;
         int r;
 
         /*
-         * Parse body-signature into CDVarType array. We use a single array
-         * with all the argument-types concatenated.
+         * Fetch the CDVarType array of the body-signature. This is a single
+         * array with all the argument-types concatenated. Only a handful of
+         * distinct signatures are used in practice, so we cache them.
          */
 
-        n_signature = strlen(signature);
-        assert(n_signature < 256);
-        types = alloca(n_signature * sizeof(CDVarType));
-        n_types = 0;
+        r = signature_cache_lookup(&message_signatures, metadata->fields.signature, &types, &n_types);
+        if (r)
+                return (r == SIGNATURE_E_INVALID) ? MESSAGE_E_INVALID_HEADER : error_fold(r);
 
-        for (i = 0; i < n_signature; i += types[i].length) {
-                t = types + i;
-                r = c_dvar_type_new_from_signature(&t, signature + i, n_signature - i);
-                if (r)
-                        return r < 0 ? error_origin(r) : MESSAGE_E_INVALID_HEADER;
+        /*
+         * Size the argument cache to cover the last string/path argument.
+         * Most messages fit into the small inline array of the message, only
+         * messages with string arguments at higher positions need a separate
+         * allocation.
+         */
 
-                ++n_types;
+        for (i = 0, t = types, n_args = 0; i < n_types && i < MESSAGE_ARGS_MAX; ++i, t += t->length)
+                if (t->element == 's' || t->element == 'o')
+                        n_args = i + 1;
+
+        if (n_args > C_ARRAY_SIZE(message->args)) {
+                metadata->args = calloc(n_args, sizeof(*metadata->args));
+                if (!metadata->args)
+                        return error_origin(-ENOMEM);
+        } else {
+                metadata->args = message->args;
         }
 
         /*
@@ -380,7 +419,7 @@ static int message_parse_body(Message *message, MessageMetadata *metadata) {
                 switch (t->element) {
                 case 's':
                 case 'o':
-                        if (i < C_ARRAY_SIZE(metadata->args)) {
+                        if (i < n_args) {
                                 metadata->args[i].element = t->element;
                                 c_dvar_read(&v, (char[2]){ t->element, 0 }, &metadata->args[i].value);
                                 metadata->n_args = i + 1;
@@ -448,6 +487,16 @@ int message_parse_metadata(Message *message) {
         if (message->fds)
                 fdlist_truncate(message->fds, message->metadata.fields.unix_fds);
 
+        /*
+         * Broadcasts are looked up in the match registry by their path,
+         * interface and member. Hash them once here, so every lookup of this
+         * message can reuse them.
+         */
+        message->metadata.hashes.path = hash_string(message->metadata.fields.path);
+        message->metadata.hashes.interface = hash_string(message->metadata.fields.interface);
+        message->metadata.hashes.member = hash_string(message->metadata.fields.member);
+        message->metadata.hashes.valid = true;
+
         message->parsed = true;
         return 0;
 }
@@ -654,3 +703,13 @@ void message_log_append(Message *message, Log *log) {
                 log_appendf(log, "DBUS_BROKER_MESSAGE_TYPE=%u\n", message->metadata.header.type);
         }
 }
+
+/**
+ * message_flush_signatures() - flush signature cache
+ *
+ * This releases all cached body-signatures of incoming messages. They are
+ * rebuilt on demand.
+ */
+void message_flush_signatures(void) {
+        signature_cache_flush(&message_signatures);
+}
@@ -15,10 +15,18 @@ typedef struct Log Log;
 typedef struct Message Message;
 typedef struct MessageHeader MessageHeader;
 typedef struct MessageMetadata MessageMetadata;
+typedef struct MessageMetadataArg MessageMetadataArg;
+typedef struct Pool Pool;
 
 /* max message size; taken from spec */
 #define MESSAGE_SIZE_MAX (128UL * 1024UL * 1024UL)
 
+/* max number of cached body arguments; see message_parse_body() */
+#define MESSAGE_ARGS_MAX (64)
+
+/* number of cached body arguments stored inline in a message */
+#define MESSAGE_ARGS_INLINE (4)
+
 /* max patch buffer size; see message_stitch_sender() */
 #define MESSAGE_PATCH_MAX (C_ALIGN_TO(1 + 3 + 4 + ADDRESS_ID_STRING_MAX + 1, 8))
 
@@ -31,6 +39,11 @@ enum {
         MESSAGE_E_INVALID_BODY,
 };
 
+struct MessageMetadataArg {
+        char element;
+        const void *value;
+};
+
 struct MessageMetadata {
         struct {
                 uint8_t type;
@@ -54,10 +67,15 @@ struct MessageMetadata {
                 uint32_t unix_fds;
         } fields;
 
+        /* hashes of @fields, for match registry lookups */
         struct {
-                char element;
-                const void *value;
-        } args[64];
+                bool valid;
+                uint64_t path;
+                uint64_t interface;
+                uint64_t member;
+        } hashes;
+
+        MessageMetadataArg *args;
         size_t n_args;
 };
 
@@ -72,6 +90,7 @@ struct Message {
         bool allocated_data : 1;
         bool parsed : 1;
 
+        Pool *pool;
         FDList *fds;
 
         size_t n_data;
@@ -85,6 +104,7 @@ struct Message {
         void *body;
 
         void *original_sender;
+        MessageMetadataArg args[MESSAGE_ARGS_INLINE];
         struct iovec vecs[4];
         alignas(8) uint8_t patch[MESSAGE_PATCH_MAX];
         alignas(8) uint8_t extra[];
@@ -115,6 +135,8 @@ void message_stitch_sender(Message *message, uint64_t sender_id);
 
 void message_log_append(Message *message, Log *log);
 
+void message_flush_signatures(void);
+
 /* inline helpers */
 
 /**
@@ -8,6 +8,17 @@
 #include "util/fdlist.h"
 #include "util/error.h"
 
+static void iqueue_discard_segment(IQueue *iq) {
+        assert(iq->n_segments);
+
+        fdlist_free(iq->segments[0].fds);
+        user_charge_deinit(&iq->segments[0].charge_fds);
+
+        memmove(iq->segments,
+                iq->segments + 1,
+                --iq->n_segments * sizeof(*iq->segments));
+}
+
 /**
  * iqueue_init() - XXX
  */
@@ -23,6 +34,7 @@ void iqueue_deinit(IQueue *iq) {
         iqueue_flush(iq);
 
         assert(!iq->fds);
+        assert(!iq->n_segments);
         assert(!iq->pending.data);
         assert(!iq->pending.fds);
 
@@ -49,6 +61,9 @@ void iqueue_flush(IQueue *iq) {
         iq->data_cursor = 0;
         iq->fds = fdlist_free(iq->fds);
 
+        while (iq->n_segments)
+                iqueue_discard_segment(iq);
+
         iq->pending.data = NULL;
         iq->pending.n_data = 0;
         iq->pending.n_copied = 0;
@@ -101,8 +116,10 @@ int iqueue_get_cursor(IQueue *iq,
                       void **bufferp,
                       size_t **fromp,
                       size_t *top,
+                      size_t *n_segmentsp,
                       FDList ***fdsp,
                       UserCharge **charge_fdsp) {
+        size_t i;
         void *p;
         int r;
 
@@ -122,6 +139,8 @@ int iqueue_get_cursor(IQueue *iq,
                 iq->data_end - iq->data_start);
         iq->data_cursor -= iq->data_start;
         iq->data_end -= iq->data_start;
+        for (i = 0; i < iq->n_segments; ++i)
+                iq->segments[i].end -= iq->data_start;
         iq->data_start = 0;
 
         /*
@@ -204,6 +223,7 @@ int iqueue_get_cursor(IQueue *iq,
                 *bufferp = iq->pending.data;
                 *fromp = &iq->pending.n_copied;
                 *top = iq->pending.n_data;
+                *n_segmentsp = 1;
                 *fdsp = &iq->pending.fds;
                 *charge_fdsp = &iq->pending.charge_fds;
                 return 0;
@@ -217,20 +237,50 @@ int iqueue_get_cursor(IQueue *iq,
          * incoming messages we may have in the buffer at once.
          *
          * Note that the kernel always breaks recvmsg() calls after an SKB with
-         * file-descriptor payload. Hence, this could be improvded with
-         * recvmmsg() so we get multiple messages at all cost. However, FD
-         * passing is no fast-path and should never be, so there is little
-         * reason to resort to recvmmsg() (which would be non-trivial, anyway,
-         * since we would need multiple input buffers).
+         * file-descriptor payload. Hence, we allow the caller to split the
+         * cursor into up to IQUEUE_SEGMENT_MAX segments (e.g., to fetch them
+         * via a single recvmmsg() call). Every time the caller moves on to
+         * the next segment, it must call iqueue_cut_segment(), so any FDs
+         * received so far stay attached to the last byte of their segment,
+         * rather than the last byte of the input buffer.
+         * Since we never read while there is unparsed data, no segment can be
+         * left over from a previous read.
          */
+        assert(!iq->n_segments);
+
         *bufferp = iq->data;
         *fromp = &iq->data_end;
         *top = (iq->data_size - iq->data_end) > IQUEUE_RECV_MAX ? iq->data_end + IQUEUE_RECV_MAX : iq->data_size;
+        *n_segmentsp = C_ARRAY_SIZE(iq->segments) + 1;
         *fdsp = &iq->fds;
         *charge_fdsp = &iq->charge_fds;
         return 0;
 }
 
+/**
+ * iqueue_cut_segment() - XXX
+ */
+void iqueue_cut_segment(IQueue *iq) {
+        IQueueSegment *segment;
+
+        /*
+         * Segments are only needed to remember where FDs were received. If
+         * the current segment did not carry any FDs, it can simply be merged
+         * with the following one.
+         */
+        if (!iq->fds)
+                return;
+
+        assert(iq->n_segments < C_ARRAY_SIZE(iq->segments));
+
+        segment = &iq->segments[iq->n_segments++];
+        segment->end = iq->data_end;
+        segment->fds = iq->fds;
+        segment->charge_fds = iq->charge_fds;
+        iq->fds = NULL;
+        iq->charge_fds = (UserCharge)USER_CHARGE_INIT;
+}
+
 /**
  * iqueue_pop_line() - XXX
  */
@@ -256,6 +306,9 @@ int iqueue_pop_line(IQueue *iq, const char **linep, size_t *np) {
                  * and the DBus spec clearly states that no extension shall
                  * pass FDs during authentication.
                  */
+                while (iq->n_segments && iq->segments[0].end <= iq->data_cursor + 1)
+                        iqueue_discard_segment(iq);
+
                 if (iq->data_cursor + 1 >= iq->data_end) {
                         iq->fds = fdlist_free(iq->fds);
                         user_charge_deinit(&iq->charge_fds);
@@ -343,7 +396,21 @@ int iqueue_pop_data(IQueue *iq, FDList **fdsp) {
          * a single message (all FDs must be transferred in a single shot). It
          * is, thus, a protocol violation if there are multiple FDsets for a
          * single message.
+         *
+         * If the input-queue was filled in several segments, the same applies
+         * to the last byte of each segment.
          */
+        while (_c_unlikely_(iq->n_segments && iq->segments[0].end <= iq->data_start)) {
+                if (_c_unlikely_(iq->pending.fds))
+                        return IQUEUE_E_VIOLATION;
+
+                iq->pending.fds = iq->segments[0].fds;
+                iq->pending.charge_fds = iq->segments[0].charge_fds;
+                iq->segments[0].fds = NULL;
+                iq->segments[0].charge_fds = (UserCharge)USER_CHARGE_INIT;
+                iqueue_discard_segment(iq);
+        }
+
         if (_c_unlikely_(!n_data && iq->fds)) {
                 if (_c_unlikely_(iq->pending.fds))
                         return IQUEUE_E_VIOLATION;
@@ -11,9 +11,11 @@
 #include "util/user.h"
 
 typedef struct IQueue IQueue;
+typedef struct IQueueSegment IQueueSegment;
 
 #define IQUEUE_LINE_MAX (16UL * 1024UL) /* taken from dbus-daemon(1) */
 #define IQUEUE_RECV_MAX (2UL * 1024UL) /* based on average message size */
+#define IQUEUE_SEGMENT_MAX (4UL) /* number of FD-delimited segments per read */
 
 enum {
         _IQUEUE_E_SUCCESS,
@@ -23,6 +25,12 @@ enum {
         IQUEUE_E_VIOLATION,
 };
 
+struct IQueueSegment {
+        UserCharge charge_fds;
+        size_t end;
+        FDList *fds;
+};
+
 struct IQueue {
         User *user;
 
@@ -35,6 +43,9 @@ struct IQueue {
         size_t data_cursor;
         FDList *fds;
 
+        size_t n_segments;
+        IQueueSegment segments[IQUEUE_SEGMENT_MAX - 1];
+
         struct {
                 UserCharge charge_data;
                 UserCharge charge_fds;
@@ -78,8 +89,10 @@ int iqueue_get_cursor(IQueue *iq,
                       void **bufferp,
                       size_t **fromp,
                       size_t *top,
+                      size_t *n_segmentsp,
                       FDList ***fdsp,
                       UserCharge **charge_fdsp);
+void iqueue_cut_segment(IQueue *iq);
 
 int iqueue_pop_line(IQueue *iq, const char **linep, size_t *np);
 int iqueue_pop_data(IQueue *iq, FDList **fds);
@@ -0,0 +1,143 @@
+/*
+ * D-Bus Signature Cache
+ *
+ * Parsing a message body requires the CDVarType representation of its
+ * signature. Building it is cheap, but not free, and it is done for every
+ * single message. Real-world traffic only ever uses a small set of distinct
+ * signatures, though. Hence, this cache maps signature strings to their
+ * pre-built type arrays.
+ *
+ * The cache is bounded by @max_entries. Entries are kept in LRU order, and
+ * the least recently used entry is evicted whenever a new one is needed. A
+ * returned type array is only valid until the next lookup on the same cache.
+ */
+
+#include <c-dvar.h>
+#include <c-dvar-type.h>
+#include <c-list.h>
+#include <c-macro.h>
+#include <c-rbtree.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dbus/signature.h"
+#include "util/error.h"
+
+static int signature_cache_entry_compare(CRBTree *tree, void *k, CRBNode *rb) {
+        SignatureCacheEntry *entry = c_container_of(rb, SignatureCacheEntry, cache_node);
+
+        return strcmp(k, entry->signature);
+}
+
+static void signature_cache_entry_free(SignatureCache *cache, SignatureCacheEntry *entry) {
+        c_rbnode_unlink(&entry->cache_node);
+        c_list_unlink(&entry->lru_link);
+        --cache->n_entries;
+        free(entry);
+}
+
+static int signature_cache_entry_new(SignatureCacheEntry **entryp, const char *signature) {
+        _c_cleanup_(c_freep) SignatureCacheEntry *entry = NULL;
+        size_t i, n_signature;
+        CDVarType *t;
+        int r;
+
+        n_signature = strlen(signature);
+        entry = malloc(sizeof(*entry) + n_signature * sizeof(CDVarType) + n_signature + 1);
+        if (!entry)
+                return error_origin(-ENOMEM);
+
+        entry->cache_node = (CRBNode)C_RBNODE_INIT(entry->cache_node);
+        entry->lru_link = (CList)C_LIST_INIT(entry->lru_link);
+        entry->signature = (char *)(entry->types + n_signature);
+        entry->n_types = 0;
+        memcpy(entry->signature, signature, n_signature + 1);
+
+        /*
+         * Parse the signature into a single array with all the argument-types
+         * concatenated, just like the body parser expects it.
+         */
+        for (i = 0; i < n_signature; i += entry->types[i].length) {
+                t = entry->types + i;
+                r = c_dvar_type_new_from_signature(&t, signature + i, n_signature - i);
+                if (r)
+                        return r < 0 ? error_origin(r) : SIGNATURE_E_INVALID;
+
+                ++entry->n_types;
+        }
+
+        *entryp = entry;
+        entry = NULL;
+        return 0;
+}
+
+/**
+ * signature_cache_lookup() - look up type array of a signature
+ * @cache:              cache to operate on
+ * @signature:          signature to look up
+ * @typesp:             output argument for the type array
+ * @n_typesp:           output argument for the number of types
+ *
+ * This looks up the CDVarType array of @signature, building and caching it if
+ * it is not cached yet. The array contains all argument types of @signature,
+ * concatenated. It is owned by the cache and stays valid until the next call
+ * on @cache.
+ *
+ * Return: 0 on success, SIGNATURE_E_INVALID if @signature is invalid, or a
+ *         negative error code on failure.
+ */
+int signature_cache_lookup(SignatureCache *cache,
+                           const char *signature,
+                           const CDVarType **typesp,
+                           size_t *n_typesp) {
+        SignatureCacheEntry *entry;
+        CRBNode *parent, **slot;
+        int r;
+
+        entry = c_rbtree_find_entry(&cache->entry_tree,
+                                    signature_cache_entry_compare,
+                                    signature,
+                                    SignatureCacheEntry,
+                                    cache_node);
+        if (entry) {
+                ++cache->n_hits;
+                c_list_unlink(&entry->lru_link);
+                c_list_link_front(&cache->lru_list, &entry->lru_link);
+        } else {
+                ++cache->n_misses;
+
+                r = signature_cache_entry_new(&entry, signature);
+                if (r)
+                        return error_trace(r);
+
+                if (cache->n_entries && cache->n_entries >= cache->max_entries)
+                        signature_cache_entry_free(cache,
+                                                   c_list_last_entry(&cache->lru_list,
+                                                                     SignatureCacheEntry,
+                                                                     lru_link));
+
+                slot = c_rbtree_find_slot(&cache->entry_tree, signature_cache_entry_compare, signature, &parent);
+                assert(slot);
+                c_rbtree_add(&cache->entry_tree, parent, slot, &entry->cache_node);
+                c_list_link_front(&cache->lru_list, &entry->lru_link);
+                ++cache->n_entries;
+        }
+
+        *typesp = entry->types;
+        *n_typesp = entry->n_types;
+        return 0;
+}
+
+/**
+ * signature_cache_flush() - drop all cached entries
+ * @cache:              cache to operate on
+ *
+ * This releases all entries of @cache. The counters are left untouched.
+ */
+void signature_cache_flush(SignatureCache *cache) {
+        SignatureCacheEntry *entry, *safe;
+
+        c_list_for_each_entry_safe(entry, safe, &cache->lru_list, lru_link)
+                signature_cache_entry_free(cache, entry);
+
+        assert(!cache->n_entries);
+}
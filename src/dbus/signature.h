@@ -0,0 +1,52 @@
+#pragma once
+
+/*
+ * D-Bus Signature Cache
+ */
+
+#include <c-dvar.h>
+#include <c-list.h>
+#include <c-macro.h>
+#include <c-rbtree.h>
+#include <stdlib.h>
+
+typedef struct SignatureCache SignatureCache;
+typedef struct SignatureCacheEntry SignatureCacheEntry;
+
+#define SIGNATURE_CACHE_MAX (1024UL)
+
+enum {
+        _SIGNATURE_E_SUCCESS,
+
+        SIGNATURE_E_INVALID,
+};
+
+struct SignatureCacheEntry {
+        CRBNode cache_node;
+        CList lru_link;
+        char *signature;
+        size_t n_types;
+        CDVarType types[];
+};
+
+struct SignatureCache {
+        CRBTree entry_tree;
+        CList lru_list;
+        size_t n_entries;
+        size_t max_entries;
+
+        uint64_t n_hits;
+        uint64_t n_misses;
+};
+
+#define SIGNATURE_CACHE_INIT(_x) {                              \
+                .entry_tree = C_RBTREE_INIT,                    \
+                .lru_list = C_LIST_INIT((_x).lru_list),         \
+                .max_entries = SIGNATURE_CACHE_MAX,             \
+        }
+
+int signature_cache_lookup(SignatureCache *cache,
+                           const char *signature,
+                           const CDVarType **typesp,
+                           size_t *n_typesp);
+void signature_cache_flush(SignatureCache *cache);
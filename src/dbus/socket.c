@@ -25,11 +25,13 @@
 #include "dbus/socket.h"
 #include "util/error.h"
 #include "util/fdlist.h"
+#include "util/pool.h"
 #include "util/user.h"
 
 struct SocketBuffer {
         CList link;
         UserCharge charges[2];
+        Pool *pool;
 
         size_t n_total;
         Message *message;
@@ -39,6 +41,15 @@ struct SocketBuffer {
         struct iovec vecs[];
 };
 
+/*
+ * Every queued message needs its own socket buffer, for every receiver. We
+ * cache them in a pool, so broadcasts do not cause one malloc(3) per
+ * receiver. Line buffers are only used during authentication. They share the
+ * pool if they fit, otherwise they are allocated directly.
+ */
+static Pool socket_buffer_pool = POOL_INIT(socket_buffer_pool,
+                                           sizeof(SocketBuffer) + sizeof(((Message *)NULL)->vecs));
+
 static char *socket_buffer_get_base(SocketBuffer *buffer) {
         return (char *)(buffer->vecs + buffer->n_vecs);
 }
@@ -51,7 +62,7 @@ static SocketBuffer *socket_buffer_free(SocketBuffer *buffer) {
         user_charge_deinit(&buffer->charges[0]);
         c_list_unlink(&buffer->link);
         message_unref(buffer->message);
-        free(buffer);
+        pool_free(buffer->pool, buffer);
 
         return NULL;
 }
@@ -60,14 +71,20 @@ C_DEFINE_CLEANUP(SocketBuffer *, socket_buffer_free);
 
 static int socket_buffer_new_internal(SocketBuffer **bufferp, size_t n_vecs, size_t n_line) {
         SocketBuffer *buffer;
+        size_t n;
+        Pool *pool;
 
-        buffer = malloc(sizeof(*buffer) + n_vecs * sizeof(*buffer->vecs) + n_line);
+        n = sizeof(*buffer) + n_vecs * sizeof(*buffer->vecs) + n_line;
+        pool = pool_select(&socket_buffer_pool, 1, n);
+
+        buffer = pool_alloc(pool, n);
         if (!buffer)
                 return error_origin(-ENOMEM);
 
         buffer->link = (CList)C_LIST_INIT(buffer->link);
         user_charge_init(&buffer->charges[0]);
         user_charge_init(&buffer->charges[1]);
+        buffer->pool = pool;
         buffer->n_total = n_line;
         buffer->message = NULL;
         buffer->n_vecs = n_vecs;
@@ -185,6 +202,38 @@ static bool socket_buffer_consume(SocketBuffer *buffer, size_t n) {
         return socket_buffer_is_consumed(buffer);
 }
 
+static size_t socket_buffer_get_remaining(SocketBuffer *buffer) {
+        struct iovec *vec;
+        size_t n = 0;
+
+        for (vec = buffer->writer ?: buffer->vecs; vec < buffer->vecs + buffer->n_vecs; ++vec)
+                n += vec->iov_len;
+
+        return n;
+}
+
+static size_t socket_buffer_get_vecs(SocketBuffer *buffer, struct iovec *vecs, size_t n_vecs, size_t *n_bytesp) {
+        struct iovec *vec;
+        size_t n = 0, n_bytes = 0;
+
+        /*
+         * Copy all remaining, non-empty vectors of @buffer into @vecs. If
+         * they do not fit, nothing is copied and 0 is returned.
+         */
+        for (vec = buffer->writer ?: buffer->vecs; vec < buffer->vecs + buffer->n_vecs; ++vec) {
+                if (!vec->iov_len)
+                        continue;
+                if (n >= n_vecs)
+                        return 0;
+
+                vecs[n++] = *vec;
+                n_bytes += vec->iov_len;
+        }
+
+        *n_bytesp = n_bytes;
+        return n;
+}
+
 static void socket_discard_input(Socket *socket) {
         iqueue_flush(&socket->in.queue);
         socket->in.message = message_unref(socket->in.message);
@@ -217,6 +266,23 @@ void socket_init(Socket *socket, User *user, int fd) {
         iqueue_init(&socket->in.queue, user);
 }
 
+/**
+ * socket_set_write_limits() - set limits for coalesced writes
+ * @socket:             socket to operate on
+ * @max_vecs:           maximum number of I/O vectors per write
+ * @max_bytes:          maximum number of bytes per write
+ *
+ * Consecutive queued messages without FDs are coalesced into a single
+ * write, as long as the write does not exceed @max_vecs I/O vectors, nor
+ * @max_bytes bytes. A single message is always written in one go,
+ * regardless of the limits. @max_vecs is capped at SOCKET_WRITE_VECS_MAX.
+ * Passing 1 as @max_vecs effectively disables coalescing.
+ */
+void socket_set_write_limits(Socket *socket, size_t max_vecs, size_t max_bytes) {
+        socket->out.max_vecs = c_max(c_min(max_vecs, SOCKET_WRITE_VECS_MAX), 1UL);
+        socket->out.max_bytes = max_bytes;
+}
+
 /**
  * socket_deinit() - deinitialize socket
  * @socket:             socket to operate on
@@ -236,6 +302,7 @@ void socket_deinit(Socket *socket) {
 
         while ((buffer = c_list_first_entry(&socket->out.pending, SocketBuffer, link)))
                 socket_buffer_free(buffer);
+        socket->out.n_pending = 0;
 
         assert(c_list_is_empty(&socket->out.pending));
         assert(c_list_is_empty(&socket->out.queue));
@@ -507,74 +574,31 @@ int socket_queue(Socket *socket, User *user, Message *message) {
         return 0;
 }
 
-static int socket_recvmsg(Socket *socket,
-                          void *buffer,
-                          size_t *from,
-                          size_t to,
-                          FDList **fdsp,
-                          UserCharge *charge_fds) {
-        union {
-                struct cmsghdr cmsg;
-                char buffer[CMSG_SPACE(sizeof(int) * SOCKET_FD_MAX)];
-        } control;
+static void socket_discard_fds(struct msghdr *msg) {
         struct cmsghdr *cmsg;
-        struct msghdr msg;
-        int r, *fds = NULL;
-        size_t n_fds = 0;
-        ssize_t l;
-
-        assert(to > *from);
+        size_t n_fds;
+        int *fds;
 
-        msg = (struct msghdr){
-                .msg_iov = &(struct iovec){
-                        .iov_base = buffer + *from,
-                        .iov_len = to - *from,
-                },
-                .msg_iovlen = 1,
-                .msg_control = &control,
-                .msg_controllen = sizeof(control),
-        };
-
-        l = recvmsg(socket->fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
-        if (_c_unlikely_(!l)) {
-                /*
-                 * A 0 return of recvmsg() signals end-of-file. Hence, hangup
-                 * the input side, but keep the output alive. We might still
-                 * want to flush more data out.
-                 */
-                socket_hangup_input(socket);
-                return SOCKET_E_LOST_INTEREST;
-        } else if (_c_unlikely_(l < 0)) {
-                switch (errno) {
-                case EAGAIN:
-                        return 0;
-                case ECOMM:
-                case ECONNABORTED:
-                case ECONNRESET:
-                case EHOSTDOWN:
-                case EHOSTUNREACH:
-                case EIO:
-                case ENOBUFS:
-                case ENOMEM:
-                case EPIPE:
-                case EPROTO:
-                case EREMOTEIO:
-                case ESHUTDOWN:
-                case ETIMEDOUT:
-                        /*
-                         * If recvmsg(2) fails, this means both read-side *and*
-                         * write-side are shutdown. A mere read-side hangup is
-                         * signalled by a 0 return-value (handled above).
-                         */
-                        socket_hangup_input(socket);
-                        socket_hangup_output(socket);
-                        return SOCKET_E_LOST_INTEREST;
+        for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+                if (cmsg->cmsg_level == SOL_SOCKET &&
+                    cmsg->cmsg_type == SCM_RIGHTS) {
+                        fds = (void *)CMSG_DATA(cmsg);
+                        n_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                        while (n_fds)
+                                close(fds[--n_fds]);
                 }
-
-                return error_origin(-errno);
         }
+}
+
+static int socket_recvmsg_fds(Socket *socket,
+                              struct msghdr *msg,
+                              FDList **fdsp,
+                              UserCharge *charge_fds) {
+        struct cmsghdr *cmsg;
+        int r, *fds = NULL;
+        size_t n_fds = 0;
 
-        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
                 if (cmsg->cmsg_level == SOL_SOCKET &&
                     cmsg->cmsg_type == SCM_RIGHTS) {
                         /*
@@ -588,7 +612,7 @@ static int socket_recvmsg(Socket *socket,
                 }
         }
 
-        if (msg.msg_flags & MSG_CTRUNC) {
+        if (msg->msg_flags & MSG_CTRUNC) {
                 /*
                  * This flag means the control-buffer was too small to retrieve
                  * all data. If this can be triggered remotely, it means a peer
@@ -664,8 +688,7 @@ static int socket_recvmsg(Socket *socket,
                 }
         }
 
-        *from += l;
-        return SOCKET_E_PREEMPTED;
+        return 0;
 
 error:
         while (n_fds)
@@ -673,9 +696,126 @@ error:
         return r;
 }
 
+static int socket_recvmsg(Socket *socket,
+                          void *buffer,
+                          size_t *from,
+                          size_t to,
+                          size_t n_segments,
+                          FDList **fdsp,
+                          UserCharge *charge_fds) {
+        union {
+                struct cmsghdr cmsg;
+                char buffer[CMSG_SPACE(sizeof(int) * SOCKET_FD_MAX)];
+        } control[IQUEUE_SEGMENT_MAX];
+        struct mmsghdr msgs[IQUEUE_SEGMENT_MAX];
+        struct iovec vecs[IQUEUE_SEGMENT_MAX];
+        size_t i, n_vec;
+        int r, n_msgs;
+
+        assert(to > *from);
+        assert(n_segments > 0);
+
+        /*
+         * The kernel breaks recvmsg(2) calls after each SKB that carries FDs.
+         * To avoid one syscall per FD-carrying message, we split the cursor
+         * into up to @n_segments equally sized segments and fetch them all
+         * via a single recvmmsg(2) call. Each segment is filled by a separate
+         * recvmsg(2) invocation in the kernel, so each segment carries at
+         * most one FD-set, attached to its last byte. Note that segments
+         * without FDs are filled entirely by the kernel, so a stream of
+         * FD-free messages is still fetched in one go.
+         */
+        n_segments = c_min(n_segments, IQUEUE_SEGMENT_MAX);
+        n_segments = c_min(n_segments, to - *from);
+        n_vec = (to - *from) / n_segments;
+
+        for (i = 0; i < n_segments; ++i) {
+                vecs[i] = (struct iovec){
+                        .iov_base = buffer + *from + i * n_vec,
+                        .iov_len = (i + 1 < n_segments) ? n_vec : (to - *from - i * n_vec),
+                };
+                msgs[i] = (struct mmsghdr){
+                        .msg_hdr = {
+                                .msg_iov = &vecs[i],
+                                .msg_iovlen = 1,
+                                .msg_control = &control[i],
+                                .msg_controllen = sizeof(control[i]),
+                        },
+                };
+        }
+
+        n_msgs = recvmmsg(socket->fd, msgs, n_segments, MSG_DONTWAIT | MSG_CMSG_CLOEXEC, NULL);
+        if (_c_unlikely_(n_msgs < 0)) {
+                switch (errno) {
+                case EAGAIN:
+                        return 0;
+                case ECOMM:
+                case ECONNABORTED:
+                case ECONNRESET:
+                case EHOSTDOWN:
+                case EHOSTUNREACH:
+                case EIO:
+                case ENOBUFS:
+                case ENOMEM:
+                case EPIPE:
+                case EPROTO:
+                case EREMOTEIO:
+                case ESHUTDOWN:
+                case ETIMEDOUT:
+                        /*
+                         * If recvmsg(2) fails, this means both read-side *and*
+                         * write-side are shutdown. A mere read-side hangup is
+                         * signalled by a 0 return-value (handled below).
+                         */
+                        socket_hangup_input(socket);
+                        socket_hangup_output(socket);
+                        return SOCKET_E_LOST_INTEREST;
+                }
+
+                return error_origin(-errno);
+        } else if (_c_unlikely_(!n_msgs || !msgs[0].msg_len)) {
+                /*
+                 * A 0 return of recvmsg() signals end-of-file. Hence, hangup
+                 * the input side, but keep the output alive. We might still
+                 * want to flush more data out.
+                 */
+                socket_hangup_input(socket);
+                return SOCKET_E_LOST_INTEREST;
+        }
+
+        /*
+         * A 0-length segment following other data signals end-of-file. We
+         * stop there and let the next read detect the hangup, so all data
+         * fetched so far is dispatched first.
+         */
+        for (i = 0; i < (size_t)n_msgs && msgs[i].msg_len; ++i) {
+                if (i > 0) {
+                        /*
+                         * Segments are always fetched into the input buffer.
+                         * Close the previous segment, so its FDs stay
+                         * attached to its last byte, and then move the data
+                         * right behind it.
+                         */
+                        iqueue_cut_segment(&socket->in.queue);
+                        memmove(buffer + *from, vecs[i].iov_base, msgs[i].msg_len);
+                }
+
+                r = socket_recvmsg_fds(socket, &msgs[i].msg_hdr, fdsp, charge_fds);
+                if (r) {
+                        while (++i < (size_t)n_msgs)
+                                socket_discard_fds(&msgs[i].msg_hdr);
+                        return r;
+                }
+
+                *from += msgs[i].msg_len;
+        }
+
+        return SOCKET_E_PREEMPTED;
+}
+
 static int socket_dispatch_read(Socket *socket) {
         UserCharge *charge_fds;
-        size_t *from, to;
+        size_t *from, to, n_segments;
         FDList **fds;
         void *buffer;
         int r;
@@ -687,10 +827,16 @@ static int socket_dispatch_read(Socket *socket) {
                               &buffer,
                               &from,
                               &to,
+                              &n_segments,
                               &fds,
                               &charge_fds);
         if (r == IQUEUE_E_PENDING) {
-                return 0;
+                /*
+                 * The caller has not consumed all buffered input yet (e.g.,
+                 * because it ran out of dispatch budget). Keep the event, so
+                 * we read again once the input queue is drained.
+                 */
+                return SOCKET_E_PREEMPTED;
         } else if (r == IQUEUE_E_QUOTA ||
                    r == IQUEUE_E_VIOLATION) {
                 socket_close(socket);
@@ -703,6 +849,7 @@ static int socket_dispatch_read(Socket *socket) {
                               buffer,
                               from,
                               to,
+                              n_segments,
                               fds,
                               charge_fds);
 }
@@ -710,47 +857,90 @@ static int socket_dispatch_read(Socket *socket) {
 static int socket_dispatch_write(Socket *socket) {
         SocketBuffer *buffer, *safe;
         struct mmsghdr msgs[SOCKET_MMSG_MAX];
+        struct iovec vecs[SOCKET_WRITE_VECS_MAX];
+        size_t n_buffers[SOCKET_MMSG_MAX];
+        size_t i, j, n, n_vecs, n_bytes, n_msg_bytes;
         struct msghdr *msg;
-        int r, i, v, n_msgs;
+        int r, v, n_msgs;
+        size_t n_fds;
+        bool fds;
 
         if (!c_list_is_empty(&socket->out.pending)) {
                 r = ioctl(socket->fd, SIOCOUTQ, &v);
                 if (r < 0)
                         return error_origin(-errno);
 
-                if (v > 0) /* treat like EAGAIN */
-                        return 0;
-
-                c_list_for_each_entry_safe(buffer, safe, &socket->out.pending, link)
-                        socket_buffer_free(buffer);
+                if (v > 0) {
+                        /* treat like EAGAIN, if we cannot pipeline more FDs */
+                        if (socket->out.n_pending >= SOCKET_FD_INFLIGHT_MAX)
+                                return 0;
+                } else {
+                        c_list_for_each_entry_safe(buffer, safe, &socket->out.pending, link)
+                                socket_buffer_free(buffer);
 
-                socket_might_reset(socket);
+                        socket->out.n_pending = 0;
+                        socket_might_reset(socket);
+                }
         }
 
         if (socket->hup_out)
                 return SOCKET_E_LOST_INTEREST;
 
+        /*
+         * Every msghdr passed to the kernel ends up as (at least) one skb on
+         * the receiving socket. Hence, we coalesce the vectors of consecutive
+         * buffers into a single msghdr, as long as none of them carries FDs,
+         * and the configured limits are not exceeded. Buffers with FDs always
+         * get a msghdr of their own, so their FDs are attached to their data
+         * only.
+         */
         n_msgs = 0;
+        n_vecs = 0;
+        n_msg_bytes = 0;
+        n_fds = socket->out.n_pending;
+        msg = NULL;
         c_list_for_each_entry(buffer, &socket->out.queue, link) {
-                msg = &msgs[n_msgs].msg_hdr;
+                fds = buffer->message &&
+                      buffer->message->fds &&
+                      socket_buffer_is_uncomsumed(buffer);
+
+                n = socket_buffer_get_vecs(buffer,
+                                           vecs + n_vecs,
+                                           C_ARRAY_SIZE(vecs) - n_vecs,
+                                           &n_bytes);
+                if (!n)
+                        break;
 
-                msg->msg_name = NULL;
-                msg->msg_namelen = 0;
-                msg->msg_iov = buffer->vecs;
-                msg->msg_iovlen = buffer->n_vecs;
-                if (buffer->message &&
-                    buffer->message->fds &&
-                    socket_buffer_is_uncomsumed(buffer)) {
-                        msg->msg_control = buffer->message->fds->cmsg;
-                        msg->msg_controllen = buffer->message->fds->cmsg->cmsg_len;
-                } else {
-                        msg->msg_control = NULL;
-                        msg->msg_controllen = 0;
+                if (!msg ||
+                    fds ||
+                    msg->msg_control ||
+                    msg->msg_iovlen + n > socket->out.max_vecs ||
+                    n_msg_bytes + n_bytes > socket->out.max_bytes) {
+                        if (n_msgs >= (ssize_t)C_ARRAY_SIZE(msgs))
+                                break;
+
+                        msg = &msgs[n_msgs].msg_hdr;
+                        msg->msg_name = NULL;
+                        msg->msg_namelen = 0;
+                        msg->msg_iov = vecs + n_vecs;
+                        msg->msg_iovlen = 0;
+                        if (fds) {
+                                msg->msg_control = buffer->message->fds->cmsg;
+                                msg->msg_controllen = buffer->message->fds->cmsg->cmsg_len;
+                        } else {
+                                msg->msg_control = NULL;
+                                msg->msg_controllen = 0;
+                        }
+                        msg->msg_flags = 0;
+
+                        n_buffers[n_msgs++] = 0;
+                        n_msg_bytes = 0;
                 }
-                msg->msg_flags = 0;
 
-                if (++n_msgs >= (ssize_t)C_ARRAY_SIZE(msgs))
-                        break;
+                msg->msg_iovlen += n;
+                n_vecs += n;
+                n_msg_bytes += n_bytes;
+                ++n_buffers[n_msgs - 1];
 
                 /*
                  * Right now, the only information the kernel gives us about
@@ -758,24 +948,34 @@ static int socket_dispatch_write(Socket *socket) {
                  * is, a boolean state. There is some other data, but we cannot
                  * reliable deduce any useful state from it.
                  *
-                 * Hence, we only ever queue at most 1 message with FDs on it.
-                 * This way, we can reliably get notified about FDs being
-                 * queued and dequeued.
+                 * Hence, we cannot tell which of the messages with FDs on
+                 * them were dequeued by the client, until the entire queue is
+                 * drained. Instead, we keep all of them on the pending list,
+                 * including their FD charges, until the kernel reports an
+                 * empty queue, and then release them all at once. Hence, the
+                 * accounting never under-estimates the FDs held in-flight on
+                 * behalf of the client.
                  *
-                 * We could, technically, avoid this and just spam out
-                 * messages. However, we better be notified as early as
-                 * possible about dequeued FDs, so our accounting actually
-                 * represents the real client-controlled state. If we were
-                 * notified late (because we continued queueing), then a client
-                 * might have dequeued the FDs at fault, but we still consider
-                 * them queued and thus might exceed its quota.
+                 * To bound how late the client is credited, we pipeline at
+                 * most SOCKET_FD_INFLIGHT_MAX messages with FDs. Once the
+                 * limit is reached, we stop writing until the queue is
+                 * drained.
                  */
-                if (buffer->message && fdlist_count(buffer->message->fds))
+                if (buffer->message &&
+                    fdlist_count(buffer->message->fds) &&
+                    ++n_fds >= SOCKET_FD_INFLIGHT_MAX)
                         break;
         }
 
+        /*
+         * If there is nothing to write, but buffers with FDs are still
+         * in-flight, we must stay interested in EPOLLOUT, so they are
+         * released once the receiver drained its queue.
+         */
         if (!n_msgs)
-                return SOCKET_E_LOST_INTEREST;
+                return c_list_is_empty(&socket->out.pending) ? SOCKET_E_LOST_INTEREST : 0;
+
+        ++socket->out.n_syscalls;
 
         n_msgs = sendmmsg(socket->fd, msgs, n_msgs, MSG_DONTWAIT | MSG_NOSIGNAL);
         if (n_msgs < 0) {
@@ -833,23 +1033,44 @@ static int socket_dispatch_write(Socket *socket) {
                 return error_origin(-errno);
         }
 
+        socket->out.n_msgs += n_msgs;
+
+        /*
+         * Distribute the written bytes of each msghdr across its buffers, in
+         * order. If a msghdr was written partially, the remaining buffers of
+         * it are left untouched.
+         */
         i = 0;
+        j = 0;
+        n = msgs[0].msg_len;
         c_list_for_each_entry_safe(buffer, safe, &socket->out.queue, link) {
-                if (i >= n_msgs)
+                if (i >= (size_t)n_msgs)
                         break;
 
-                if (socket_buffer_consume(buffer, msgs[i].msg_len)) {
+                n_bytes = c_min(n, socket_buffer_get_remaining(buffer));
+                n -= n_bytes;
+
+                if (n_bytes && socket_buffer_consume(buffer, n_bytes)) {
+                        ++socket->out.n_buffers;
+
                         if (buffer->message && buffer->message->fds) {
                                 c_list_unlink(&buffer->link);
                                 c_list_link_tail(&socket->out.pending, &buffer->link);
+                                ++socket->out.n_pending;
                         } else {
                                 socket_buffer_free(buffer);
                         }
                 }
 
-                ++i;
+                if (++j >= n_buffers[i]) {
+                        assert(!n);
+
+                        j = 0;
+                        if (++i < (size_t)n_msgs)
+                                n = msgs[i].msg_len;
+                }
         }
-        assert(i == n_msgs);
+        assert(i == (size_t)n_msgs);
 
         if (c_list_is_empty(&socket->out.queue)) {
                 if (_c_unlikely_(socket->shutdown))
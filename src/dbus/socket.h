@@ -18,6 +18,9 @@ typedef struct SocketBuffer SocketBuffer;
 #define SOCKET_LINE_PREALLOC (64UL) /* fits the longest sane SASL exchange */
 #define SOCKET_FD_MAX (253UL) /* taken from kernel SCM_MAX_FD */
 #define SOCKET_MMSG_MAX (16) /* randomly picked, no tuning done so far */
+#define SOCKET_WRITE_VECS_MAX (1024UL) /* taken from kernel UIO_MAXIOV */
+#define SOCKET_WRITE_BYTES_DEFAULT (128UL * 1024UL) /* fits default SO_SNDBUF */
+#define SOCKET_FD_INFLIGHT_MAX (16UL) /* max messages with FDs in-flight */
 
 enum {
         _SOCKET_E_SUCCESS,
@@ -52,6 +55,14 @@ struct Socket {
         struct SocketOut {
                 CList queue;
                 CList pending;
+                size_t n_pending;
+
+                size_t max_vecs;
+                size_t max_bytes;
+
+                uint64_t n_syscalls;
+                uint64_t n_msgs;
+                uint64_t n_buffers;
         } out;
 };
 
@@ -60,10 +71,13 @@ struct Socket {
                 .in.queue = IQUEUE_NULL((_x).in.queue),                 \
                 .out.queue = C_LIST_INIT((_x).out.queue),               \
                 .out.pending = C_LIST_INIT((_x).out.pending),           \
+                .out.max_vecs = SOCKET_WRITE_VECS_MAX,                  \
+                .out.max_bytes = SOCKET_WRITE_BYTES_DEFAULT,            \
         }
 
 void socket_init(Socket *socket, User *user, int fd);
 void socket_deinit(Socket *socket);
+void socket_set_write_limits(Socket *socket, size_t max_vecs, size_t max_bytes);
 
 int socket_dequeue_line(Socket *socket, const char **linep, size_t *np);
 int socket_dequeue(Socket *socket, Message **messagep);
@@ -36,7 +36,7 @@ static void test_in_special(void) {
         {
                 static const char blob[] = TEST_32k;
                 UserCharge *charge_fds;
-                size_t n, total, *from, to;
+                size_t n, total, *from, to, n_segments;
                 const char *l;
                 void *buffer;
                 FDList **fds;
@@ -47,6 +47,7 @@ static void test_in_special(void) {
                                               &buffer,
                                               &from,
                                               &to,
+                                              &n_segments,
                                               &fds,
                                               &charge_fds);
                         if (r == IQUEUE_E_VIOLATION)
@@ -95,7 +96,7 @@ static void test_in_special(void) {
         {
                 char data[128];
                 UserCharge *charge_fds;
-                size_t *from, to;
+                size_t *from, to, n_segments;
                 void *buffer;
                 FDList **fds, *f;
 
@@ -104,6 +105,7 @@ static void test_in_special(void) {
                                       &buffer,
                                       &from,
                                       &to,
+                                      &n_segments,
                                       &fds,
                                       &charge_fds);
                 assert(!r);
@@ -119,6 +121,7 @@ static void test_in_special(void) {
                                       &buffer,
                                       &from,
                                       &to,
+                                      &n_segments,
                                       &fds,
                                       &charge_fds);
                 assert(r == IQUEUE_E_PENDING);
@@ -143,6 +146,7 @@ static void test_in_special(void) {
                                       &buffer,
                                       &from,
                                       &to,
+                                      &n_segments,
                                       &fds,
                                       &charge_fds);
                 assert(!r);
@@ -184,7 +188,7 @@ static void test_in_special(void) {
         {
                 char data[128];
                 UserCharge *charge_fds;
-                size_t *from, to;
+                size_t *from, to, n_segments;
                 void *buffer;
                 FDList **fds, *f;
 
@@ -193,6 +197,7 @@ static void test_in_special(void) {
                                       &buffer,
                                       &from,
                                       &to,
+                                      &n_segments,
                                       &fds,
                                       &charge_fds);
                 assert(!r);
@@ -221,6 +226,97 @@ static void test_in_special(void) {
                 assert(fdlist_get(f, 0) == 0);
                 fdlist_free(f);
         }
+
+        iqueue_deinit(&iq);
+        iqueue_init(&iq, NULL);
+
+        /*
+         * Test segmented receival. We push two 1-byte segments with 1 FD each
+         * via a single cursor, separated by iqueue_cut_segment(). Then verify
+         * that each byte is retrieved with its own FD.
+         */
+        {
+                char data[128];
+                UserCharge *charge_fds;
+                size_t *from, to, n_segments;
+                void *buffer;
+                FDList **fds, *f;
+
+                r = iqueue_get_cursor(&iq,
+                                      &buffer,
+                                      &from,
+                                      &to,
+                                      &n_segments,
+                                      &fds,
+                                      &charge_fds);
+                assert(!r);
+                assert(to - *from >= 128);
+                assert(n_segments == IQUEUE_SEGMENT_MAX);
+
+                /* push in 1 byte with 1 fd as first segment */
+                memcpy(buffer + *from, (char [1]){}, 1);
+                *from += 1;
+                r = fdlist_new_with_fds(fds, (int [1]){}, 1);
+                assert(!r);
+
+                /* push in 1 byte with 1 fd as second segment */
+                iqueue_cut_segment(&iq);
+                assert(!*fds);
+
+                memcpy(buffer + *from, (char [1]){}, 1);
+                *from += 1;
+                r = fdlist_new_with_fds(fds, (int [1]){ 1 }, 1);
+                assert(!r);
+
+                /* fetch 1 byte target and verify it got the first fd */
+                r = iqueue_set_target(&iq, data, 1);
+                assert(!r);
+
+                r = iqueue_pop_data(&iq, &f);
+                assert(!r);
+                assert(fdlist_count(f) == 1);
+                assert(fdlist_get(f, 0) == 0);
+                fdlist_free(f);
+
+                /* fetch 1 byte target and verify it got the second fd */
+                r = iqueue_set_target(&iq, data, 1);
+                assert(!r);
+
+                r = iqueue_pop_data(&iq, &f);
+                assert(!r);
+                assert(fdlist_count(f) == 1);
+                assert(fdlist_get(f, 0) == 1);
+                fdlist_free(f);
+
+                /* push two segments again, but fetch both in one target */
+                r = iqueue_get_cursor(&iq,
+                                      &buffer,
+                                      &from,
+                                      &to,
+                                      &n_segments,
+                                      &fds,
+                                      &charge_fds);
+                assert(!r);
+
+                memcpy(buffer + *from, (char [1]){}, 1);
+                *from += 1;
+                r = fdlist_new_with_fds(fds, (int [1]){}, 1);
+                assert(!r);
+
+                iqueue_cut_segment(&iq);
+
+                memcpy(buffer + *from, (char [1]){}, 1);
+                *from += 1;
+                r = fdlist_new_with_fds(fds, (int [1]){ 1 }, 1);
+                assert(!r);
+
+                /* a single message must not carry two FD-sets */
+                r = iqueue_set_target(&iq, data, 2);
+                assert(!r);
+
+                r = iqueue_pop_data(&iq, &f);
+                assert(r == IQUEUE_E_VIOLATION);
+        }
 }
 
 static void test_in_lines(void) {
@@ -289,7 +385,7 @@ static void test_in_lines(void) {
                         /* push random chunk from @send into @iq */
                         {
                                 UserCharge *charge_fds;
-                                size_t *from, to;
+                                size_t *from, to, n_segments;
                                 void *buffer;
                                 FDList **fds;
 
@@ -297,6 +393,7 @@ static void test_in_lines(void) {
                                                       &buffer,
                                                       &from,
                                                       &to,
+                                                      &n_segments,
                                                       &fds,
                                                       &charge_fds);
                                 assert(!r);
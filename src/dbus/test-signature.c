@@ -0,0 +1,88 @@
+/*
+ * Test D-Bus Signature Cache
+ */
+
+#include <c-dvar.h>
+#include <c-macro.h>
+#include <stdlib.h>
+#include "dbus/signature.h"
+
+static void test_setup(void) {
+        SignatureCache cache = SIGNATURE_CACHE_INIT(cache);
+
+        signature_cache_flush(&cache);
+        assert(!cache.n_entries);
+}
+
+static void test_lookup(void) {
+        SignatureCache cache = SIGNATURE_CACHE_INIT(cache);
+        const CDVarType *types1, *types2;
+        size_t n_types1, n_types2;
+        int r;
+
+        r = signature_cache_lookup(&cache, "sa{sv}as", &types1, &n_types1);
+        assert(!r);
+        assert(n_types1 == 3);
+        assert(types1[0].element == 's');
+        assert(types1[1].element == 'a');
+        assert(types1[1 + types1[1].length].element == 'a');
+        assert(cache.n_misses == 1 && cache.n_hits == 0);
+
+        r = signature_cache_lookup(&cache, "sa{sv}as", &types2, &n_types2);
+        assert(!r);
+        assert(types2 == types1);
+        assert(n_types2 == n_types1);
+        assert(cache.n_misses == 1 && cache.n_hits == 1);
+
+        r = signature_cache_lookup(&cache, "", &types2, &n_types2);
+        assert(!r);
+        assert(n_types2 == 0);
+        assert(cache.n_entries == 2);
+
+        r = signature_cache_lookup(&cache, "a{", &types2, &n_types2);
+        assert(r == SIGNATURE_E_INVALID);
+        assert(cache.n_entries == 2);
+
+        signature_cache_flush(&cache);
+}
+
+static void test_eviction(void) {
+        SignatureCache cache = SIGNATURE_CACHE_INIT(cache);
+        const CDVarType *types;
+        size_t n_types;
+        int r;
+
+        cache.max_entries = 2;
+
+        r = signature_cache_lookup(&cache, "s", &types, &n_types);
+        assert(!r);
+        r = signature_cache_lookup(&cache, "u", &types, &n_types);
+        assert(!r);
+
+        /* refresh "s", so "u" is the least recently used entry */
+        r = signature_cache_lookup(&cache, "s", &types, &n_types);
+        assert(!r);
+
+        r = signature_cache_lookup(&cache, "o", &types, &n_types);
+        assert(!r);
+        assert(cache.n_entries == 2);
+        assert(cache.n_misses == 3 && cache.n_hits == 1);
+
+        r = signature_cache_lookup(&cache, "s", &types, &n_types);
+        assert(!r);
+        assert(cache.n_misses == 3 && cache.n_hits == 2);
+
+        r = signature_cache_lookup(&cache, "u", &types, &n_types);
+        assert(!r);
+        assert(cache.n_misses == 4 && cache.n_hits == 2);
+        assert(cache.n_entries == 2);
+
+        signature_cache_flush(&cache);
+}
+
+int main(int argc, char **argv) {
+        test_setup();
+        test_lookup();
+        test_eviction();
+        return 0;
+}
@@ -9,6 +9,7 @@
 #include <sys/socket.h>
 #include "dbus/message.h"
 #include "dbus/socket.h"
+#include "util/fdlist.h"
 
 static void test_setup(void) {
         _c_cleanup_(socket_deinit) Socket server = SOCKET_NULL(server), client = SOCKET_NULL(client);
@@ -91,9 +92,292 @@ static void test_message(void) {
         assert(memcmp(message1->header, message2->header, sizeof(header)) == 0);
 }
 
+static void test_fds(void) {
+        _c_cleanup_(socket_deinit) Socket server = SOCKET_NULL(server);
+        MessageHeader header = {
+                .endian = 'l',
+        };
+        union {
+                struct cmsghdr cmsg;
+                char buffer[CMSG_SPACE(sizeof(int))];
+        } control;
+        struct cmsghdr *cmsg;
+        struct msghdr msg;
+        Message *message;
+        int pair[2], r, fd;
+        size_t i;
+
+        r = socketpair(AF_UNIX, SOCK_STREAM, 0, pair);
+        assert(r >= 0);
+
+        socket_init(&server, NULL, pair[1]);
+
+        /*
+         * Send a sequence of messages that each carry a single FD. The kernel
+         * breaks reads after each of them, but we expect a single dispatch
+         * to fetch all of them, and correctly attribute each FD to its own
+         * message.
+         */
+        for (i = 0; i < IQUEUE_SEGMENT_MAX; ++i) {
+                fd = dup(pair[0]);
+                assert(fd >= 0);
+
+                msg = (struct msghdr){
+                        .msg_iov = &(struct iovec){
+                                .iov_base = &header,
+                                .iov_len = sizeof(header),
+                        },
+                        .msg_iovlen = 1,
+                        .msg_control = &control,
+                        .msg_controllen = sizeof(control),
+                };
+                cmsg = CMSG_FIRSTHDR(&msg);
+                cmsg->cmsg_level = SOL_SOCKET;
+                cmsg->cmsg_type = SCM_RIGHTS;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+                memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+                r = sendmsg(pair[0], &msg, MSG_NOSIGNAL);
+                assert(r == sizeof(header));
+                close(fd);
+        }
+
+        r = socket_dispatch(&server, EPOLLIN);
+        assert(r == SOCKET_E_PREEMPTED);
+
+        for (i = 0; i < IQUEUE_SEGMENT_MAX; ++i) {
+                r = socket_dequeue(&server, &message);
+                assert(!r && message);
+                assert(fdlist_count(message->fds) == 1);
+                message_unref(message);
+        }
+
+        r = socket_dequeue(&server, &message);
+        assert(!r && !message);
+
+        close(pair[0]);
+}
+
+static void test_coalesce(void) {
+        _c_cleanup_(socket_deinit) Socket client = SOCKET_NULL(client), server = SOCKET_NULL(server);
+        MessageHeader header = {
+                .endian = 'l',
+        };
+        Message *message;
+        int pair[2], r;
+        size_t i;
+
+        r = socketpair(AF_UNIX, SOCK_STREAM, 0, pair);
+        assert(r >= 0);
+
+        socket_init(&client, NULL, pair[0]);
+        socket_init(&server, NULL, pair[1]);
+
+        /*
+         * Queue a batch of messages without FDs. We expect them to be written
+         * with a single msghdr. Then limit the number of vectors per write,
+         * and expect one msghdr per message.
+         */
+        for (i = 0; i < 8; ++i) {
+                r = message_new_incoming(&message, header);
+                assert(!r);
+
+                r = socket_queue(&client, NULL, message);
+                assert(!r);
+
+                message_unref(message);
+        }
+
+        r = socket_dispatch(&client, EPOLLOUT);
+        assert(r == SOCKET_E_LOST_INTEREST);
+        assert(client.out.n_syscalls == 1);
+        assert(client.out.n_msgs == 1);
+        assert(client.out.n_buffers == 8);
+
+        socket_set_write_limits(&client, 1, SOCKET_WRITE_BYTES_DEFAULT);
+
+        for (i = 0; i < 8; ++i) {
+                r = message_new_incoming(&message, header);
+                assert(!r);
+
+                r = socket_queue(&client, NULL, message);
+                assert(!r);
+
+                message_unref(message);
+        }
+
+        r = socket_dispatch(&client, EPOLLOUT);
+        assert(r == SOCKET_E_LOST_INTEREST);
+        assert(client.out.n_syscalls == 2);
+        assert(client.out.n_msgs == 9);
+        assert(client.out.n_buffers == 16);
+
+        r = socket_dispatch(&server, EPOLLIN);
+        assert(!r || r == SOCKET_E_PREEMPTED);
+
+        for (i = 0; i < 16; ++i) {
+                r = socket_dequeue(&server, &message);
+                assert(!r && message);
+                assert(!memcmp(message->header, &header, sizeof(header)));
+                message_unref(message);
+        }
+}
+
+static void test_fds_pipeline(void) {
+        _c_cleanup_(socket_deinit) Socket client = SOCKET_NULL(client), server = SOCKET_NULL(server);
+        MessageHeader header = {
+                .endian = 'l',
+        };
+        Message *message;
+        int pair[2], r, fd;
+        size_t i;
+
+        r = socketpair(AF_UNIX, SOCK_STREAM, 0, pair);
+        assert(r >= 0);
+
+        socket_init(&client, NULL, pair[0]);
+        socket_init(&server, NULL, pair[1]);
+
+        /*
+         * Queue more messages with FDs than can be in-flight. We expect the
+         * first batch to be written right away, and the rest only after the
+         * receiver drained its queue. The FDs stay pinned until then.
+         */
+        for (i = 0; i < SOCKET_FD_INFLIGHT_MAX + 1; ++i) {
+                r = message_new_incoming(&message, header);
+                assert(!r);
+
+                fd = dup(pair[0]);
+                assert(fd >= 0);
+
+                r = fdlist_new_consume_fds(&message->fds, &fd, 1);
+                assert(!r);
+
+                r = socket_queue(&client, NULL, message);
+                assert(!r);
+
+                message_unref(message);
+        }
+
+        r = socket_dispatch(&client, EPOLLOUT);
+        assert(!r);
+        assert(client.out.n_msgs == SOCKET_FD_INFLIGHT_MAX);
+        assert(client.out.n_pending == SOCKET_FD_INFLIGHT_MAX);
+
+        r = socket_dispatch(&client, EPOLLOUT);
+        assert(!r);
+        assert(client.out.n_msgs == SOCKET_FD_INFLIGHT_MAX);
+
+        for (i = 0; i < SOCKET_FD_INFLIGHT_MAX; ++i) {
+                r = socket_dispatch(&server, EPOLLIN);
+                assert(!r || r == SOCKET_E_PREEMPTED);
+
+                r = socket_dequeue(&server, &message);
+                assert(!r && message);
+                assert(fdlist_count(message->fds) == 1);
+                message_unref(message);
+        }
+
+        r = socket_dispatch(&client, EPOLLOUT);
+        assert(!r);
+        assert(client.out.n_msgs == SOCKET_FD_INFLIGHT_MAX + 1);
+        assert(client.out.n_pending == 1);
+
+        r = socket_dispatch(&server, EPOLLIN);
+        assert(!r || r == SOCKET_E_PREEMPTED);
+
+        r = socket_dequeue(&server, &message);
+        assert(!r && message);
+        assert(fdlist_count(message->fds) == 1);
+        message_unref(message);
+
+        r = socket_dispatch(&client, EPOLLOUT);
+        assert(r == SOCKET_E_LOST_INTEREST);
+        assert(client.out.n_pending == 0);
+}
+
+static void test_fds_partial(void) {
+        _c_cleanup_(socket_deinit) Socket client = SOCKET_NULL(client);
+        MessageHeader header = {
+                .endian = 'l',
+        };
+        union {
+                struct cmsghdr cmsg;
+                char buffer[CMSG_SPACE(sizeof(int))];
+        } control;
+        struct msghdr msg;
+        Message *message;
+        int pair[2], r, fd;
+        size_t i;
+
+        r = socketpair(AF_UNIX, SOCK_STREAM, 0, pair);
+        assert(r >= 0);
+
+        socket_init(&client, NULL, pair[0]);
+
+        for (i = 0; i < 4; ++i) {
+                r = message_new_incoming(&message, header);
+                assert(!r);
+
+                fd = dup(pair[0]);
+                assert(fd >= 0);
+
+                r = fdlist_new_consume_fds(&message->fds, &fd, 1);
+                assert(!r);
+
+                r = socket_queue(&client, NULL, message);
+                assert(!r);
+
+                message_unref(message);
+        }
+
+        r = socket_dispatch(&client, EPOLLOUT);
+        assert(!r);
+        assert(client.out.n_pending == 4);
+
+        /*
+         * Let the receiver drain only some of the messages. Nothing is left
+         * to write, but the remaining FDs are still in-flight, so the socket
+         * must stay interested in EPOLLOUT until they were drained as well.
+         */
+        for (i = 0; i < 4; ++i) {
+                msg = (struct msghdr){
+                        .msg_iov = &(struct iovec){
+                                .iov_base = &header,
+                                .iov_len = sizeof(header),
+                        },
+                        .msg_iovlen = 1,
+                        .msg_control = &control,
+                        .msg_controllen = sizeof(control),
+                };
+
+                r = recvmsg(pair[1], &msg, MSG_CMSG_CLOEXEC);
+                assert(r == sizeof(header));
+                assert(CMSG_FIRSTHDR(&msg));
+
+                memcpy(&fd, CMSG_DATA(CMSG_FIRSTHDR(&msg)), sizeof(int));
+                close(fd);
+
+                r = socket_dispatch(&client, EPOLLOUT);
+                if (i < 3) {
+                        assert(!r);
+                        assert(client.out.n_pending == 4);
+                } else {
+                        assert(r == SOCKET_E_LOST_INTEREST);
+                        assert(client.out.n_pending == 0);
+                }
+        }
+
+        close(pair[1]);
+}
+
 int main(int argc, char **argv) {
         test_setup();
         test_line();
         test_message();
+        test_fds();
+        test_coalesce();
+        test_fds_pipeline();
+        test_fds_partial();
         return 0;
 }
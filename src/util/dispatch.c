@@ -40,6 +40,23 @@
  *               You must explicitly clear events once you handled them. The
  *               kernel never tells us about falling edges, so we must detect
  *               them manually (usually via EAGAIN).
+ *
+ * To avoid a single busy file starving all others, the context carries a
+ * per-round budget (@budget_items and @budget_bytes). Callbacks are expected
+ * to account their work via dispatch_file_consume(), and once
+ * dispatch_file_has_budget() returns false, stop and put the file back via
+ * dispatch_file_yield(). The file is then dispatched again in the next round,
+ * after all other ready files had their turn. A budget of 0 means unlimited.
+ *
+ * Furthermore, every file belongs to a priority class (see
+ * dispatch_file_set_priority()). Each class has its own ready-list, and
+ * higher classes are dispatched first in every round. This lets the
+ * controller and connecting peers overtake bulk traffic, without starving
+ * it, since all ready files are still dispatched once per round.
+ *
+ * The context records the time every file waits from being queued on its
+ * ready-list until it is dispatched in @wait_metrics. Its quantiles show how
+ * long a ready peer is delayed by the other peers.
  */
 
 #include <c-list.h>
@@ -49,6 +66,7 @@
 #include <sys/epoll.h>
 #include "util/dispatch.h"
 #include "util/error.h"
+#include "util/metrics.h"
 
 /**
  * dispatch_file_init() - initialize dispatch file
@@ -101,6 +119,7 @@ int dispatch_file_init(DispatchFile *file,
         file->ready_link = (CList)C_LIST_INIT(file->ready_link);
         file->fn = fn;
         file->fd = fd;
+        file->priority = DISPATCH_PRIORITY_BULK;
         file->user_mask = 0;
         file->kernel_mask = mask;
         file->events = events;
@@ -172,8 +191,7 @@ void dispatch_file_select(DispatchFile *file, uint32_t mask) {
         assert(!(mask & ~file->kernel_mask));
 
         file->user_mask |= mask;
-        if ((file->user_mask & file->events) && !c_list_is_linked(&file->ready_link))
-                c_list_link_tail(&file->context->ready_list, &file->ready_link);
+        dispatch_file_schedule(file);
 }
 
 /**
@@ -209,6 +227,45 @@ void dispatch_file_clear(DispatchFile *file, uint32_t mask) {
                 c_list_unlink(&file->ready_link);
 }
 
+/**
+ * dispatch_file_yield() - yield with events pending
+ * @file:               dispatch file
+ * @mask:               event mask
+ *
+ * This marks the events in @mask as signalled, as if the kernel signalled
+ * them, and queues @file for the next dispatch round. This is meant for
+ * callbacks that stop handling an event before they saw EAGAIN (e.g., because
+ * their budget is exhausted, see dispatch_file_has_budget()), but might have
+ * cleared the event already.
+ */
+void dispatch_file_yield(DispatchFile *file, uint32_t mask) {
+        assert(!(mask & ~file->kernel_mask));
+
+        file->events |= mask;
+        dispatch_file_schedule(file);
+}
+
+/**
+ * dispatch_file_set_priority() - change priority class
+ * @file:               dispatch file
+ * @priority:           new priority class
+ *
+ * This moves @file into the priority class @priority. If @file is currently
+ * queued, it is re-queued at the tail of its new class.
+ */
+void dispatch_file_set_priority(DispatchFile *file, unsigned int priority) {
+        assert(priority < _DISPATCH_PRIORITY_N);
+
+        if (file->priority == priority)
+                return;
+
+        file->priority = priority;
+        if (c_list_is_linked(&file->ready_link)) {
+                c_list_unlink(&file->ready_link);
+                c_list_link_tail(&file->context->ready_lists[priority], &file->ready_link);
+        }
+}
+
 /**
  * dispatch_context_init() - initialize dispatch context
  * @ctx:                dispatch context
@@ -239,7 +296,7 @@ int dispatch_context_init(DispatchContext *ctx) {
  */
 void dispatch_context_deinit(DispatchContext *ctx) {
         assert(!ctx->n_files);
-        assert(c_list_is_empty(&ctx->ready_list));
+        assert(!dispatch_context_is_ready(ctx));
 
         ctx->epoll_fd = c_close(ctx->epoll_fd);
 }
@@ -292,8 +349,7 @@ int dispatch_context_poll(DispatchContext *ctx, int timeout) {
                 assert(f->context == ctx);
 
                 f->events |= e->events & f->kernel_mask;
-                if ((f->events & f->user_mask) && !c_list_is_linked(&f->ready_link))
-                        c_list_link_tail(&f->context->ready_list, &f->ready_link);
+                dispatch_file_schedule(f);
         }
 
         return 0;
@@ -307,6 +363,11 @@ int dispatch_context_poll(DispatchContext *ctx, int timeout) {
  * dispatches all pending events and calls into the callbacks of the respective
  * dispatch-file.
  *
+ * Files are dispatched in order of their priority class, and in FIFO order
+ * within each class. Every file that is ready when the round starts is
+ * dispatched exactly once, regardless of its class. Hence, higher classes
+ * always go first, but lower classes cannot be starved.
+ *
  * The first non-zero return code of any dispatch-file callback will break the
  * loop and cause a propagation of that error code to the caller.
  *
@@ -314,40 +375,64 @@ int dispatch_context_poll(DispatchContext *ctx, int timeout) {
  *         dispatched file stops dispatching and is returned unmodified.
  */
 int dispatch_context_dispatch(DispatchContext *ctx) {
-        CList todo = (CList)C_LIST_INIT(todo);
+        CList todo[_DISPATCH_PRIORITY_N];
         DispatchFile *file;
+        uint64_t now;
+        size_t i, j;
         int r;
 
-        r = dispatch_context_poll(ctx, c_list_is_empty(&ctx->ready_list) ? -1 : 0);
+        r = dispatch_context_poll(ctx, dispatch_context_is_ready(ctx) ? 0 : -1);
         if (r)
                 return error_fold(r);
 
         /*
-         * We want to dispatch @ctx->ready_list exactly once here. The trivial
+         * We want to dispatch @ctx->ready_lists exactly once here. The trivial
          * approach would be to iterate it via c_list_for_each(). However, we
          * want to allow callbacks to modify their event masks, so we must
          * allow them to add and remove files arbitrarily. At the same time, we
          * want to prevent dispatching a single file twice, so we must make
          * sure to detect detach+reattach cycles to avoid starvation.
          *
-         * Therefore, we simply fetch the entire ready-list into @todo and
-         * handle it one-by-one, moving them back onto the ready-list. This is
-         * safe against entry-removal in the callbacks, and it has a clearly
-         * determined runtime.
+         * Therefore, we simply fetch the entire ready-lists into @todo and
+         * handle them one-by-one, highest class first, moving them back onto
+         * the ready-lists. This is safe against entry-removal in the
+         * callbacks, and it has a clearly determined runtime.
          */
-        c_list_swap(&todo, &ctx->ready_list);
+        for (i = 0; i < _DISPATCH_PRIORITY_N; ++i) {
+                todo[i] = (CList)C_LIST_INIT(todo[i]);
+                c_list_swap(&todo[i], &ctx->ready_lists[i]);
+        }
 
-        while ((file = c_list_first_entry(&todo, DispatchFile, ready_link))) {
-                c_list_unlink(&file->ready_link);
-                c_list_link_tail(&ctx->ready_list, &file->ready_link);
+        for (i = 0; i < _DISPATCH_PRIORITY_N; ++i) {
+                while ((file = c_list_first_entry(&todo[i], DispatchFile, ready_link))) {
+                        c_list_unlink(&file->ready_link);
+                        c_list_link_tail(&ctx->ready_lists[file->priority], &file->ready_link);
+
+                        /*
+                         * Record how long the file waited to be dispatched.
+                         * If it stays ready, its next wait starts now.
+                         */
+                        now = metrics_get_time(&ctx->wait_metrics);
+                        metrics_sample_record(&ctx->wait_metrics, now - file->ready_at);
+                        file->ready_at = now;
+
+                        file->n_items = 0;
+                        file->n_bytes = 0;
+
+                        r = file->fn(file);
+                        if (error_trace(r)) {
+                                for (j = i; j < _DISPATCH_PRIORITY_N; ++j)
+                                        c_list_splice(&ctx->ready_lists[j], &todo[j]);
+                                break;
+                        }
+                }
 
-                r = file->fn(file);
-                if (error_trace(r)) {
-                        c_list_splice(&ctx->ready_list, &todo);
+                if (r)
                         break;
-                }
         }
 
-        assert(c_list_is_empty(&todo));
+        for (i = 0; i < _DISPATCH_PRIORITY_N; ++i)
+                assert(c_list_is_empty(&todo[i]));
+
         return r;
 }
@@ -8,6 +8,7 @@
 #include <c-macro.h>
 #include <c-ref.h>
 #include <stdlib.h>
+#include "util/metrics.h"
 
 enum {
         _DISPATCH_E_SUCCESS,
@@ -16,6 +17,13 @@ enum {
         DISPATCH_E_FAILURE,
 };
 
+enum {
+        DISPATCH_PRIORITY_CONTROLLER,
+        DISPATCH_PRIORITY_REGISTRATION,
+        DISPATCH_PRIORITY_BULK,
+        _DISPATCH_PRIORITY_N,
+};
+
 typedef struct DispatchContext DispatchContext;
 typedef struct DispatchFile DispatchFile;
 typedef int (*DispatchFn) (DispatchFile *file);
@@ -28,14 +36,23 @@ struct DispatchFile {
         DispatchFn fn;
 
         int fd;
+        unsigned int priority;
         uint32_t user_mask;
         uint32_t kernel_mask;
         uint32_t events;
+
+        /* budget consumed in the current round */
+        size_t n_items;
+        size_t n_bytes;
+
+        /* time the file was queued on its ready-list */
+        uint64_t ready_at;
 };
 
 #define DISPATCH_FILE_NULL(_x) {                                \
                 .ready_link = C_LIST_INIT((_x).ready_link),     \
                 .fd = -1,                                       \
+                .priority = DISPATCH_PRIORITY_BULK,             \
         }
 
 int dispatch_file_init(DispatchFile *file,
@@ -49,18 +66,29 @@ void dispatch_file_deinit(DispatchFile *file);
 void dispatch_file_select(DispatchFile *file, uint32_t mask);
 void dispatch_file_deselect(DispatchFile *file, uint32_t mask);
 void dispatch_file_clear(DispatchFile *file, uint32_t mask);
+void dispatch_file_yield(DispatchFile *file, uint32_t mask);
+void dispatch_file_set_priority(DispatchFile *file, unsigned int priority);
 
 /* contexts */
 
 struct DispatchContext {
-        CList ready_list;
+        CList ready_lists[_DISPATCH_PRIORITY_N];
         int epoll_fd;
         size_t n_files;
+
+        size_t budget_items;
+        size_t budget_bytes;
+        Metrics wait_metrics;
 };
 
 #define DISPATCH_CONTEXT_NULL(_x) {                             \
-                .ready_list = C_LIST_INIT((_x).ready_list),     \
-                .epoll_fd = -1,                                 \
+                .ready_lists = {                                                                \
+                        C_LIST_INIT((_x).ready_lists[DISPATCH_PRIORITY_CONTROLLER]),            \
+                        C_LIST_INIT((_x).ready_lists[DISPATCH_PRIORITY_REGISTRATION]),          \
+                        C_LIST_INIT((_x).ready_lists[DISPATCH_PRIORITY_BULK]),                  \
+                },                                                                              \
+                .epoll_fd = -1,                                                                 \
+                .wait_metrics = METRICS_INIT(CLOCK_MONOTONIC),                                  \
         }
 
 int dispatch_context_init(DispatchContext *ctx);
@@ -74,3 +102,60 @@ int dispatch_context_dispatch(DispatchContext *ctx);
 static inline uint32_t dispatch_file_events(DispatchFile *file) {
         return file->events & file->user_mask;
 }
+
+/**
+ * dispatch_file_schedule() - queue file if ready
+ * @file:               dispatch file
+ *
+ * This links @file into the ready-list of its priority class, if it has
+ * selected events pending and is not queued already. The time is recorded, so
+ * the wait until the file is dispatched can be measured.
+ */
+static inline void dispatch_file_schedule(DispatchFile *file) {
+        if ((file->events & file->user_mask) && !c_list_is_linked(&file->ready_link)) {
+                file->ready_at = metrics_get_time(&file->context->wait_metrics);
+                c_list_link_tail(&file->context->ready_lists[file->priority], &file->ready_link);
+        }
+}
+
+/**
+ * dispatch_context_is_ready() - check for ready files
+ * @ctx:                dispatch context
+ *
+ * Return: True if any file of @ctx is ready to be dispatched.
+ */
+static inline bool dispatch_context_is_ready(DispatchContext *ctx) {
+        size_t i;
+
+        for (i = 0; i < _DISPATCH_PRIORITY_N; ++i)
+                if (!c_list_is_empty(&ctx->ready_lists[i]))
+                        return true;
+
+        return false;
+}
+
+/**
+ * dispatch_file_consume() - consume dispatch budget
+ * @file:               dispatch file
+ * @n_bytes:            number of bytes handled
+ *
+ * This charges one item of @n_bytes bytes on the budget of @file for the
+ * current dispatch round.
+ */
+static inline void dispatch_file_consume(DispatchFile *file, size_t n_bytes) {
+        ++file->n_items;
+        file->n_bytes += n_bytes;
+}
+
+/**
+ * dispatch_file_has_budget() - check for remaining dispatch budget
+ * @file:               dispatch file
+ *
+ * Return: True if @file has budget left in the current dispatch round.
+ */
+static inline bool dispatch_file_has_budget(DispatchFile *file) {
+        DispatchContext *ctx = file->context;
+
+        return (!ctx->budget_items || file->n_items < ctx->budget_items) &&
+               (!ctx->budget_bytes || file->n_bytes < ctx->budget_bytes);
+}
@@ -0,0 +1,140 @@
+/*
+ * Hash Helpers
+ *
+ * These helpers provide a keyed hash for in-memory hash tables. Since most
+ * keys (e.g., names, paths or match rules) are provided by clients, the hash
+ * is SipHash-1-3 keyed with random data at first use, so clients cannot
+ * predict hash values, nor craft keys that collide.
+ */
+
+#include <c-macro.h>
+#include <errno.h>
+#include <endian.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/auxv.h>
+#include <sys/random.h>
+#include <time.h>
+#include <unistd.h>
+#include "util/hash.h"
+
+#define HASH_ROTL(_x, _b) (((_x) << (_b)) | ((_x) >> (64 - (_b))))
+
+static void hash_round(uint64_t v[4]) {
+        v[0] += v[1];
+        v[1] = HASH_ROTL(v[1], 13);
+        v[1] ^= v[0];
+        v[0] = HASH_ROTL(v[0], 32);
+        v[2] += v[3];
+        v[3] = HASH_ROTL(v[3], 16);
+        v[3] ^= v[2];
+        v[0] += v[3];
+        v[3] = HASH_ROTL(v[3], 21);
+        v[3] ^= v[0];
+        v[2] += v[1];
+        v[1] = HASH_ROTL(v[1], 17);
+        v[1] ^= v[2];
+        v[2] = HASH_ROTL(v[2], 32);
+}
+
+static void hash_seed(uint64_t key[2]) {
+        struct timespec ts;
+        const void *auxv;
+        ssize_t l;
+        int r;
+
+        /*
+         * The broker starts early during boot, possibly before the kernel
+         * random pool is initialized, and must not block on it. A hash key
+         * does not need cryptographic quality, it just needs to be unknown to
+         * clients. Hence, never wait for entropy, and if getrandom(2) fails
+         * for whatever reason (e.g., EAGAIN, ENOSYS, or a seccomp filter),
+         * fall back to the random bytes the kernel passed via AT_RANDOM, mixed
+         * with the current time and our PID.
+         */
+        do {
+                l = getrandom(key, 2 * sizeof(*key), GRND_NONBLOCK);
+        } while (l < 0 && errno == EINTR);
+
+        if (l == 2 * sizeof(*key))
+                return;
+
+        auxv = (const void *)getauxval(AT_RANDOM);
+        if (auxv)
+                memcpy(key, auxv, 2 * sizeof(*key));
+
+        r = clock_gettime(CLOCK_MONOTONIC, &ts);
+        if (r >= 0)
+                key[0] ^= (uint64_t)ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+        key[1] ^= (uint64_t)getpid();
+}
+
+static const uint64_t *hash_key(void) {
+        static uint64_t key[2];
+        static bool initialized;
+
+        if (_c_unlikely_(!initialized)) {
+                hash_seed(key);
+                initialized = true;
+        }
+
+        return key;
+}
+
+static uint64_t hash_read64(const unsigned char *b) {
+        uint64_t m;
+
+        memcpy(&m, b, sizeof(m));
+        return le64toh(m);
+}
+
+/**
+ * hash_bytes() - hash a byte buffer
+ * @p:                  buffer to hash
+ * @n:                  size of @p in bytes
+ *
+ * Return: The hash value of the @n bytes at @p.
+ */
+uint64_t hash_bytes(const void *p, size_t n) {
+        const uint64_t *key = hash_key();
+        const unsigned char *b = p;
+        uint64_t m, v[4];
+        size_t i;
+
+        v[0] = key[0] ^ UINT64_C(0x736f6d6570736575);
+        v[1] = key[1] ^ UINT64_C(0x646f72616e646f6d);
+        v[2] = key[0] ^ UINT64_C(0x6c7967656e657261);
+        v[3] = key[1] ^ UINT64_C(0x7465646279746573);
+
+        for (i = 0; i + 8 <= n; i += 8) {
+                m = hash_read64(b + i);
+                v[3] ^= m;
+                hash_round(v);
+                v[0] ^= m;
+        }
+
+        m = (uint64_t)n << 56;
+        for ( ; i < n; ++i)
+                m |= (uint64_t)b[i] << (8 * (i % 8));
+
+        v[3] ^= m;
+        hash_round(v);
+        v[0] ^= m;
+
+        v[2] ^= 0xff;
+        hash_round(v);
+        hash_round(v);
+        hash_round(v);
+
+        return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+/**
+ * hash_string() - hash a string
+ * @s:                  string to hash, or NULL
+ *
+ * Return: The hash value of @s, or 0 if @s is NULL.
+ */
+uint64_t hash_string(const char *s) {
+        return s ? hash_bytes(s, strlen(s)) : 0;
+}
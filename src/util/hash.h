@@ -0,0 +1,26 @@
+#pragma once
+
+/*
+ * Hash Helpers
+ */
+
+#include <c-macro.h>
+#include <stdlib.h>
+
+uint64_t hash_bytes(const void *p, size_t n);
+uint64_t hash_string(const char *s);
+
+/**
+ * hash_combine() - combine two hash values
+ * @h:                  hash value to extend
+ * @v:                  hash value to mix in
+ *
+ * Return: A hash value covering both @h and @v, in this order.
+ */
+static inline uint64_t hash_combine(uint64_t h, uint64_t v) {
+        h ^= v + UINT64_C(0x9e3779b97f4a7c15) + (h << 6) + (h >> 2);
+        h ^= h >> 33;
+        h *= UINT64_C(0xff51afd7ed558ccd);
+        h ^= h >> 33;
+        return h;
+}
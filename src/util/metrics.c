@@ -2,7 +2,8 @@
  * Metrics Helper
  *
  * The metrics object is used to compute the min/max/avg/std deviation of samples of
- * CPU time, in fixed size and without memory allocations.
+ * CPU time, in fixed size and without memory allocations. Additionally, samples are
+ * counted in a histogram of power-of-two buckets, so quantiles can be estimated.
  *
  * The values of min/max/avg are meant to be read out of the struct directly, whereas
  * the standard deviation can only be accessed using a helper function (as it is not
@@ -48,17 +49,16 @@ uint64_t metrics_get_time(Metrics *metrics) {
 }
 
 /**
- * metrics_sample_add() - add one sample
+ * metrics_sample_record() - record one sample
  * @metrics:            object to operate on
- * @timestamp:          time the sample was started
+ * @sample:             value of the sample
  *
- * Update the internal state with a new sample, started at @timestamp
- * and ending at the time the function is called.
+ * Update the internal state with a new sample of the value @sample. This is
+ * meant for samples measured by the caller, see metrics_sample_add() to
+ * measure the time since a timestamp.
  */
-void metrics_sample_add(Metrics *metrics, uint64_t timestamp) {
-        uint64_t sample, average_old;
-
-        sample = metrics_get_time(metrics) - timestamp;
+void metrics_sample_record(Metrics *metrics, uint64_t sample) {
+        uint64_t average_old;
 
         metrics->count ++;
         metrics->sum += sample;
@@ -72,6 +72,22 @@ void metrics_sample_add(Metrics *metrics, uint64_t timestamp) {
 
         if (metrics->maximum < sample)
                 metrics->maximum = sample;
+
+        /* bucket N covers [2^N, 2^(N+1)), the last one is open-ended */
+        metrics->histogram[c_min(sample ? 63 - __builtin_clzll(sample) : 0,
+                                 METRICS_HISTOGRAM_N - 1)]++;
+}
+
+/**
+ * metrics_sample_add() - add one sample
+ * @metrics:            object to operate on
+ * @timestamp:          time the sample was started
+ *
+ * Update the internal state with a new sample, started at @timestamp
+ * and ending at the time the function is called.
+ */
+void metrics_sample_add(Metrics *metrics, uint64_t timestamp) {
+        metrics_sample_record(metrics, metrics_get_time(metrics) - timestamp);
 }
 
 /**
@@ -119,3 +135,33 @@ double metrics_read_standard_deviation(Metrics *metrics) {
 
         return sqrt(metrics->sum_of_squares / metrics->count);
 }
+
+/**
+ * metrics_read_quantile() - estimate a quantile
+ * @metrics:            object to operate on
+ * @quantile:           quantile to estimate, between 0 and 1
+ *
+ * This estimates the given quantile (e.g., 0.99 for the 99th percentile) of
+ * the samples recorded so far, based on the histogram. The returned value is
+ * the upper bound of the histogram bucket the quantile falls into, hence it
+ * over-estimates by at most a factor of two. It never exceeds the maximum.
+ *
+ * Return: the estimated quantile, or 0 if no samples were taken.
+ */
+uint64_t metrics_read_quantile(Metrics *metrics, double quantile) {
+        uint64_t rank, n = 0;
+        size_t i;
+
+        if (!metrics->count)
+                return 0;
+
+        rank = c_max(quantile * metrics->count, 1.0);
+
+        for (i = 0; i < METRICS_HISTOGRAM_N - 1; ++i) {
+                n += metrics->histogram[i];
+                if (n >= rank)
+                        return c_min((UINT64_C(2) << i) - 1, metrics->maximum);
+        }
+
+        return metrics->maximum;
+}
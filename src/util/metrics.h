@@ -10,12 +10,15 @@
 
 typedef struct Metrics Metrics;
 
+#define METRICS_HISTOGRAM_N (32) /* log2 buckets, up to 2^31ns (~2s) */
+
 struct Metrics {
         uint64_t count;
         uint64_t sum;
         uint64_t minimum;
         uint64_t maximum;
         uint64_t average;
+        uint64_t histogram[METRICS_HISTOGRAM_N];
 
         /* internal state */
         clockid_t id;
@@ -33,8 +36,10 @@ void metrics_deinit(Metrics *metrics);
 
 uint64_t metrics_get_time(Metrics *metrics);
 void metrics_sample_add(Metrics *metrics, uint64_t timestamp);
+void metrics_sample_record(Metrics *metrics, uint64_t sample);
 
 void metrics_sample_start(Metrics *metrics);
 void metrics_sample_end(Metrics *metrics);
 
 double metrics_read_standard_deviation(Metrics *metrics);
+uint64_t metrics_read_quantile(Metrics *metrics, double quantile);
@@ -0,0 +1,214 @@
+/*
+ * Object Pools
+ *
+ * A pool caches freed objects of a fixed size class, so they can be reused by
+ * the next allocation rather than returning them to, and requesting them from,
+ * the system allocator. Objects of the broker are frequently allocated and
+ * released in bursts (e.g., one socket buffer per receiver of a broadcast), so
+ * a small per-type cache avoids most allocator calls in those cases.
+ *
+ * Each pool caches at most POOL_SIZE_MAX bytes. Objects beyond that limit are
+ * freed right away. Furthermore, pool_trim() releases half of the objects
+ * that were not needed since the previous call, so pools shrink again once
+ * the bus is idle.
+ *
+ * Pools are bookkeeping only. Objects are still accounted by their users,
+ * exactly as if they were allocated via malloc(3).
+ *
+ * Pools are not thread-safe. They are meant to be used as static objects
+ * of the modules that allocate from them, and every pool that caches objects
+ * is linked into a global list, so they can be trimmed all at once.
+ */
+
+#include <c-list.h>
+#include <c-macro.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util/pool.h"
+
+typedef struct PoolEntry PoolEntry;
+
+struct PoolEntry {
+        PoolEntry *next;
+};
+
+static CList pool_list = C_LIST_INIT(pool_list);
+
+/**
+ * pool_alloc() - allocate object from pool
+ * @pool:               pool to allocate from, or NULL
+ * @size:               size of the object
+ *
+ * This allocates an object of size @size from @pool. If @pool has an object
+ * cached, it is returned, otherwise a new object of the size class of @pool
+ * is allocated. If @pool is NULL, this falls back to malloc(3).
+ *
+ * The content of the returned object is undefined.
+ *
+ * Return: Pointer to the new object, or NULL if out of memory.
+ */
+void *pool_alloc(Pool *pool, size_t size) {
+        PoolEntry *entry;
+
+        if (!pool)
+                return malloc(size);
+
+        assert(size <= pool->size);
+
+        entry = pool->entries;
+        if (!entry)
+                return malloc(c_max(pool->size, sizeof(PoolEntry)));
+
+        pool->entries = entry->next;
+        if (--pool->n_entries < pool->n_low)
+                pool->n_low = pool->n_entries;
+
+        return entry;
+}
+
+/**
+ * pool_alloc0() - allocate zeroed object from pool
+ * @pool:               pool to allocate from, or NULL
+ * @size:               size of the object
+ *
+ * This is the same as pool_alloc(), but clears the first @size bytes of the
+ * object.
+ *
+ * Return: Pointer to the new object, or NULL if out of memory.
+ */
+void *pool_alloc0(Pool *pool, size_t size) {
+        void *p;
+
+        p = pool_alloc(pool, size);
+        if (p)
+                memset(p, 0, size);
+
+        return p;
+}
+
+/**
+ * pool_free() - return object to pool
+ * @pool:               pool the object was allocated from, or NULL
+ * @p:                  object to release, or NULL
+ *
+ * This releases an object previously allocated via pool_alloc() from the same
+ * pool. The object is cached in @pool, unless the pool is full, in which case
+ * it is freed.
+ */
+void pool_free(Pool *pool, void *p) {
+        PoolEntry *entry = p;
+
+        if (!p)
+                return;
+
+        if (!pool || (pool->n_entries + 1) * pool->size > POOL_SIZE_MAX) {
+                free(p);
+                return;
+        }
+
+        if (!c_list_is_linked(&pool->link))
+                c_list_link_tail(&pool_list, &pool->link);
+
+        entry->next = pool->entries;
+        pool->entries = entry;
+        ++pool->n_entries;
+}
+
+/**
+ * pool_trim() - shrink pool
+ * @pool:               pool to operate on
+ *
+ * This releases half of the cached objects that were not used since the last
+ * call to this function, rounded up.
+ */
+void pool_trim(Pool *pool) {
+        PoolEntry *entry;
+        size_t n;
+
+        for (n = (pool->n_low + 1) / 2; n; --n) {
+                entry = pool->entries;
+                pool->entries = entry->next;
+                --pool->n_entries;
+                free(entry);
+        }
+
+        pool->n_low = pool->n_entries;
+        if (!pool->n_entries)
+                c_list_unlink(&pool->link);
+}
+
+/**
+ * pool_flush() - release all cached objects
+ * @pool:               pool to operate on
+ *
+ * This releases all cached objects of @pool.
+ */
+void pool_flush(Pool *pool) {
+        PoolEntry *entry;
+
+        while ((entry = pool->entries)) {
+                pool->entries = entry->next;
+                free(entry);
+        }
+
+        pool->n_entries = 0;
+        pool->n_low = 0;
+        c_list_unlink(&pool->link);
+}
+
+/**
+ * pool_select() - select size class
+ * @pools:              array of pools, ordered by size
+ * @n_pools:            number of pools in @pools
+ * @size:               size of the object
+ *
+ * This selects the smallest pool in @pools that can hold objects of size
+ * @size.
+ *
+ * Return: Pointer to the selected pool, or NULL if @size exceeds all pools.
+ */
+Pool *pool_select(Pool *pools, size_t n_pools, size_t size) {
+        size_t i;
+
+        for (i = 0; i < n_pools; ++i)
+                if (size <= pools[i].size)
+                        return &pools[i];
+
+        return NULL;
+}
+
+/**
+ * pool_has_cached() - check for cached objects
+ *
+ * Return: True if any pool currently caches objects.
+ */
+bool pool_has_cached(void) {
+        return !c_list_is_empty(&pool_list);
+}
+
+/**
+ * pool_trim_all() - shrink all pools
+ *
+ * This calls pool_trim() on all pools that currently cache objects. This is
+ * meant to be called periodically as long as pool_has_cached() returns true,
+ * regardless of whether the caller is busy or idle. The interval decides how
+ * long an object must stay unused before it is released.
+ */
+void pool_trim_all(void) {
+        Pool *pool, *safe;
+
+        c_list_for_each_entry_safe(pool, safe, &pool_list, link)
+                pool_trim(pool);
+}
+
+/**
+ * pool_flush_all() - release all cached objects of all pools
+ *
+ * This calls pool_flush() on all pools that currently cache objects.
+ */
+void pool_flush_all(void) {
+        Pool *pool;
+
+        while ((pool = c_list_first_entry(&pool_list, Pool, link)))
+                pool_flush(pool);
+}
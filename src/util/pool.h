@@ -0,0 +1,39 @@
+#pragma once
+
+/*
+ * Object Pools
+ */
+
+#include <c-list.h>
+#include <c-macro.h>
+#include <stdlib.h>
+
+typedef struct Pool Pool;
+
+#define POOL_SIZE_MAX (256UL * 1024UL) /* max bytes cached per pool */
+
+struct Pool {
+        size_t size;
+        CList link;
+
+        void *entries;
+        size_t n_entries;
+        size_t n_low;
+};
+
+#define POOL_INIT(_x, _size) {                                  \
+                .size = (_size),                                \
+                .link = C_LIST_INIT((_x).link),                 \
+        }
+
+void *pool_alloc(Pool *pool, size_t size);
+void *pool_alloc0(Pool *pool, size_t size);
+void pool_free(Pool *pool, void *p);
+
+void pool_trim(Pool *pool);
+void pool_flush(Pool *pool);
+
+Pool *pool_select(Pool *pools, size_t n_pools, size_t size);
+bool pool_has_cached(void);
+void pool_trim_all(void);
+void pool_flush_all(void);
@@ -206,8 +206,150 @@ static void test_uds_edge(unsigned int run) {
         c_close(s[0]);
 }
 
+typedef struct TestBudget {
+        DispatchFile file;
+        size_t n_read;
+} TestBudget;
+
+static int test_budget_fn(DispatchFile *file) {
+        TestBudget *t = c_container_of(file, TestBudget, file);
+        char b;
+        int r;
+
+        for (;;) {
+                if (!dispatch_file_has_budget(file)) {
+                        dispatch_file_yield(file, EPOLLIN);
+                        return 0;
+                }
+
+                r = recv(file->fd, &b, sizeof(b), MSG_DONTWAIT);
+                if (r < 0) {
+                        assert(errno == EAGAIN);
+                        dispatch_file_clear(file, EPOLLIN);
+                        return 0;
+                }
+
+                dispatch_file_consume(file, r);
+                ++t->n_read;
+        }
+}
+
+/*
+ * This test verifies that a file which runs out of dispatch budget is put
+ * back on the ready-list and continued in the following round, after all
+ * other ready files had their turn.
+ */
+static void test_budget(void) {
+        _c_cleanup_(dispatch_context_deinit) DispatchContext c = DISPATCH_CONTEXT_NULL(c);
+        TestBudget t[2] = { { .file = DISPATCH_FILE_NULL(t[0].file) }, { .file = DISPATCH_FILE_NULL(t[1].file) } };
+        char b[] = { "fo" };
+        int r, s[2][2];
+        size_t i;
+
+        r = dispatch_context_init(&c);
+        assert(!r);
+
+        c.budget_items = 2;
+
+        for (i = 0; i < C_ARRAY_SIZE(t); ++i) {
+                r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0, s[i]);
+                assert(!r);
+
+                r = dispatch_file_init(&t[i].file, &c, test_budget_fn, s[i][0], EPOLLIN, 0);
+                assert(!r);
+
+                dispatch_file_select(&t[i].file, EPOLLIN);
+
+                r = send(s[i][1], b, sizeof(b), MSG_DONTWAIT | MSG_NOSIGNAL);
+                assert(r == sizeof(b));
+        }
+
+        /* each file gets its budget, then yields with data left */
+
+        r = dispatch_context_dispatch(&c);
+        assert(!r);
+
+        for (i = 0; i < C_ARRAY_SIZE(t); ++i) {
+                assert(t[i].n_read == 2);
+                assert(c_list_is_linked(&t[i].file.ready_link));
+        }
+
+        /* the next round drains the rest and clears the event */
+
+        r = dispatch_context_dispatch(&c);
+        assert(!r);
+
+        for (i = 0; i < C_ARRAY_SIZE(t); ++i) {
+                assert(t[i].n_read == sizeof(b));
+                assert(!c_list_is_linked(&t[i].file.ready_link));
+        }
+
+        /* every dispatch of a file records its wait */
+        assert(c.wait_metrics.count == 4);
+
+        for (i = 0; i < C_ARRAY_SIZE(t); ++i) {
+                dispatch_file_deinit(&t[i].file);
+                c_close(s[i][1]);
+                c_close(s[i][0]);
+        }
+}
+
+static unsigned int test_priority_order[_DISPATCH_PRIORITY_N];
+static size_t test_priority_n;
+
+static int test_priority_fn(DispatchFile *file) {
+        test_priority_order[test_priority_n++] = file->priority;
+        dispatch_file_clear(file, EPOLLIN);
+        return 0;
+}
+
+/*
+ * This test verifies that files are dispatched in order of their priority
+ * class, regardless of the order the kernel signalled them in.
+ */
+static void test_priority(void) {
+        _c_cleanup_(dispatch_context_deinit) DispatchContext c = DISPATCH_CONTEXT_NULL(c);
+        DispatchFile f[_DISPATCH_PRIORITY_N];
+        int r, s[_DISPATCH_PRIORITY_N][2];
+        size_t i;
+
+        r = dispatch_context_init(&c);
+        assert(!r);
+
+        for (i = 0; i < _DISPATCH_PRIORITY_N; ++i) {
+                f[i] = (DispatchFile)DISPATCH_FILE_NULL(f[i]);
+
+                r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0, s[i]);
+                assert(!r);
+
+                r = dispatch_file_init(&f[i], &c, test_priority_fn, s[i][0], EPOLLIN, 0);
+                assert(!r);
+
+                dispatch_file_select(&f[i], EPOLLIN);
+                dispatch_file_set_priority(&f[i], _DISPATCH_PRIORITY_N - i - 1);
+
+                r = send(s[i][1], "x", 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+                assert(r == 1);
+        }
+
+        r = dispatch_context_dispatch(&c);
+        assert(!r);
+        assert(test_priority_n == _DISPATCH_PRIORITY_N);
+
+        for (i = 0; i < _DISPATCH_PRIORITY_N; ++i)
+                assert(test_priority_order[i] == i);
+
+        for (i = 0; i < _DISPATCH_PRIORITY_N; ++i) {
+                dispatch_file_deinit(&f[i]);
+                c_close(s[i][1]);
+                c_close(s[i][0]);
+        }
+}
+
 int main(int argc, char **argv) {
         test_uds_edge(0);
         test_uds_edge(1);
+        test_budget();
+        test_priority();
         return 0;
 }
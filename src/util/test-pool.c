@@ -0,0 +1,149 @@
+/*
+ * Test Object Pools
+ */
+
+#include <c-macro.h>
+#include <stdlib.h>
+#include "util/pool.h"
+
+static void test_setup(void) {
+        Pool pool = POOL_INIT(pool, 64);
+        void *p;
+
+        p = pool_alloc(&pool, 64);
+        assert(p);
+        assert(!pool.n_entries);
+
+        pool_free(&pool, p);
+        assert(pool.n_entries == 1);
+
+        pool_flush(&pool);
+        assert(!pool.n_entries);
+        assert(!c_list_is_linked(&pool.link));
+
+        /* NULL pools fall back to malloc(3) */
+        p = pool_alloc0(NULL, 128);
+        assert(p);
+        pool_free(NULL, p);
+        pool_free(NULL, NULL);
+}
+
+static void test_reuse(void) {
+        Pool pool = POOL_INIT(pool, 64);
+        void *p1, *p2;
+
+        /*
+         * Objects are cached on release and handed out again on allocation,
+         * in LIFO order.
+         */
+
+        p1 = pool_alloc(&pool, 32);
+        assert(p1);
+        p2 = pool_alloc(&pool, 32);
+        assert(p2);
+
+        pool_free(&pool, p1);
+        pool_free(&pool, p2);
+        assert(pool.n_entries == 2);
+
+        assert(pool_alloc(&pool, 64) == p2);
+        assert(pool_alloc(&pool, 16) == p1);
+        assert(!pool.n_entries);
+
+        pool_free(&pool, p2);
+        pool_free(&pool, p1);
+        pool_flush(&pool);
+}
+
+static void test_bound(void) {
+        Pool pool = POOL_INIT(pool, POOL_SIZE_MAX / 4);
+        void *p[8];
+        size_t i;
+
+        /*
+         * A pool never caches more than POOL_SIZE_MAX bytes, anything beyond
+         * that is freed right away.
+         */
+
+        for (i = 0; i < C_ARRAY_SIZE(p); ++i) {
+                p[i] = pool_alloc(&pool, pool.size);
+                assert(p[i]);
+        }
+
+        for (i = 0; i < C_ARRAY_SIZE(p); ++i)
+                pool_free(&pool, p[i]);
+
+        assert(pool.n_entries == 4);
+
+        pool_flush(&pool);
+}
+
+static void test_trim(void) {
+        Pool pool = POOL_INIT(pool, 64);
+        void *p[8];
+        size_t i;
+
+        for (i = 0; i < C_ARRAY_SIZE(p); ++i) {
+                p[i] = pool_alloc(&pool, pool.size);
+                assert(p[i]);
+        }
+
+        for (i = 0; i < C_ARRAY_SIZE(p); ++i)
+                pool_free(&pool, p[i]);
+
+        /*
+         * The first trim only resets the low-water mark, since all objects
+         * were in use since the pool was created. Afterwards, each trim
+         * releases half of the unused objects, rounded up.
+         */
+
+        pool_trim_all();
+        assert(pool.n_entries == 8);
+
+        pool_trim_all();
+        assert(pool.n_entries == 4);
+
+        /* allocations lower the low-water mark */
+        p[0] = pool_alloc(&pool, pool.size);
+        p[1] = pool_alloc(&pool, pool.size);
+        p[2] = pool_alloc(&pool, pool.size);
+        pool_free(&pool, p[2]);
+        pool_free(&pool, p[1]);
+        pool_free(&pool, p[0]);
+
+        pool_trim_all();
+        assert(pool.n_entries == 3);
+
+        pool_trim_all();
+        assert(pool.n_entries == 1);
+
+        assert(pool_has_cached());
+
+        pool_trim_all();
+        assert(!pool.n_entries);
+        assert(!c_list_is_linked(&pool.link));
+        assert(!pool_has_cached());
+}
+
+static void test_select(void) {
+        Pool pools[] = {
+                POOL_INIT(pools[0], 64),
+                POOL_INIT(pools[1], 128),
+                POOL_INIT(pools[2], 256),
+        };
+
+        assert(pool_select(pools, C_ARRAY_SIZE(pools), 0) == &pools[0]);
+        assert(pool_select(pools, C_ARRAY_SIZE(pools), 64) == &pools[0]);
+        assert(pool_select(pools, C_ARRAY_SIZE(pools), 65) == &pools[1]);
+        assert(pool_select(pools, C_ARRAY_SIZE(pools), 256) == &pools[2]);
+        assert(!pool_select(pools, C_ARRAY_SIZE(pools), 257));
+}
+
+int main(int argc, char **argv) {
+        test_setup();
+        test_reuse();
+        test_bound();
+        test_trim();
+        test_select();
+        return 0;
+}
@@ -2290,7 +2290,7 @@ static void test_verify_property_features(sd_bus_message *message) {
 }
 
 static void test_verify_property_interfaces(sd_bus_message *message) {
-        bool monitoring = false;
+        bool monitoring = false, broker = false;
         int r;
 
         r = sd_bus_message_enter_container(message, 'v', "as");
@@ -2307,6 +2307,8 @@ static void test_verify_property_interfaces(sd_bus_message *message) {
 
                 if (strcmp(interface, "org.freedesktop.DBus.Monitoring") == 0)
                         monitoring = true;
+                else if (strcmp(interface, "org.bus1.DBus.Broker") == 0)
+                        broker = true;
         }
 
         r = sd_bus_message_exit_container(message);
@@ -2316,6 +2318,7 @@ static void test_verify_property_interfaces(sd_bus_message *message) {
         assert(r >= 0);
 
         assert(monitoring);
+        assert(broker);
 }
 
 static void test_properties(void) {
@@ -2471,6 +2474,64 @@ static void test_no_destination(void) {
         util_broker_terminate(broker);
 }
 
+static void test_get_dispatch_stats(void) {
+        _c_cleanup_(util_broker_freep) Broker *broker = NULL;
+        _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *bus = NULL;
+        _c_cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
+        uint64_t value, count = 0, p50 = 0, p99 = 0, max = 0;
+        uint64_t n_syscalls = 0, n_msgs = 0, n_buffers = 0;
+        const char *key;
+        int r;
+
+        util_broker_new(&broker);
+        util_broker_spawn(broker);
+
+        util_broker_connect(broker, &bus);
+
+        /*
+         * The broker dispatched our connection, so it recorded its wait, and
+         * it wrote the reply to our Hello().
+         */
+        r = sd_bus_call_method(bus, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.bus1.DBus.Broker",
+                               "GetDispatchStats", NULL, &reply,
+                               "");
+        assert(r >= 0);
+
+        r = sd_bus_message_enter_container(reply, 'a', "{st}");
+        assert(r >= 0);
+
+        while ((r = sd_bus_message_read(reply, "{st}", &key, &value)) > 0) {
+                if (!strcmp(key, "DispatchCount"))
+                        count = value;
+                else if (!strcmp(key, "WaitP50"))
+                        p50 = value;
+                else if (!strcmp(key, "WaitP99"))
+                        p99 = value;
+                else if (!strcmp(key, "WaitMax"))
+                        max = value;
+                else if (!strcmp(key, "WriteSyscalls"))
+                        n_syscalls = value;
+                else if (!strcmp(key, "WriteMessages"))
+                        n_msgs = value;
+                else if (!strcmp(key, "WriteBuffers"))
+                        n_buffers = value;
+        }
+        assert(r >= 0);
+
+        r = sd_bus_message_exit_container(reply);
+        assert(r >= 0);
+
+        assert(count > 0);
+        assert(p50 <= p99);
+        assert(p99 <= max);
+
+        assert(n_syscalls > 0);
+        assert(n_msgs > 0);
+        assert(n_msgs <= n_buffers);
+
+        util_broker_terminate(broker);
+}
+
 int main(int argc, char **argv) {
         test_unknown();
         test_hello();
@@ -2496,6 +2557,7 @@ int main(int argc, char **argv) {
         test_become_monitor();
         test_ping();
         test_get_machine_id();
+        test_get_dispatch_stats();
         test_properties();
         test_no_destination();
 
@@ -20,9 +20,14 @@ enum {
         _TEST_FD_STREAM_N,
 };
 
+#define TEST_FD_BULK_N (4096U)
+#define TEST_FD_BULK_WINDOW (8U)
+
 static unsigned int test_fd_stream_mode;
 static unsigned int test_fd_stream_seq;
 static unsigned int test_fd_stream_got;
+static unsigned int test_fd_bulk_sent;
+static unsigned int test_fd_bulk_got;
 
 static void test_fd_stream_send(Connection *c, unsigned int unix_fds, unsigned int n_fds) {
         static const CDVarType type[] = {
@@ -260,6 +265,90 @@ static void test_fd_stream(void) {
         util_broker_terminate(broker);
 }
 
+static int test_fd_bulk_fn(DispatchFile *file) {
+        Connection *c = c_container_of(file, Connection, socket_file);
+        int r;
+
+        r = connection_dispatch(c, dispatch_file_events(file));
+        assert(!r);
+
+        do {
+                _c_cleanup_(message_unrefp) Message *m = NULL;
+
+                r = connection_dequeue(c, &m);
+                if (!r) {
+                        if (!m)
+                                break;
+
+                        r = message_parse_metadata(m);
+                        assert(!r);
+                        assert(m->metadata.fields.unix_fds == fdlist_count(m->fds));
+
+                        if (m->metadata.fields.reply_serial == 1) {
+                                for ( ; test_fd_bulk_sent < TEST_FD_BULK_WINDOW; ++test_fd_bulk_sent)
+                                        test_fd_stream_send(c, 1, 1);
+                        } else if (m->metadata.header.type == DBUS_MESSAGE_TYPE_METHOD_CALL) {
+                                assert(m->metadata.fields.unix_fds == 1);
+
+                                if (++test_fd_bulk_got == TEST_FD_BULK_N)
+                                        connection_shutdown(c);
+                                else if (test_fd_bulk_sent++ < TEST_FD_BULK_N)
+                                        test_fd_stream_send(c, 1, 1);
+                        } else {
+                                assert(m->metadata.header.type == DBUS_MESSAGE_TYPE_SIGNAL);
+                        }
+                }
+        } while (!r);
+
+        if (r == CONNECTION_E_EOF) {
+                connection_shutdown(c);
+                return connection_is_running(c) ? 0 : DISPATCH_E_EXIT;
+        }
+
+        assert(!r);
+        return 0;
+}
+
+static void test_fd_bulk(void) {
+        _c_cleanup_(dispatch_context_deinit) DispatchContext d = DISPATCH_CONTEXT_NULL(d);
+        _c_cleanup_(connection_deinit) Connection c = CONNECTION_NULL(c);
+        _c_cleanup_(util_broker_freep) Broker *broker = NULL;
+        int r, fd;
+
+        /*
+         * This test connects a single client to the broker and then sends a
+         * stream of method-calls to itself, each carrying a single FD. A
+         * window of calls is kept in-flight at all times, so the broker has
+         * to pipeline messages with FDs in both directions. The window is
+         * kept below the default FD quota.
+         */
+
+        util_broker_new(&broker);
+        util_broker_spawn(broker);
+
+        r = dispatch_context_init(&d);
+        assert(!r);
+
+        util_broker_connect_fd(broker, &fd);
+
+        r = connection_init_client(&c, &d, test_fd_bulk_fn, NULL, fd);
+        assert(!r);
+
+        r = connection_open(&c);
+        assert(!r);
+
+        test_fd_stream_hello(&c);
+
+        do {
+                r = dispatch_context_dispatch(&d);
+                assert(!r || r == DISPATCH_E_EXIT);
+        } while (!r);
+
+        assert(test_fd_bulk_got == TEST_FD_BULK_N);
+
+        util_broker_terminate(broker);
+}
+
 int main(int argc, char **argv) {
         /*
          * dbus-daemon(1) fails this test, so skip it if run under it. Note
@@ -291,5 +380,8 @@ int main(int argc, char **argv) {
                         assert(test_fd_stream_got == 3);
         }
 
+        test_fd_stream_seq = 0;
+        test_fd_bulk();
+
         return 0;
 }
@@ -114,6 +114,61 @@ static void test_well_known_name(void) {
         util_broker_terminate(broker);
 }
 
+static void test_name_change(void) {
+        _c_cleanup_(util_broker_freep) Broker *broker = NULL;
+        _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *sender = NULL;
+        _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *receiver = NULL;
+        int r;
+
+        util_broker_new(&broker);
+        util_broker_spawn(broker);
+
+        util_broker_connect(broker, &sender);
+        util_broker_connect(broker, &receiver);
+
+        r = sd_bus_call_method(receiver, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                               "AddMatch", NULL, NULL,
+                               "s", "sender=com.example.foo,interface=org.example");
+        assert(r >= 0);
+
+        r = sd_bus_call_method(receiver, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                               "AddMatch", NULL, NULL,
+                               "s", "interface=org.example.sentinel");
+        assert(r >= 0);
+
+        /* signals follow the name as it is acquired and released again */
+        r = sd_bus_emit_signal(sender, "/org/example", "org.example", "Foo", "");
+        assert(r >= 0);
+        r = sd_bus_emit_signal(sender, "/org/example", "org.example.sentinel", "Sentinel", "");
+        assert(r >= 0);
+
+        util_broker_consume_signal(receiver, "org.example.sentinel", "Sentinel");
+
+        r = sd_bus_call_method(sender, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                               "RequestName", NULL, NULL,
+                               "su", "com.example.foo", 0);
+        assert(r >= 0);
+
+        r = sd_bus_emit_signal(sender, "/org/example", "org.example", "Foo", "");
+        assert(r >= 0);
+
+        util_broker_consume_signal(receiver, "org.example", "Foo");
+
+        r = sd_bus_call_method(sender, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                               "ReleaseName", NULL, NULL,
+                               "s", "com.example.foo");
+        assert(r >= 0);
+
+        r = sd_bus_emit_signal(sender, "/org/example", "org.example", "Foo", "");
+        assert(r >= 0);
+        r = sd_bus_emit_signal(sender, "/org/example", "org.example.sentinel", "Sentinel", "");
+        assert(r >= 0);
+
+        util_broker_consume_signal(receiver, "org.example.sentinel", "Sentinel");
+
+        util_broker_terminate(broker);
+}
+
 static void test_driver(void) {
         _c_cleanup_(util_broker_freep) Broker *broker = NULL;
         _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *receiver = NULL;
@@ -257,13 +312,170 @@ static void test_noc_driver(void) {
         util_broker_terminate(broker);
 }
 
+static void test_bulk(void) {
+        _c_cleanup_(util_broker_freep) Broker *broker = NULL;
+        _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *sender = NULL;
+        _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *receiver = NULL;
+        _c_cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+        int r;
+
+        util_broker_new(&broker);
+        util_broker_spawn(broker);
+
+        util_broker_connect(broker, &sender);
+        util_broker_connect(broker, &receiver);
+
+        /* add several rules with a single call */
+        r = sd_bus_call_method(receiver, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.bus1.DBus.Broker",
+                               "AddMatches", NULL, NULL,
+                               "as", 2, "interface=org.example,member=Foo", "interface=org.example,member=Bar");
+        assert(r >= 0);
+
+        r = sd_bus_emit_signal(sender, "/org/example", "org.example", "Foo", "");
+        assert(r >= 0);
+        r = sd_bus_emit_signal(sender, "/org/example", "org.example", "Bar", "");
+        assert(r >= 0);
+
+        util_broker_consume_signal(receiver, "org.example", "Foo");
+        util_broker_consume_signal(receiver, "org.example", "Bar");
+
+        /* a single invalid rule fails the entire call, without adding any rule */
+        r = sd_bus_call_method(receiver, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.bus1.DBus.Broker",
+                               "AddMatches", &error, NULL,
+                               "as", 2, "interface=org.example,member=Baz", "invalid=rule");
+        assert(r < 0);
+        assert(!strcmp(error.name, "org.freedesktop.DBus.Error.MatchRuleInvalid"));
+        sd_bus_error_free(&error);
+
+        r = sd_bus_emit_signal(sender, "/org/example", "org.example", "Baz", "");
+        assert(r >= 0);
+        r = sd_bus_emit_signal(sender, "/org/example", "org.example", "Foo", "");
+        assert(r >= 0);
+
+        util_broker_consume_signal(receiver, "org.example", "Foo");
+
+        /* a single unknown rule fails the entire call, without removing any rule */
+        r = sd_bus_call_method(receiver, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.bus1.DBus.Broker",
+                               "RemoveMatches", &error, NULL,
+                               "as", 2, "interface=org.example,member=Foo", "interface=org.example,member=Baz");
+        assert(r < 0);
+        assert(!strcmp(error.name, "org.freedesktop.DBus.Error.MatchRuleNotFound"));
+        sd_bus_error_free(&error);
+
+        r = sd_bus_emit_signal(sender, "/org/example", "org.example", "Foo", "");
+        assert(r >= 0);
+
+        util_broker_consume_signal(receiver, "org.example", "Foo");
+
+        /* a rule cannot be removed more often than it was added */
+        r = sd_bus_call_method(receiver, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.bus1.DBus.Broker",
+                               "RemoveMatches", &error, NULL,
+                               "as", 2, "interface=org.example,member=Bar", "interface=org.example,member=Bar");
+        assert(r < 0);
+        assert(!strcmp(error.name, "org.freedesktop.DBus.Error.MatchRuleNotFound"));
+        sd_bus_error_free(&error);
+
+        r = sd_bus_emit_signal(sender, "/org/example", "org.example", "Bar", "");
+        assert(r >= 0);
+
+        util_broker_consume_signal(receiver, "org.example", "Bar");
+
+        /* remove several rules with a single call */
+        r = sd_bus_call_method(receiver, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.bus1.DBus.Broker",
+                               "RemoveMatches", NULL, NULL,
+                               "as", 1, "interface=org.example,member=Foo");
+        assert(r >= 0);
+
+        r = sd_bus_emit_signal(sender, "/org/example", "org.example", "Foo", "");
+        assert(r >= 0);
+        r = sd_bus_emit_signal(sender, "/org/example", "org.example", "Bar", "");
+        assert(r >= 0);
+
+        util_broker_consume_signal(receiver, "org.example", "Bar");
+
+        util_broker_terminate(broker);
+}
+
+static void test_stats(void) {
+        _c_cleanup_(util_broker_freep) Broker *broker = NULL;
+        _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *sender = NULL;
+        _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *receiver = NULL;
+        _c_cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
+        const char *unique_name, *name, *rule;
+        uint64_t n_evaluations, n_hits;
+        bool found = false;
+        int r;
+
+        util_broker_new(&broker);
+        util_broker_spawn(broker);
+
+        util_broker_connect(broker, &sender);
+        util_broker_connect(broker, &receiver);
+
+        r = sd_bus_get_unique_name(receiver, &unique_name);
+        assert(r >= 0);
+
+        r = sd_bus_add_match(receiver, NULL, "member=Foo,interface=org.example", NULL, NULL);
+        assert(r >= 0);
+
+        r = sd_bus_emit_signal(sender, "/org/example", "org.example", "Foo", "");
+        assert(r >= 0);
+
+        util_broker_consume_signal(receiver, "org.example", "Foo");
+
+        /* the rule is reported in canonical form, with its counters */
+        r = sd_bus_call_method(sender, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.bus1.DBus.Broker",
+                               "GetMatchStats", NULL, &reply, "");
+        assert(r >= 0);
+
+        r = sd_bus_message_enter_container(reply, 'a', "{sa(stt)}");
+        assert(r >= 0);
+
+        while (!sd_bus_message_at_end(reply, false)) {
+                r = sd_bus_message_enter_container(reply, 'e', "sa(stt)");
+                assert(r >= 0);
+
+                r = sd_bus_message_read(reply, "s", &name);
+                assert(r >= 0);
+
+                r = sd_bus_message_enter_container(reply, 'a', "(stt)");
+                assert(r >= 0);
+
+                while ((r = sd_bus_message_read(reply, "(stt)", &rule, &n_evaluations, &n_hits)) > 0) {
+                        if (strcmp(name, unique_name) || strcmp(rule, "interface='org.example',member='Foo'"))
+                                continue;
+
+                        assert(n_evaluations >= 1);
+                        assert(n_hits >= 1);
+                        found = true;
+                }
+                assert(r >= 0);
+
+                r = sd_bus_message_exit_container(reply);
+                assert(r >= 0);
+
+                r = sd_bus_message_exit_container(reply);
+                assert(r >= 0);
+        }
+
+        r = sd_bus_message_exit_container(reply);
+        assert(r >= 0);
+
+        assert(found);
+
+        util_broker_terminate(broker);
+}
+
 int main(int argc, char **argv) {
         test_wildcard();
         test_unique_name();
         test_well_known_name();
+        test_name_change();
         test_driver();
         test_noc_wildcard();
         test_noc_unique();
         test_noc_well_known();
         test_noc_driver();
+        test_bulk();
+        test_stats();
 }